@@ -5,6 +5,9 @@
 
 #include "NIRS/NIRS.h"
 #include "NIRS/Snirf.h"
+#include "NIRS/Quality.h"
+
+#include <future>
 
 #include "Renderer/Renderer.h"
 #include "Renderer/Renderable/Shader.h"
@@ -45,6 +48,11 @@ public:
 
 	void HandleSNIRFLoaded();
 
+	// SCI / PSP of the active run on the ThreadPool, queued behind a task that is still running.
+	// Reports come from NIRS::ChannelQualityCache, so a file is only analysed once.
+	void ComputeChannelQuality();
+	void HandleQualityReport(const Ref<const NIRS::QualityReport>& report);
+
 	void DrawBackground();
 	void DrawSourcesAndDetectors();
 	void DrawChannels();
@@ -74,6 +82,14 @@ private:
 
 	std::vector<NIRS::ChannelID> m_SelectedChannels = {};
 
+	// --- Channel Quality ---
+	bool m_ColorByQuality = true;
+	Ref<const NIRS::QualityReport> m_QualityReport = nullptr;
+	std::map<NIRS::ChannelID, glm::vec4> m_QualityColors; // Built once per report, DrawChannels only looks them up
+	std::future<Ref<const NIRS::QualityReport>> m_QualityTask;
+	bool m_QualityRecompute = false; // Requested while m_QualityTask was running
+	std::string m_QualityFilepath = "";
+
 	std::map<NIRS::ProbeID, NIRS::Probe2D> m_Sources;
 	std::map<NIRS::ProbeID, NIRS::Probe2D> m_Detectors;
 
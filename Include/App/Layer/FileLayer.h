@@ -1,7 +1,14 @@
 #pragma once
 #include "Core/Base.h"
 #include "Core/Layer.h"
+#include "Events/EventBus.h"
+
+#include <thread>
+#include <atomic>
+#include <filesystem>
+
 class Cortex;
+class SNIRF;
 
 class FileLayer : public Layer {
 public:
@@ -25,4 +32,21 @@ public:
 	void LoadSNIRFFile();
 	void LoadHeadAnatomy();
 	void LoadCortexAnatomy();
+
+	// Reads the file on a worker thread. The SNIRF asset is registered as soon as its channel
+	// table is known, the samples and channels fill in while the layers keep rendering.
+	void LoadSNIRFFileAsync(const std::filesystem::path& filepath);
+	bool IsLoadingSNIRF() const { return m_LoadingSNIRF.load(); };
+
+private:
+	void HandleSNIRFLoadProgress(const OnSNIRFLoadProgress& e);
+	void RenderLoadingProgress();
+
+	std::thread m_LoadThread;
+	std::atomic<bool> m_LoadingSNIRF{ false };
+
+	Ref<SNIRF> m_PendingSNIRF = nullptr; // Loading, not yet registered with the AssetManager
+	std::string m_LoadingFilepath = "";
+	float m_LoadProgress = 0.0f;
+	size_t m_ReadyChannels = 0;
 };
\ No newline at end of file
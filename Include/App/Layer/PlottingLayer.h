@@ -10,6 +10,11 @@
 #include "Renderer/Camera/OrbitCamera.h"
 
 #include "NIRS/Snirf.h"
+#include "NIRS/Pipeline.h"
+#include "NIRS/Spectral.h"
+#include "NIRS/GLM.h"
+#include "NIRS/Epochs.h"
+#include "NIRS/LevelOfDetail.h"
 
 enum PlottingWavelength {
 	HBO_ONLY = 0,
@@ -17,6 +22,19 @@ enum PlottingWavelength {
 	HBO_AND_HBR = 2,
 };
 
+enum PlotData {
+	RAW_DATA = 0,
+	PREPROCESSED_DATA = 1,	// SNIRFRun::ProcessedRegistry, once the run is loaded
+	STREAM_DATA = 2,		// The processing stream's output, once it has run
+};
+
+enum PlotMode {
+	TIME_SERIES = 0,
+	POWER_SPECTRUM = 1,
+	SPECTROGRAM = 2,
+	BLOCK_AVERAGE = 3,
+};
+
 class PlottingLayer : public Layer {
 public:
 	PlottingLayer(const EntityID& settingsID);
@@ -40,13 +58,107 @@ public:
 	void SetChannelValuesAtTimeIndex(int index);
 
 	void EditProcessingStream();
+	// Brings the processing stream up to date for the active run, only changed stages are recomputed
+	void RunProcessingStream();
+
+	void EditGLM();
+	// Fits the GLM to the plotted data: the processing stream's output, the preprocessed or the raw run
+	void RunGLM();
+	// Sends the selected condition's betas or t values of every channel to the projection
+	void ProjectGLMResult();
+	// Sends every channel's block average of the selected condition, at the selected time after onset, to the projection
+	void ProjectBlockAverage();
 private:
+	// The samples being plotted, the raw or preprocessed registry or the processing stream's output
+	struct PlotSource {
+		Ref<ChannelDataRegistry> Registry = nullptr;
+		double SamplingRate = 0.0;
+		double StartTime = 0.0;
+		size_t SampleCount = 0;		// Samples per channel that can be read
+		bool Complete = false;		// Every channel resident and fully loaded
+		bool Lazy = false;			// Channels are read from disk on demand, one at a time
+		NIRS::SignalType Type = NIRS::SignalType::Intensity; // Whether the arrays are HbO / HbR or the two wavelengths
+	};
+	PlotSource GetPlotSource() const;
+
+	// Spectra of the plotted arrays, kept until the selection, source or settings change
+	struct SpectralView {
+		uint64_t Key = 0;
+		Ref<ChannelDataRegistry> Registry = nullptr; // Held with the key, a new registry could reuse its address
+		std::vector<int> Indices = {};		// Plotted arrays, refilled every frame
+		std::vector<std::string> Labels = {};
+		std::vector<NIRS::PowerSpectrum> Spectra = {};
+		NIRS::Spectrogram Spectrogram;		// Of the first plotted array only
+		std::vector<float> Heatmap = {};	// Spectrogram in dB, highest frequency row first
+		float MinDecibel = 0.0f;
+		float MaxDecibel = 0.0f;
+		bool NeedAxisFit = false;
+	};
+	void UpdateSpectralView(const PlotSource& source);
+	void PlotSpectralView(const PlotSource& source);
+
+	// Recomputed only when the source or the epoch settings change
+	void UpdateBlockAverage(const PlotSource& source);
+	void PlotBlockAverage(const PlotSource& source);
+
+	// Min/max pyramids of every array of a complete source, built once and kept until the source changes
+	struct PlotPyramids {
+		Ref<ChannelDataRegistry> Registry = nullptr;
+		size_t ArrayCount = 0;
+		size_t SampleCount = 0;
+		std::vector<NIRS::MinMaxPyramid> Pyramids = {};
+	};
+	void UpdatePlotPyramids(const PlotSource& source);
+	// Null when the array has no pyramid, it is then drawn from its raw samples
+	const NIRS::MinMaxPyramid* GetPlotPyramid(const ChannelDataRegistry* registry, int dataIndex) const;
+
+	// Draws only the visible part of the first 'count' samples, through 'pyramid' when there is one
+	// so that no more than about two points per pixel column reach ImPlot
+	void PlotChannel(const char* label, ChannelDataRegistry::ChannelView data, int count, double samplingRate, double startTime,
+		const NIRS::MinMaxPyramid* pyramid = nullptr);
+	// Onsets and durations of the events inside the visible time range, one legend entry per condition
+	void PlotEventMarkers();
+	void PlotAuxChannels();
+
 	Ref<SNIRF> m_SNIRF;
 	
 
 	float m_DeltaTime = 0.0f;
 	bool m_EditingProcessingStream = false;
 
+	Ref<NIRS::ProcessingPipeline> m_Pipeline = NIRS::ProcessingPipeline::CreateDefault();
+	Ref<const NIRS::StageResult> m_StreamResult = nullptr;
+	PlotData m_PlotData = PREPROCESSED_DATA; // Falls back to the raw data while the choice is not available
+
+	PlotPyramids m_PlotPyramids;
+
+	PlotMode m_PlotMode = TIME_SERIES;
+	NIRS::SpectralSettings m_SpectralSettings;
+	SpectralView m_SpectralView;
+
+	bool m_EditingGLM = false;
+	NIRS::GLMSettings m_GLMSettings;
+	Ref<const NIRS::GLMResult> m_GLMResult = nullptr;
+	int m_GLMCondition = 0;
+	bool m_GLMShowTValues = true;
+	bool m_ProjectGLM = false; // While set the projection shows the GLM instead of the values at the time tag
+
+	NIRS::EpochSettings m_EpochSettings;
+	Ref<const NIRS::BlockAverage> m_BlockAverage = nullptr;
+	uint64_t m_BlockAverageKey = 0;
+	Ref<ChannelDataRegistry> m_BlockAverageRegistry = nullptr; // Held with the key, a new registry could reuse its address
+	int m_BlockAverageCondition = 0;
+	double m_BlockAverageTime = 5.0;	// Seconds after the onset shown on the projection
+	bool m_ProjectBlockAverage = false;
+	// Mean -/+ standard error of one line against epoch time, reused every frame
+	std::vector<double> m_ShadeTime = {};
+	std::vector<double> m_ShadeLower = {};
+	std::vector<double> m_ShadeUpper = {};
+
+	bool m_ShowEvents = true;
+	std::vector<double> m_EventOnsets = {}; // Visible onsets of one condition, reused every frame
+	std::vector<size_t> m_PlottedAux = {};	// Indices into the run's aux channels
+
 	unsigned int m_TimeIndex = 0;
 
 	double m_TagSliderValue = 0.0f; 
@@ -17,6 +17,8 @@
 #include "NIRS/NIRS.h"
 #include "NIRS/Snirf.h"
 
+#include <set>
+
 struct ProbeVisual {
 	NIRS::Probe3D Probe3D;
 	NIRS::Probe2D Probe2D;
@@ -75,6 +77,8 @@ private:
 	std::vector<NIRS::Channel> m_Channels; // Copy of sNIRF channels, the timeseries data is seperatetly stored, so this is fine. 
 	std::map<NIRS::ChannelID, NIRS::Channel> m_ChannelMap; // The idientifer is artificial, just an index to correlate visuals to the correct channel
 	std::map<NIRS::ChannelID, NIRS::ChannelVisualization> m_ChannelVisualsMap;
+	std::set<NIRS::ChannelID> m_ReadyChannels; // Channels whose data is fully loaded
+	bool m_ChannelVisualsDirty = false; // Set by the ready events, the visuals are rebuilt in the next OnUpdate
 
 	// Uses a vector because its not sure every channel actually hits the cortex.
 	std::map<NIRS::ChannelID, glm::vec3> m_ChannelProjectionIntersections; // Channel index to intersection point on cortex
@@ -6,6 +6,7 @@
 
 #include "Core/Input.h"
 #include "Core/AssetManager.h"	
+#include "Core/ThreadPool.h"
 
 #include "Events/MouseCodes.h"
 #include "Events/KeyCodes.h"
@@ -16,6 +17,35 @@
 #define DETECTOR_OFFSET 1024
 #define CHANNEL_OFFSET 2048
 
+namespace Utils {
+
+	// Red through yellow to green as more of the channel's windows pass
+	static glm::vec4 QualityToColor(float goodFraction)
+	{
+		const float t = std::clamp(goodFraction, 0.0f, 1.0f);
+		if (t < 0.5f) return glm::vec4(1.0f, 2.0f * t, 0.0f, 1.0f);
+		return glm::vec4(2.0f * (1.0f - t), 1.0f, 0.0f, 1.0f);
+	}
+
+	// Texture.frag multiplies by u_Color when u_UseColor is set. Every draw with the shared
+	// texture shader sets both, otherwise it would keep the tint of the draw before it.
+	static void AppendTint(RenderCommand& cmd, bool useColor, const glm::vec4& color = glm::vec4(1.0f))
+	{
+		UniformData use;
+		use.Name = "u_UseColor";
+		use.Type = UniformDataType::INT1;
+		use.Data.i1 = useColor ? 1 : 0;
+
+		UniformData tint;
+		tint.Name = "u_Color";
+		tint.Type = UniformDataType::FLOAT4;
+		tint.Data.f4 = color;
+
+		cmd.UniformCommands.push_back(use);
+		cmd.UniformCommands.push_back(tint);
+	}
+}
+
 ChannelSelectorLayer::ChannelSelectorLayer(const EntityID& settingsID) : Layer(settingsID)
 {
 }
@@ -52,6 +82,11 @@ void ChannelSelectorLayer::OnAttach()
 	EventBus::Instance().Subscribe<OnSNIRFLoaded>([this](const OnSNIRFLoaded& e){
 		this->HandleSNIRFLoaded();
 	});
+	EventBus::Instance().Subscribe<OnSNIRFLoadProgress>([this](const OnSNIRFLoadProgress& e) {
+		// Quality needs every sample, lazy files wait for the Compute button
+		auto snirf = AssetManager::Get<SNIRF>("SNIRF");
+		if (e.Finished && snirf && !snirf->IsLazyLoaded()) this->ComputeChannelQuality();
+	});
 }
 
 void ChannelSelectorLayer::OnDetach()
@@ -60,6 +95,14 @@ void ChannelSelectorLayer::OnDetach()
 
 void ChannelSelectorLayer::OnUpdate(float dt)
 {
+	if (m_QualityTask.valid() && m_QualityTask.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		HandleQualityReport(m_QualityTask.get());
+		if (m_QualityRecompute) {
+			m_QualityRecompute = false;
+			ComputeChannelQuality();
+		}
+	}
+
 	auto camera = ViewportManager::GetViewport("ChannelSelectorViewport").CameraPtr;
 	camera->UpdateProjectionMatrix();
 	camera->UpdateViewMatrix();
@@ -84,6 +127,22 @@ void ChannelSelectorLayer::OnImGuiRender()
 	ImGui::Text("Use Right Click to Select Channel");
 	m_OrthoCamera->OnImGuiRender(false);
 
+	ImGui::SeparatorText("Channel Quality");
+	ImGui::Checkbox("Color by Quality", &m_ColorByQuality);
+	if (m_QualityTask.valid()) {
+		ImGui::Text("Computing SCI / PSP ...");
+	}
+	else if (m_QualityReport) {
+		const auto& settings = m_QualityReport->Settings;
+		size_t good = 0;
+		for (const auto& channel : m_QualityReport->Channels) good += channel.GoodFraction >= 0.5f ? 1 : 0;
+		ImGui::Text("%zu of %zu channels good in most windows", good, m_QualityReport->Channels.size());
+		ImGui::Text("SCI >= %.2f, PSP >= %.2f over %.1f s windows", settings.SCIThreshold, settings.PSPThreshold, settings.WindowSeconds);
+	}
+	else if (ImGui::Button("Compute Channel Quality")) {
+		ComputeChannelQuality();
+	}
+
 	ImGui::End();
 
 
@@ -218,6 +277,8 @@ void ChannelSelectorLayer::HandleSNIRFLoaded()
 	auto snirf = AssetManager::Get<SNIRF>("SNIRF");
 	m_ChannelVisuals.clear(); 
 	m_SelectedChannels.clear();
+	m_QualityReport = nullptr; // A pending task of the previous file is dropped once it finishes
+	m_QualityColors.clear();
 	m_Channels = snirf->GetChannelMap();
 	m_Sources = snirf->GetSource2DMap();
 	m_Detectors = snirf->GetDetector2DMap();
@@ -240,6 +301,38 @@ void ChannelSelectorLayer::HandleSNIRFLoaded()
 	}
 }
 
+void ChannelSelectorLayer::ComputeChannelQuality()
+{
+	auto snirf = AssetManager::Get<SNIRF>("SNIRF");
+	if (!snirf || !snirf->IsFileLoaded()) return;
+	if (m_QualityTask.valid()) {
+		m_QualityRecompute = true; // Possibly another file, OnUpdate starts over once the running task is done
+		return;
+	}
+
+	m_QualityFilepath = snirf->GetFilepath();
+	const size_t run = snirf->GetActiveRunIndex();
+
+	// The report only reads the registry, the SNIRF is kept alive until it is done
+	m_QualityTask = ThreadPool::Instance().Submit([snirf, run, filepath = m_QualityFilepath]() {
+		return NIRS::ChannelQualityCache::Get(filepath, snirf->GetRun(run));
+	});
+}
+
+void ChannelSelectorLayer::HandleQualityReport(const Ref<const NIRS::QualityReport>& report)
+{
+	auto snirf = AssetManager::Get<SNIRF>("SNIRF");
+	if (!report || !snirf || snirf->GetFilepath() != m_QualityFilepath) return;
+
+	m_QualityReport = report;
+	m_QualityColors.clear();
+
+	const auto& channels = snirf->GetRun(snirf->GetActiveRunIndex()).Channels;
+	for (size_t i = 0; i < channels.size() && i < report->Channels.size(); i++) {
+		m_QualityColors[channels[i].ID] = Utils::QualityToColor(report->Channels[i].GoodFraction);
+	}
+}
+
 void ChannelSelectorLayer::DrawBackground()
 {
 	RenderCommand cmd;
@@ -263,6 +356,7 @@ void ChannelSelectorLayer::DrawBackground()
 	id.Type = UniformDataType::INT1;
 	id.Data.i1 = BACKGROUND_ID;
 	cmd.UniformCommands = { texUnifrom, id };
+	Utils::AppendTint(cmd, false);
 
 	Renderer::Submit(cmd);
 }
@@ -302,6 +396,7 @@ void ChannelSelectorLayer::DrawSourcesAndDetectors()
 		id.Type = UniformDataType::INT1;
 		id.Data.i1 = source.ID + SOURCE_OFFSET;
 		cmd.UniformCommands = { texUnifrom, id };
+		Utils::AppendTint(cmd, false);
 
 		Renderer::Submit(cmd);
 	}
@@ -330,6 +425,7 @@ void ChannelSelectorLayer::DrawSourcesAndDetectors()
 		id.Type = UniformDataType::INT1;
 		id.Data.i1 = detector.ID + DETECTOR_OFFSET;
 		cmd.UniformCommands = { texUnifrom, id };
+		Utils::AppendTint(cmd, false);
 
 		Renderer::Submit(cmd);
 	}
@@ -375,6 +471,10 @@ void ChannelSelectorLayer::DrawChannels()
 		id.Type = UniformDataType::INT1;
 		id.Data.i1 = ID + CHANNEL_OFFSET;
 		cmd.UniformCommands = { texUnifrom, id };
+
+		auto quality = m_QualityColors.find(ID);
+		const bool tinted = m_ColorByQuality && quality != m_QualityColors.end();
+		Utils::AppendTint(cmd, tinted, tinted ? quality->second : glm::vec4(1.0f));
 		Renderer::Submit(cmd);
 	}
 
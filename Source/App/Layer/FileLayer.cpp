@@ -47,13 +47,19 @@ void FileLayer::OnAttach()
 
 
 	// SNIRF
-	Ref<SNIRF> snirf = CreateRef<SNIRF>(snirfFilepath);
-	AssetManager::Register<SNIRF>("SNIRF", snirf);
-	EventBus::Instance().Publish<OnSNIRFLoaded>({});
+	EventBus::Instance().Subscribe<OnSNIRFLoadProgress>([this](const OnSNIRFLoadProgress& e) {
+		this->HandleSNIRFLoadProgress(e);
+	});
+	EventBus::Instance().Subscribe<OnSNIRFChannelReady>([this](const OnSNIRFChannelReady& e) {
+		m_ReadyChannels++;
+	});
+
+	LoadSNIRFFileAsync(snirfFilepath);
 }
 
 void FileLayer::OnDetach()
 {
+	if (m_LoadThread.joinable()) m_LoadThread.join();
 }
 
 void FileLayer::OnUpdate(float dt)
@@ -66,7 +72,7 @@ void FileLayer::OnRender()
 
 void FileLayer::OnImGuiRender()
 {
-	
+	if (m_LoadingSNIRF) RenderLoadingProgress();
 }
 
 void FileLayer::OnEvent(Event& event)
@@ -79,7 +85,7 @@ void FileLayer::RenderMenuBar()
 
 
 
-		if(ImGui::MenuItem("Open fNIRS file")) {
+		if(ImGui::MenuItem("Open fNIRS file", nullptr, false, !m_LoadingSNIRF)) {
 			// On Load SNIRF File
 			LoadSNIRFFile();
 		}
@@ -124,14 +130,78 @@ void FileLayer::LoadSNIRFFile()
 
 	if (!GetOpenFileNameA(&ofn)) return;
 
-	if (!AssetManager::Get<SNIRF>("SNIRF")) { //
-		AssetManager::Register<SNIRF>("SNIRF", CreateRef<SNIRF>());
+	LoadSNIRFFileAsync(std::string(filePath));
+}
+
+void FileLayer::LoadSNIRFFileAsync(const std::filesystem::path& filepath)
+{
+	if (m_LoadingSNIRF) {
+		NVIZ_WARN("Already loading {}, ignoring {}", m_LoadingFilepath, filepath.string());
+		return;
 	}
+	if (m_LoadThread.joinable()) m_LoadThread.join();
+
+	// Loaded into a new SNIRF so the current one keeps rendering until the new one is ready
+	auto snirf = CreateRef<SNIRF>();
+	const std::string path = filepath.string();
+
+	// The callbacks run on the loading thread, the events reach the layers on the main thread
+	snirf->SetMetadataLoadedCallback([path](const SNIRFRun& run) {
+		EventBus::Instance().Enqueue<OnSNIRFLoadProgress>({ path, 0, run.Time.size(), false });
+	});
+	snirf->SetChunkLoadedCallback([path](size_t loaded, size_t total) {
+		EventBus::Instance().Enqueue<OnSNIRFLoadProgress>({ path, loaded, total, false });
+	});
+	snirf->SetChannelReadyCallback([](const SNIRFRun& run, NIRS::ChannelID id) {
+		EventBus::Instance().Enqueue<OnSNIRFChannelReady>({ id });
+	});
+
+	m_PendingSNIRF = snirf;
+	m_LoadingFilepath = path;
+	m_LoadProgress = 0.0f;
+	m_ReadyChannels = 0;
+	m_LoadingSNIRF = true;
+
+	m_LoadThread = std::thread([snirf, filepath]() {
+		// The finished event is queued either way, a failed load is picked up by HandleSNIRFLoadProgress
+		try {
+			snirf->LoadFile(filepath);
+		}
+		catch (const std::exception& e) {
+			NVIZ_ERROR("Failed to load SNIRF file {} : {}", filepath.string(), e.what());
+		}
+		EventBus::Instance().Enqueue<OnSNIRFLoadProgress>({ filepath.string(), snirf->GetLoadedSampleCount(), snirf->GetTime().size(), true });
+	});
+}
 
-	auto snirf = AssetManager::Get<SNIRF>("SNIRF");
-	snirf->LoadFile(std::string(filePath));
+void FileLayer::HandleSNIRFLoadProgress(const OnSNIRFLoadProgress& e)
+{
+	// The first event of a load means the channel table is there, hand the SNIRF to the layers
+	if (m_PendingSNIRF && e.Filepath == m_LoadingFilepath && !e.Finished) {
+		AssetManager::Register<SNIRF>("SNIRF", m_PendingSNIRF);
+		m_PendingSNIRF = nullptr;
+		EventBus::Instance().Publish<OnSNIRFLoaded>({});
+	}
+
+	if (e.TotalSamples > 0) m_LoadProgress = static_cast<float>(e.LoadedSamples) / e.TotalSamples;
 
-	EventBus::Instance().Publish<OnSNIRFLoaded>({});
+	if (e.Finished && e.Filepath == m_LoadingFilepath) {
+		if (m_LoadThread.joinable()) m_LoadThread.join();
+		if (m_PendingSNIRF) {
+			NVIZ_ERROR("Failed to load SNIRF file : {}", e.Filepath);
+			m_PendingSNIRF = nullptr;
+		}
+		m_LoadingSNIRF = false;
+	}
+}
+
+void FileLayer::RenderLoadingProgress()
+{
+	ImGui::Begin("Loading");
+	ImGui::TextWrapped("%s", m_LoadingFilepath.c_str());
+	ImGui::ProgressBar(m_LoadProgress, ImVec2(-1.0f, 0.0f));
+	ImGui::Text("Channels ready : %zu", m_ReadyChannels);
+	ImGui::End();
 }
 
 void FileLayer::LoadHeadAnatomy()
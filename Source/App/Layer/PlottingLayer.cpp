@@ -6,8 +6,25 @@
 #include <implot.h>
 #include <implot_internal.h>
 #include "Core/AssetManager.h"
+#include "Core/Hash.h"
+#include "Core/Timer.h"
 #include "Events/EventBus.h"
 
+#include "NIRS/Benchmark.h"
+
+namespace Utils {
+
+	// "Channel 12 - HbO" for concentrations, "Channel 12 - 850 nm" for intensities and optical density.
+	// Written into the caller's buffer rather than a new string every frame.
+	template<size_t N>
+	static void FormatArrayLabel(char (&label)[N], const NIRS::Channel& channel, bool hbo, NIRS::SignalType type)
+	{
+		const float wavelength = hbo ? channel.HBOWavelength : channel.HBRWavelength;
+		if (type == NIRS::SignalType::Concentration || wavelength <= 0.0f) std::snprintf(label, N, "Channel %u - %s", channel.ID, hbo ? "HbO" : "HbR");
+		else std::snprintf(label, N, "Channel %u - %.0f nm", channel.ID, wavelength);
+	}
+}
+
 PlottingLayer::PlottingLayer(const EntityID& settingsID) : Layer(settingsID)
 {
 }
@@ -20,10 +37,33 @@ void PlottingLayer::OnAttach()
 {
 	EventBus::Instance().Subscribe<OnSNIRFLoaded>([this](const OnSNIRFLoaded& e) {
 		m_SNIRF = AssetManager::Get<SNIRF>("SNIRF");
+		m_StreamResult = nullptr; // Stage results belong to the previous file
+		m_Pipeline->ClearCache();
+
+		// A stream built for another kind of file is swapped for the default chain this one can take
+		const auto& run = m_SNIRF->GetRun(m_SNIRF->GetActiveRunIndex());
+		std::string error;
+		if (!m_Pipeline->Validate(run, m_Pipeline->GetOutput(), &error)) {
+			NVIZ_INFO("{}, using the default processing stream for {}", error, run.GetName());
+			m_Pipeline = NIRS::ProcessingPipeline::CreateDefault(run);
+		}
+		m_GLMResult = nullptr;
+		m_ProjectGLM = false;
+		m_BlockAverage = nullptr;
+		m_BlockAverageKey = 0;
+		m_BlockAverageRegistry = nullptr;
+		m_ProjectBlockAverage = false;
+		m_PlottedAux.clear();
+		m_PlotPyramids = {};
+		m_SpectralView = {};
 	});
 	EventBus::Instance().Subscribe<OnChannelsSelected>([this](const OnChannelsSelected& e) {
 		this->HandleSelectedChannels(e.selectedIDs);
 	});
+	EventBus::Instance().Subscribe<OnSNIRFLoadProgress>([this](const OnSNIRFLoadProgress& e) {
+		// Refit once when the last samples are in, rather than for every channel that becomes ready
+		if (e.Finished && !m_SelectedChannels.empty()) this->HandleSelectedChannels(m_SelectedChannels);
+	});
 
 }
 
@@ -44,8 +84,14 @@ void PlottingLayer::OnRender()
 void PlottingLayer::OnImGuiRender()
 {
 	if (m_EditingProcessingStream) EditProcessingStream();
+	if (m_EditingGLM) EditGLM();
 
 	ImGui::Begin("Plotting");
+	if (!m_SNIRF) { // Still loading on the FileLayer thread
+		ImGui::Text("Loaded SNIRF file : ...");
+		ImGui::End();
+		return;
+	}
 	ImGui::Text("Loaded SNIRF file : %s", m_SNIRF->GetFilepath().c_str());
 
 	ImGui::Separator(); 
@@ -62,21 +108,76 @@ void PlottingLayer::OnImGuiRender()
 		m_PlottingWavelength = HBO_AND_HBR;
 		
 	}
+	ImGui::Text("Data : ");
+	ImGui::SameLine();
+	if (ImGui::RadioButton("Raw", m_PlotData == RAW_DATA)) {
+		m_PlotData = RAW_DATA;
+		HandleSelectedChannels(m_SelectedChannels);
+	}
+	ImGui::SameLine();
+	if (ImGui::RadioButton("Preprocessed", m_PlotData == PREPROCESSED_DATA)) {
+		m_PlotData = PREPROCESSED_DATA;
+		HandleSelectedChannels(m_SelectedChannels);
+	}
+	if (m_StreamResult) {
+		ImGui::SameLine();
+		if (ImGui::RadioButton("Processed Stream", m_PlotData == STREAM_DATA)) {
+			m_PlotData = STREAM_DATA;
+			HandleSelectedChannels(m_SelectedChannels);
+		}
+	}
+	ImGui::Text("View : ");
+	ImGui::SameLine();
+	if (ImGui::RadioButton("Time Series", m_PlotMode == TIME_SERIES)) {
+		m_PlotMode = TIME_SERIES;
+	}
+	ImGui::SameLine();
+	if (ImGui::RadioButton("Power Spectrum", m_PlotMode == POWER_SPECTRUM)) {
+		m_PlotMode = POWER_SPECTRUM;
+	}
+	ImGui::SameLine();
+	if (ImGui::RadioButton("Spectrogram", m_PlotMode == SPECTROGRAM)) {
+		m_PlotMode = SPECTROGRAM;
+	}
+	ImGui::SameLine();
+	if (ImGui::RadioButton("Block Average", m_PlotMode == BLOCK_AVERAGE)) {
+		m_PlotMode = BLOCK_AVERAGE;
+	}
+	if (m_PlotMode == POWER_SPECTRUM || m_PlotMode == SPECTROGRAM) {
+		ImGui::SliderFloat("Segment (s)", &m_SpectralSettings.SegmentSeconds, 5.0f, 300.0f, "%.0f");
+		ImGui::SliderFloat("Overlap", &m_SpectralSettings.Overlap, 0.0f, 0.9f, "%.2f");
+	}
+	else if (m_PlotMode == BLOCK_AVERAGE) {
+		ImGui::SliderFloat("Pre Stimulus (s)", &m_EpochSettings.PreStimulus, 0.0f, 20.0f, "%.1f");
+		ImGui::SliderFloat("Post Stimulus (s)", &m_EpochSettings.PostStimulus, 1.0f, 60.0f, "%.1f");
+		ImGui::Checkbox("Baseline Correction", &m_EpochSettings.BaselineCorrect);
+	}
 	ImGui::Separator();
 	
-	auto fs = m_SNIRF->GetSamplingRate();
-	auto time = m_SNIRF->GetTime();
+	const PlotSource source = GetPlotSource();
+	if (m_PlotMode == BLOCK_AVERAGE) {
+		PlotBlockAverage(source);
+		ImGui::End();
+		return;
+	}
+	if (m_PlotMode != TIME_SERIES) {
+		PlotSpectralView(source);
+		ImGui::End();
+		return;
+	}
+	auto fs = source.SamplingRate;
+	UpdatePlotPyramids(source);
 
-	auto channelMap = m_SNIRF->GetChannelMap();
-	auto channelRegistry = m_SNIRF->GetChannelDataRegistry();
+	const auto& channelMap = m_SNIRF->GetChannelMap();
+	const auto& channelRegistry = source.Registry;
 
-	size_t channel_num = m_SelectedChannels.size();
+	int sample_count = static_cast<int>(source.SampleCount); // Only plot what the reader has streamed in
 
 	ImGui::Separator();
 	ImGui::Text("Tag Value: %.4f", m_TagSliderValue);
-	if (m_TimeIndex < time.size() && m_TimeIndex >= 0) {
+	if (m_TimeIndex < source.SampleCount && m_TimeIndex >= 0) {
 		ImGui::Text("Time Index : %zu", m_TimeIndex);
-		ImGui::Text("Actual Time : %.4f s", time[m_TimeIndex]);
+		ImGui::Text("Actual Time : %.4f s", source.StartTime + m_TimeIndex / fs);
 	}
 	else {
 		ImGui::Text("Time Index : N/A");
@@ -86,11 +187,32 @@ void PlottingLayer::OnImGuiRender()
 	static bool showTags = true;
 	ImGui::Checkbox("Show Tags", &showTags);
 
+	const bool runLoaded = m_SNIRF->IsRunLoaded();
+	if (runLoaded && !m_SNIRF->GetEventIndex().IsEmpty()) {
+		ImGui::SameLine();
+		ImGui::Checkbox("Show Events", &m_ShowEvents);
+	}
+	const auto& auxChannels = m_SNIRF->GetAuxChannels();
+	if (runLoaded && !auxChannels.empty()) {
+		ImGui::Text("Aux : ");
+		for (size_t i = 0; i < auxChannels.size(); i++) {
+			ImGui::SameLine();
+			auto it = std::find(m_PlottedAux.begin(), m_PlottedAux.end(), i);
+			bool plotted = it != m_PlottedAux.end();
+			if (ImGui::Checkbox(auxChannels[i].Name.c_str(), &plotted)) {
+				if (plotted) m_PlottedAux.push_back(i);
+				else m_PlottedAux.erase(it);
+			}
+		}
+	}
+	const bool plotAux = runLoaded && !m_PlottedAux.empty();
+
 	if (ImPlot::BeginPlot("##Tags")) {
 		ImPlot::SetupAxis(ImAxis_X1);
 		ImPlot::SetupAxis(ImAxis_Y1);
 		ImPlot::SetupAxis(ImAxis_X2);
 		ImPlot::SetupAxis(ImAxis_Y2);
+		if (plotAux) ImPlot::SetupAxis(ImAxis_Y3, "Aux", ImPlotAxisFlags_AuxDefault | ImPlotAxisFlags_AutoFit);
 
 		// Apply calculated limits when channels are first selected or changed
 		if (m_NeedAxisFit && !m_SelectedChannels.empty()) {
@@ -109,40 +231,31 @@ void PlottingLayer::OnImGuiRender()
 		}
 
 
-		for(auto& channelID : m_SelectedChannels) {
-			if (channelMap.find(channelID) == channelMap.end()) {
+		// Straight from the registry and the pyramids, the labels go into a buffer on the stack, so a frame allocates nothing
+		char label[64];
+		for (auto& channelID : m_SelectedChannels) {
+			auto it = channelMap.find(channelID);
+			if (it == channelMap.end()) {
 				NVIZ_ERROR("Channel ID {} not found in channel map.", channelID);
 				continue;
 			}
-			auto& channel = channelMap[channelID];
-
-			std::string label; 
-			std::vector<double> data;
-			switch (m_PlottingWavelength) {
-				case(HBO_ONLY):
-					label = "Channel " + std::to_string(channelID) + " - HbO";
-					data = channelRegistry->GetChannelData(channel.HBODataIndex);
-					ImPlot::PlotLine(label.c_str(), time.data(), data.data(), time.size());
-					break;
-
-				case(HBR_ONLY):
-					label = "Channel " + std::to_string(channelID) + " - HbR";
-					data = channelRegistry->GetChannelData(channel.HBRDataIndex);
-					ImPlot::PlotLine(label.c_str(), time.data(), data.data(), time.size());
-					break;
-
-				case(HBO_AND_HBR):
-					label = "Channel " + std::to_string(channelID) + " - HbO";
-					data = channelRegistry->GetChannelData(channel.HBODataIndex);
-					ImPlot::PlotLine(label.c_str(), time.data(), data.data(), time.size());
+			const auto& channel = it->second;
 
-					label = "Channel " + std::to_string(channelID) + " - HbR";
-					data = channelRegistry->GetChannelData(channel.HBRDataIndex);
-					ImPlot::PlotLine(label.c_str(), time.data(), data.data(), time.size());
-					break;
+			if (m_PlottingWavelength == HBO_ONLY || m_PlottingWavelength == HBO_AND_HBR) {
+				Utils::FormatArrayLabel(label, channel, true, source.Type);
+				PlotChannel(label, channelRegistry->GetChannelData(channel.HBODataIndex), sample_count, fs, source.StartTime,
+					GetPlotPyramid(channelRegistry.get(), channel.HBODataIndex));
+			}
+			if (m_PlottingWavelength == HBR_ONLY || m_PlottingWavelength == HBO_AND_HBR) {
+				Utils::FormatArrayLabel(label, channel, false, source.Type);
+				PlotChannel(label, channelRegistry->GetChannelData(channel.HBRDataIndex), sample_count, fs, source.StartTime,
+					GetPlotPyramid(channelRegistry.get(), channel.HBRDataIndex));
 			}
 		}
 
+		if (runLoaded && m_ShowEvents) PlotEventMarkers();
+		if (plotAux) PlotAuxChannels();
+
 		ImPlot::SetAxis(ImAxis_X2);
 
 		ImPlot::DragLineX(0, &m_TagSliderValue, ImVec4(1, 0.2, 0.2, 1), 1, ImPlotDragToolFlags_NoFit);
@@ -167,24 +280,614 @@ void PlottingLayer::OnImGuiRender()
 
 
 	ImGui::End();
-	ImPlot::ShowDemoWindow();
 }
 
 void PlottingLayer::OnEvent(Event& event)
 {
 }
 
+void PlottingLayer::UpdatePlotPyramids(const PlotSource& source)
+{
+	// Partly streamed or lazy sources keep drawing their raw samples, a lazy registry would have to read every array from disk
+	if (!source.Complete || !source.Registry) return;
+
+	auto& pyramids = m_PlotPyramids;
+	if (pyramids.Registry == source.Registry && pyramids.ArrayCount == source.Registry->GetChannelCount() && pyramids.SampleCount == source.SampleCount) return;
+
+	pyramids.Registry = source.Registry;
+	pyramids.ArrayCount = source.Registry->GetChannelCount();
+	pyramids.SampleCount = source.SampleCount;
+	pyramids.Pyramids = NIRS::BuildMinMaxPyramids(*source.Registry, source.SampleCount);
+}
+
+const NIRS::MinMaxPyramid* PlottingLayer::GetPlotPyramid(const ChannelDataRegistry* registry, int dataIndex) const
+{
+	const auto& pyramids = m_PlotPyramids;
+	if (!registry || registry != pyramids.Registry.get()) return nullptr;
+	if (dataIndex < 0 || static_cast<size_t>(dataIndex) >= pyramids.Pyramids.size()) return nullptr;
+	return &pyramids.Pyramids[dataIndex];
+}
+
+void PlottingLayer::PlotChannel(const char* label, ChannelDataRegistry::ChannelView data, int count, double samplingRate, double startTime,
+	const NIRS::MinMaxPyramid* pyramid)
+{
+	const size_t samples = std::min(static_cast<size_t>(std::max(count, 0)), data.size());
+	if (samplingRate <= 0.0) return;
+
+	// Samples under the x axis. While ImPlot fits the axes it is given the whole array, still decimated, so a fit covers all of it.
+	size_t first = 0;
+	size_t last = samples;
+	if (!ImPlot::FitThisFrame()) {
+		const ImPlotRect limits = ImPlot::GetPlotLimits(ImAxis_X1);
+		const double from = std::floor((limits.X.Min - startTime) * samplingRate);
+		const double to = std::ceil((limits.X.Max - startTime) * samplingRate) + 1.0;
+		first = from > 0.0 ? std::min(static_cast<size_t>(from), samples) : 0;
+		last = to > 0.0 ? std::min(static_cast<size_t>(to), samples) : 0;
+	}
+	const size_t width = static_cast<size_t>(std::max(ImPlot::GetPlotSize().x, 1.0f));
+
+	NIRS::DecimatedRange range;
+	if (pyramid) {
+		range = pyramid->GetRange(data, first, last, width);
+	}
+	else {
+		range.Values = data.subspan(first, std::max(first, last) - first);
+		range.FirstSample = static_cast<double>(first);
+	}
+
+	// Evenly spaced either way, so ImPlot generates x from the step and no time array has to match the sample type
+	ImPlot::PlotLine(label, range.Values.data(), static_cast<int>(range.Values.size()),
+		range.SampleStep / samplingRate, startTime + range.FirstSample / samplingRate);
+}
+
+void PlottingLayer::PlotEventMarkers()
+{
+	// Two binary searches per condition, the frame cost follows the visible events rather than all of them
+	const auto& index = m_SNIRF->GetEventIndex();
+	const auto& stimuli = m_SNIRF->GetStimuli();
+	const ImPlotRect limits = ImPlot::GetPlotLimits(ImAxis_X1, ImAxis_Y1);
+
+	for (size_t c = 0; c < index.GetConditionCount() && c < stimuli.size(); c++) {
+		// Events that start before the view can still last into it
+		auto events = index.GetEventsInWindow(c, limits.X.Min - index.GetLongestDuration(), limits.X.Max);
+
+		m_EventOnsets.clear();
+		for (const auto& event : events) {
+			if (event.Onset >= limits.X.Min) m_EventOnsets.push_back(event.Onset);
+		}
+		// Also plotted without visible onsets, so the condition keeps its legend entry and colour
+		ImPlot::PlotInfLines(stimuli[c].Name.c_str(), m_EventOnsets.data(), static_cast<int>(m_EventOnsets.size()));
+
+		const ImVec4 color = ImPlot::GetLastItemColor();
+		const ImU32 fill = ImGui::GetColorU32(ImVec4(color.x, color.y, color.z, 0.15f));
+		ImPlot::PushPlotClipRect();
+		for (const auto& event : events) {
+			if (event.Duration <= 0.0 || event.Onset + event.Duration < limits.X.Min) continue;
+			const ImVec2 topLeft = ImPlot::PlotToPixels(event.Onset, limits.Y.Max, ImAxis_X1, ImAxis_Y1);
+			const ImVec2 bottomRight = ImPlot::PlotToPixels(event.Onset + event.Duration, limits.Y.Min, ImAxis_X1, ImAxis_Y1);
+			ImPlot::GetPlotDrawList()->AddRectFilled(topLeft, bottomRight, fill);
+		}
+		ImPlot::PopPlotClipRect();
+	}
+}
+
+void PlottingLayer::PlotAuxChannels()
+{
+	// On their own axis, from the raw run whichever data is plotted, the stream's stages are meant for light
+	const auto& run = m_SNIRF->GetRun(m_SNIRF->GetActiveRunIndex());
+	if (run.Time.empty()) return;
+
+	ImPlot::SetAxes(ImAxis_X1, ImAxis_Y3);
+	for (size_t i : m_PlottedAux) {
+		if (i >= run.Aux.size()) continue;
+		const auto& aux = run.Aux[i];
+		auto data = run.Registry->GetChannelData(aux.DataIndex);
+		char label[96];
+		if (aux.Unit.empty()) std::snprintf(label, sizeof(label), "%s", aux.Name.c_str());
+		else std::snprintf(label, sizeof(label), "%s (%s)", aux.Name.c_str(), aux.Unit.c_str());
+		PlotChannel(label, data, static_cast<int>(data.size()), run.SamplingRate, run.Time.front(), GetPlotPyramid(run.Registry.get(), aux.DataIndex));
+	}
+	ImPlot::SetAxes(ImAxis_X1, ImAxis_Y1);
+}
+
 void PlottingLayer::EditProcessingStream()
 {
 	// Open Processing Panel
 	ImGui::Begin("Processing Stream Editor", &m_EditingProcessingStream);
 
-	ImGui::Button("+");
+	// The stream is edited as the chain leading to the plotted stage, new stages go at its end
+	auto chain = m_Pipeline->GetChain(m_Pipeline->GetOutput());
+	NIRS::ProcessingPipeline::StageID removed = NIRS::ProcessingPipeline::Source;
+
+	ImGui::Text("Raw Data");
+	for (auto id : chain) {
+		auto stage = m_Pipeline->GetStage(id);
+		ImGui::PushID(static_cast<int>(id));
+
+		bool open = ImGui::CollapsingHeader(stage->GetName().c_str(), ImGuiTreeNodeFlags_DefaultOpen | ImGuiTreeNodeFlags_AllowItemOverlap);
+		ImGui::SameLine(ImGui::GetContentRegionAvail().x - 60.0f);
+		ImGui::Checkbox("##Enabled", &stage->Enabled);
+		ImGui::SameLine();
+		if (ImGui::SmallButton("x")) removed = id;
+
+		if (open) {
+			// Edits only mark the stage dirty, Run Stream recomputes it and the stages below
+			for (auto& parameter : stage->GetParameters()) {
+				switch (parameter.Type) {
+				case NIRS::StageParameter::Kind::Float:
+					ImGui::DragFloat(parameter.Name, static_cast<float*>(parameter.Value), 0.001f, parameter.Min, parameter.Max, "%.3f");
+					break;
+				case NIRS::StageParameter::Kind::Int:
+					ImGui::SliderInt(parameter.Name, static_cast<int*>(parameter.Value), static_cast<int>(parameter.Min), static_cast<int>(parameter.Max));
+					break;
+				case NIRS::StageParameter::Kind::Bool:
+					ImGui::Checkbox(parameter.Name, static_cast<bool*>(parameter.Value));
+					break;
+				}
+			}
+		}
+		ImGui::PopID();
+	}
+	if (removed != NIRS::ProcessingPipeline::Source) m_Pipeline->RemoveStage(removed);
+
+	if (ImGui::Button("+")) ImGui::OpenPopup("AddStage");
+	if (ImGui::BeginPopup("AddStage")) {
+		for (auto type : NIRS::StageTypes) {
+			if (ImGui::MenuItem(NIRS::StageTypeToString(type).c_str())) m_Pipeline->AddStage(type, m_Pipeline->GetOutput());
+		}
+		ImGui::EndPopup();
+	}
 
+	// Checked while editing, a stage that cannot take its input is reported before anything runs
+	std::string error;
+	const bool valid = !m_SNIRF || m_Pipeline->Validate(m_SNIRF->GetRun(m_SNIRF->GetActiveRunIndex()), m_Pipeline->GetOutput(), &error);
+	if (valid) {
+		ImGui::SameLine();
+		if (ImGui::Button("Run")) RunProcessingStream();
+	}
+	else {
+		ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", error.c_str());
+	}
 
 	ImGui::End();
 }
 
+void PlottingLayer::RunProcessingStream()
+{
+	if (!m_SNIRF || !m_SNIRF->IsFileLoaded()) return;
+
+	const auto& run = m_SNIRF->GetRun(m_SNIRF->GetActiveRunIndex());
+	if (!run.Loaded.load(std::memory_order_acquire)) {
+		NVIZ_WARN("{} is still loading, run the stream once it is done", run.GetName());
+		return;
+	}
+
+	auto result = m_Pipeline->Run(run);
+	if (!result) return; // The pipeline logged which stage could not run
+
+	m_StreamResult = result;
+	m_PlotData = STREAM_DATA;
+	HandleSelectedChannels(m_SelectedChannels);
+}
+
+void PlottingLayer::EditGLM()
+{
+	ImGui::Begin("General Linear Model", &m_EditingGLM);
+	if (!m_SNIRF) {
+		ImGui::End();
+		return;
+	}
+
+	const auto& stimuli = m_SNIRF->GetStimuli();
+	ImGui::Text("Stimuli : %zu", stimuli.size());
+	for (const auto& stimulus : stimuli) ImGui::BulletText("%s (%zu events)", stimulus.Name.c_str(), stimulus.Events.size());
+
+	ImGui::Separator();
+	ImGui::DragFloat("HRF Length (s)", &m_GLMSettings.HRFLength, 0.5f, 10.0f, 60.0f, "%.1f");
+	ImGui::SliderInt("Drift Order", &m_GLMSettings.DriftOrder, 0, 10);
+	ImGui::Checkbox("AR(1) Prewhitening", &m_GLMSettings.Prewhiten);
+	if (ImGui::Button("Fit")) RunGLM();
+
+	if (m_GLMResult) {
+		const auto& result = *m_GLMResult;
+		ImGui::Separator();
+		ImGui::Text("%zu regressors, %zu degrees of freedom, AR(1) %.3f", result.Regressors.size(), result.DegreesOfFreedom, result.AutoCorrelation);
+
+		if (result.ConditionCount == 0) {
+			ImGui::Text("No stimulus has events inside the data");
+		}
+		else {
+			bool changed = false;
+			m_GLMCondition = std::clamp(m_GLMCondition, 0, static_cast<int>(result.ConditionCount) - 1);
+			if (ImGui::BeginCombo("Condition", result.Regressors[m_GLMCondition].c_str())) {
+				for (int i = 0; i < static_cast<int>(result.ConditionCount); i++) {
+					if (ImGui::Selectable(result.Regressors[i].c_str(), i == m_GLMCondition)) {
+						m_GLMCondition = i;
+						changed = true;
+					}
+				}
+				ImGui::EndCombo();
+			}
+			if (ImGui::RadioButton("Beta", !m_GLMShowTValues)) {
+				m_GLMShowTValues = false;
+				changed = true;
+			}
+			ImGui::SameLine();
+			if (ImGui::RadioButton("t", m_GLMShowTValues)) {
+				m_GLMShowTValues = true;
+				changed = true;
+			}
+			if (ImGui::Checkbox("Show on Projection", &m_ProjectGLM)) {
+				if (m_ProjectGLM) m_ProjectBlockAverage = false;
+				changed = true;
+			}
+			if (changed) SetChannelValuesAtTimeIndex(m_TimeIndex);
+
+			// The selected channels' values, the projection shows every channel
+			const auto& values = m_GLMShowTValues ? result.TValues : result.Betas;
+			const auto& channelMap = m_SNIRF->GetChannelMap();
+			for (auto& ID : m_SelectedChannels) {
+				auto it = channelMap.find(ID);
+				if (it == channelMap.end() || it->second.HBODataIndex >= values.cols() || it->second.HBRDataIndex >= values.cols()) continue;
+				ImGui::Text("Channel %u : HbO %.3f, HbR %.3f", ID,
+					values(m_GLMCondition, it->second.HBODataIndex), values(m_GLMCondition, it->second.HBRDataIndex));
+			}
+		}
+	}
+
+	ImGui::End();
+}
+
+void PlottingLayer::RunGLM()
+{
+	if (!m_SNIRF || !m_SNIRF->IsFileLoaded()) return;
+
+	const PlotSource source = GetPlotSource();
+	if (!source.Complete && !source.Lazy) {
+		NVIZ_WARN("Fit the GLM once the file has finished loading");
+		return;
+	}
+
+	const std::vector<double>& time = (m_StreamResult && m_PlotData == STREAM_DATA) ? m_StreamResult->Time : m_SNIRF->GetTime();
+	auto design = NIRS::BuildGLMDesign(m_SNIRF->GetStimuli(), time, source.SamplingRate, m_GLMSettings);
+	m_GLMResult = CreateRef<const NIRS::GLMResult>(NIRS::FitGLM(design, *source.Registry, m_GLMSettings, !source.Lazy));
+
+	if (m_ProjectGLM) ProjectGLMResult();
+}
+
+void PlottingLayer::ProjectGLMResult()
+{
+	std::map<NIRS::ChannelID, NIRS::ChannelValue> hboValues;
+	std::map<NIRS::ChannelID, NIRS::ChannelValue> hbrValues;
+
+	const auto& result = *m_GLMResult;
+	const auto& values = m_GLMShowTValues ? result.TValues : result.Betas;
+	const bool valid = m_GLMCondition < static_cast<int>(result.ConditionCount);
+	for (auto& [ID, channel] : m_SNIRF->GetChannelMap()) {
+		const bool fitted = valid && channel.HBODataIndex < values.cols() && channel.HBRDataIndex < values.cols();
+		hboValues[ID] = fitted ? static_cast<NIRS::ChannelValue>(values(m_GLMCondition, channel.HBODataIndex)) : 0;
+		hbrValues[ID] = fitted ? static_cast<NIRS::ChannelValue>(values(m_GLMCondition, channel.HBRDataIndex)) : 0;
+	}
+
+	auto projData = AssetManager::Get<NIRS::ProjectionData>("ProjectionData");
+	projData->HBOChannelValues = hboValues;
+	projData->HBRChannelValues = hbrValues;
+
+	EventBus::Instance().Publish<OnChannelValuesUpdated>({ hboValues, hbrValues });
+}
+
+void PlottingLayer::ProjectBlockAverage()
+{
+	std::map<NIRS::ChannelID, NIRS::ChannelValue> hboValues;
+	std::map<NIRS::ChannelID, NIRS::ChannelValue> hbrValues;
+
+	const auto& average = *m_BlockAverage;
+	const bool valid = m_BlockAverageCondition < static_cast<int>(average.Conditions.size()) && average.Length > 0;
+	const Eigen::Index sample = static_cast<Eigen::Index>(std::clamp<long long>(
+		std::llround((m_BlockAverageTime - average.StartTime) * average.SampleRate), 0, std::max<long long>(0, average.Length - 1)));
+	for (auto& [ID, channel] : m_SNIRF->GetChannelMap()) {
+		hboValues[ID] = 0;
+		hbrValues[ID] = 0;
+		if (!valid) continue;
+
+		const auto& mean = average.Mean[m_BlockAverageCondition];
+		if (channel.HBODataIndex < mean.cols()) hboValues[ID] = static_cast<NIRS::ChannelValue>(mean(sample, channel.HBODataIndex));
+		if (channel.HBRDataIndex < mean.cols()) hbrValues[ID] = static_cast<NIRS::ChannelValue>(mean(sample, channel.HBRDataIndex));
+	}
+
+	auto projData = AssetManager::Get<NIRS::ProjectionData>("ProjectionData");
+	projData->HBOChannelValues = hboValues;
+	projData->HBRChannelValues = hbrValues;
+
+	EventBus::Instance().Publish<OnChannelValuesUpdated>({ hboValues, hbrValues });
+}
+
+PlottingLayer::PlotSource PlottingLayer::GetPlotSource() const
+{
+	PlotSource source;
+	if (m_StreamResult && m_PlotData == STREAM_DATA) {
+		source.Registry = m_StreamResult->Data;
+		source.SamplingRate = m_StreamResult->SamplingRate;
+		source.StartTime = m_StreamResult->Time.empty() ? 0.0 : m_StreamResult->Time.front();
+		source.SampleCount = m_StreamResult->Time.size();
+		source.Complete = !m_StreamResult->Lazy;
+		source.Lazy = m_StreamResult->Lazy;
+		source.Type = m_StreamResult->Type;
+		return source;
+	}
+
+	const auto& time = m_SNIRF->GetTime();
+	const auto& run = m_SNIRF->GetRun(m_SNIRF->GetActiveRunIndex());
+	if (m_PlotData == PREPROCESSED_DATA && m_SNIRF->IsRunLoaded() && run.HasProcessedData()) {
+		// Only ever complete, PreprocessRun fills it once every sample is in
+		source.Registry = m_SNIRF->GetProcessedChannelDataRegistry();
+		source.SamplingRate = run.SamplingRate;
+		source.StartTime = time.empty() ? 0.0 : time.front();
+		source.SampleCount = time.size();
+		source.Complete = true;
+		source.Type = NIRS::GetProcessedSignalType(run, m_SNIRF->GetLoadSettings().Preprocessing);
+		return source;
+	}
+
+	source.Registry = m_SNIRF->GetChannelDataRegistry();
+	source.SamplingRate = m_SNIRF->GetSamplingRate();
+	source.StartTime = time.empty() ? 0.0 : time.front();
+	source.SampleCount = std::min(time.size(), m_SNIRF->GetLoadedSampleCount());
+	source.Complete = source.SampleCount == time.size() && !m_SNIRF->IsLazyLoaded();
+	source.Lazy = m_SNIRF->IsLazyLoaded();
+	source.Type = NIRS::GetSourceSignalType(run);
+	return source;
+}
+
+void PlottingLayer::UpdateSpectralView(const PlotSource& source)
+{
+	// The arrays the time series would show, in the same order. Runs every frame, so the
+	// indices go into a reused vector and the labels are only made when the view changes.
+	const auto& channelMap = m_SNIRF->GetChannelMap();
+	auto& indices = m_SpectralView.Indices;
+	indices.clear();
+	for (auto& channelID : m_SelectedChannels) {
+		auto it = channelMap.find(channelID);
+		if (it == channelMap.end()) continue;
+
+		if (m_PlottingWavelength == HBO_ONLY || m_PlottingWavelength == HBO_AND_HBR) indices.push_back(it->second.HBODataIndex);
+		if (m_PlottingWavelength == HBR_ONLY || m_PlottingWavelength == HBO_AND_HBR) indices.push_back(it->second.HBRDataIndex);
+	}
+
+	// Redrawing, panning and zooming reuse the spectra, only a different input recomputes them
+	uint64_t key = Hash::XXH64(indices.data(), indices.size() * sizeof(int));
+	key = Hash::XXH64(&source.SampleCount, sizeof(source.SampleCount), key);
+	key = Hash::XXH64(&m_SpectralSettings, sizeof(m_SpectralSettings), key);
+	key = Hash::XXH64(&m_PlotMode, sizeof(m_PlotMode), key);
+	if (key == m_SpectralView.Key && source.Registry == m_SpectralView.Registry) return;
+
+	m_SpectralView.Key = key;
+	m_SpectralView.Registry = source.Registry;
+	m_SpectralView.Labels.clear();
+	char label[64];
+	for (auto& channelID : m_SelectedChannels) {
+		auto it = channelMap.find(channelID);
+		if (it == channelMap.end()) continue;
+
+		if (m_PlottingWavelength == HBO_ONLY || m_PlottingWavelength == HBO_AND_HBR) {
+			Utils::FormatArrayLabel(label, it->second, true, source.Type);
+			m_SpectralView.Labels.push_back(label);
+		}
+		if (m_PlottingWavelength == HBR_ONLY || m_PlottingWavelength == HBO_AND_HBR) {
+			Utils::FormatArrayLabel(label, it->second, false, source.Type);
+			m_SpectralView.Labels.push_back(label);
+		}
+	}
+	m_SpectralView.Spectra.clear();
+	m_SpectralView.Spectrogram = {};
+	m_SpectralView.Heatmap.clear();
+	m_SpectralView.NeedAxisFit = true;
+	if (indices.empty()) return;
+
+	Timer timer;
+	if (m_PlotMode == POWER_SPECTRUM) {
+		m_SpectralView.Spectra = NIRS::ComputeWelchPSD(*source.Registry, indices, source.SamplingRate, m_SpectralSettings, !source.Lazy);
+	}
+	else {
+		auto& spectrogram = m_SpectralView.Spectrogram;
+		spectrogram = NIRS::ComputeSpectrogram(source.Registry->GetChannelData(indices.front()), source.SamplingRate, m_SpectralSettings);
+
+		// PlotHeatmap draws the first row at the top, so rows run from the highest frequency down
+		auto& heatmap = m_SpectralView.Heatmap;
+		heatmap.resize(spectrogram.Frames * spectrogram.Bins);
+		float minDecibel = std::numeric_limits<float>::max();
+		float maxDecibel = std::numeric_limits<float>::lowest();
+		for (size_t bin = 0; bin < spectrogram.Bins; bin++) {
+			float* row = heatmap.data() + (spectrogram.Bins - 1 - bin) * spectrogram.Frames;
+			for (size_t frame = 0; frame < spectrogram.Frames; frame++) {
+				const float decibel = 10.0f * std::log10(std::max(spectrogram.Power[frame * spectrogram.Bins + bin], 1e-30f));
+				row[frame] = decibel;
+				minDecibel = std::min(minDecibel, decibel);
+				maxDecibel = std::max(maxDecibel, decibel);
+			}
+		}
+		// Empty bins, such as what a bandpass removed, would otherwise flatten the colour scale
+		m_SpectralView.MinDecibel = std::max(minDecibel, maxDecibel - 60.0f);
+		m_SpectralView.MaxDecibel = maxDecibel;
+	}
+
+	NVIZ_INFO("Computed the {} of {} arrays in {:.2f} ms", m_PlotMode == POWER_SPECTRUM ? "power spectra" : "spectrogram",
+		m_PlotMode == POWER_SPECTRUM ? indices.size() : size_t(1), timer.ElapsedMillis());
+}
+
+void PlottingLayer::PlotSpectralView(const PlotSource& source)
+{
+	if (!source.Complete && !source.Lazy) {
+		ImGui::Text("Spectra are available once the file has finished loading");
+		return;
+	}
+	UpdateSpectralView(source);
+
+	if (m_SpectralView.Labels.empty()) {
+		ImGui::Text("Select channels to see their spectra");
+		return;
+	}
+
+	// Physiological bands that contaminate the haemodynamic response
+	struct Band { const char* Name; double Range[2]; };
+	static constexpr Band bands[] = {
+		{ "Mayer Waves", { 0.08, 0.12 } },
+		{ "Respiration", { 0.2, 0.4 } },
+		{ "Cardiac", { 0.5, 2.5 } },
+	};
+
+	if (m_PlotMode == POWER_SPECTRUM) {
+		if (ImPlot::BeginPlot("##PowerSpectrum", ImVec2(-1, -1))) {
+			ImPlot::SetupAxes("Frequency (Hz)", "Power / Hz");
+			ImPlot::SetupAxisScale(ImAxis_Y1, ImPlotScale_Log10);
+			if (m_SpectralView.NeedAxisFit) {
+				ImPlot::SetupAxisLimits(ImAxis_X1, 0.0, 0.5 * source.SamplingRate, ImPlotCond_Always);
+				m_SpectralView.NeedAxisFit = false;
+			}
+
+			for (const auto& band : bands) ImPlot::PlotInfLines(band.Name, band.Range, 2);
+
+			for (size_t i = 0; i < m_SpectralView.Spectra.size(); i++) {
+				const auto& spectrum = m_SpectralView.Spectra[i];
+				ImPlot::PlotLine(m_SpectralView.Labels[i].c_str(), spectrum.Power.data(), static_cast<int>(spectrum.Power.size()), spectrum.FrequencyStep, 0.0);
+			}
+			ImPlot::EndPlot();
+		}
+		return;
+	}
+
+	const auto& spectrogram = m_SpectralView.Spectrogram;
+	if (spectrogram.Frames == 0) {
+		ImGui::Text("%s is too short for a spectrogram", m_SpectralView.Labels.front().c_str());
+		return;
+	}
+
+	ImGui::Text("%s", m_SpectralView.Labels.front().c_str());
+	ImPlot::PushColormap(ImPlotColormap_Viridis);
+	if (ImPlot::BeginPlot("##Spectrogram", ImVec2(ImGui::GetContentRegionAvail().x - 90.0f, -1))) {
+		ImPlot::SetupAxes("Time (s)", "Frequency (Hz)");
+		if (m_SpectralView.NeedAxisFit) {
+			ImPlot::SetupAxisLimits(ImAxis_Y1, 0.0, 0.5 * source.SamplingRate, ImPlotCond_Always);
+			m_SpectralView.NeedAxisFit = false;
+		}
+
+		// Every cell is centred on its frame and bin
+		const double start = source.StartTime + spectrogram.StartTime - 0.5 * spectrogram.TimeStep;
+		const ImPlotPoint min(start, -0.5 * spectrogram.FrequencyStep);
+		const ImPlotPoint max(start + spectrogram.Frames * spectrogram.TimeStep, (spectrogram.Bins - 0.5) * spectrogram.FrequencyStep);
+		ImPlot::PlotHeatmap("##Power", m_SpectralView.Heatmap.data(), static_cast<int>(spectrogram.Bins), static_cast<int>(spectrogram.Frames),
+			m_SpectralView.MinDecibel, m_SpectralView.MaxDecibel, nullptr, min, max);
+
+		for (const auto& band : bands) ImPlot::PlotInfLines(band.Name, band.Range, 2, ImPlotInfLinesFlags_Horizontal);
+		ImPlot::EndPlot();
+	}
+	ImGui::SameLine();
+	ImPlot::ColormapScale("dB", m_SpectralView.MinDecibel, m_SpectralView.MaxDecibel, ImVec2(80.0f, -1));
+	ImPlot::PopColormap();
+}
+
+void PlottingLayer::UpdateBlockAverage(const PlotSource& source)
+{
+	// Every array is averaged at once, so changing the selection only changes what is drawn
+	uint64_t key = Hash::XXH64(&source.SampleCount, sizeof(source.SampleCount));
+	key = Hash::XXH64(&source.SamplingRate, sizeof(source.SamplingRate), key);
+	key = Hash::XXH64(&m_EpochSettings, sizeof(m_EpochSettings), key);
+	if (key == m_BlockAverageKey && source.Registry == m_BlockAverageRegistry) return;
+
+	m_BlockAverageKey = key;
+	m_BlockAverageRegistry = source.Registry;
+	m_BlockAverage = CreateRef<const NIRS::BlockAverage>(NIRS::ComputeBlockAverage(m_SNIRF->GetEventIndex(), *source.Registry,
+		source.StartTime, source.SamplingRate, source.SampleCount, m_EpochSettings, !source.Lazy));
+	if (m_ProjectBlockAverage) ProjectBlockAverage();
+}
+
+void PlottingLayer::PlotBlockAverage(const PlotSource& source)
+{
+	if ((!source.Complete && !source.Lazy) || !m_SNIRF->IsRunLoaded()) {
+		ImGui::Text("Block averages are available once the file has finished loading");
+		return;
+	}
+	if (m_SNIRF->GetEventIndex().IsEmpty()) {
+		ImGui::Text("The run has no stimulus events to average");
+		return;
+	}
+	UpdateBlockAverage(source);
+	const auto& average = *m_BlockAverage;
+
+	bool changed = false;
+	m_BlockAverageCondition = std::clamp(m_BlockAverageCondition, 0, static_cast<int>(average.Conditions.size()) - 1);
+	if (ImGui::BeginCombo("Condition", average.Conditions[m_BlockAverageCondition].c_str())) {
+		for (int i = 0; i < static_cast<int>(average.Conditions.size()); i++) {
+			const std::string label = average.Conditions[i] + " (" + std::to_string(average.EpochCounts[i]) + " epochs)";
+			if (ImGui::Selectable(label.c_str(), i == m_BlockAverageCondition)) {
+				m_BlockAverageCondition = i;
+				changed = true;
+			}
+		}
+		ImGui::EndCombo();
+	}
+	if (ImGui::Checkbox("Show on Projection", &m_ProjectBlockAverage)) {
+		if (m_ProjectBlockAverage) m_ProjectGLM = false;
+		changed = true;
+	}
+	if (m_SelectedChannels.empty()) {
+		ImGui::Text("Select channels to see their averages");
+	}
+
+	const size_t condition = static_cast<size_t>(m_BlockAverageCondition);
+	const auto& mean = average.Mean[condition];
+	const auto& error = average.StandardError[condition];
+	const int length = static_cast<int>(average.Length);
+	const double step = 1.0 / average.SampleRate;
+
+	if (ImPlot::BeginPlot("##BlockAverage", ImVec2(-1, -1))) {
+		ImPlot::SetupAxes("Time from onset (s)", "Mean");
+
+		const auto& channelMap = m_SNIRF->GetChannelMap();
+		auto plotArray = [&](const char* label, NIRS::ChannelDataID index) {
+			if (index >= mean.cols() || average.EpochCounts[condition] == 0) return;
+
+			// Mean and standard error are columns of their matrices, contiguous in memory
+			const double* line = mean.col(index).data();
+			const double* spread = error.col(index).data();
+			m_ShadeTime.resize(length);
+			m_ShadeLower.resize(length);
+			m_ShadeUpper.resize(length);
+			for (int s = 0; s < length; s++) {
+				m_ShadeTime[s] = average.StartTime + s * step;
+				m_ShadeLower[s] = line[s] - spread[s];
+				m_ShadeUpper[s] = line[s] + spread[s];
+			}
+			ImPlot::PlotLine(label, line, length, step, average.StartTime);
+			ImPlot::SetNextFillStyle(ImPlot::GetLastItemColor(), 0.25f);
+			ImPlot::PlotShaded(label, m_ShadeTime.data(), m_ShadeLower.data(), m_ShadeUpper.data(), length);
+		};
+		char label[64];
+		for (auto& channelID : m_SelectedChannels) {
+			auto it = channelMap.find(channelID);
+			if (it == channelMap.end()) continue;
+
+			if (m_PlottingWavelength == HBO_ONLY || m_PlottingWavelength == HBO_AND_HBR) {
+				Utils::FormatArrayLabel(label, it->second, true, source.Type);
+				plotArray(label, it->second.HBODataIndex);
+			}
+			if (m_PlottingWavelength == HBR_ONLY || m_PlottingWavelength == HBO_AND_HBR) {
+				Utils::FormatArrayLabel(label, it->second, false, source.Type);
+				plotArray(label, it->second.HBRDataIndex);
+			}
+		}
+
+		const double onset = 0.0;
+		ImPlot::PlotInfLines("Onset", &onset, 1);
+		if (ImPlot::DragLineX(0, &m_BlockAverageTime, ImVec4(1, 0.2, 0.2, 1), 1, ImPlotDragToolFlags_NoFit)) changed = true;
+		ImPlot::TagX(m_BlockAverageTime, ImVec4(1, 0.2, 0.2, 1), "%s", "Projection");
+		ImPlot::EndPlot();
+	}
+
+	if (changed && m_ProjectBlockAverage) ProjectBlockAverage();
+	else if (changed) SetChannelValuesAtTimeIndex(m_TimeIndex);
+}
+
 void PlottingLayer::RenderMenuBar()
 {
 	if (ImGui::BeginMenu("Data"))
@@ -195,8 +898,24 @@ void PlottingLayer::RenderMenuBar()
 		}
 
 		if (ImGui::MenuItem("Run Stream")) {
-			// Processing 
+			RunProcessingStream();
+		}
 
+		if (ImGui::MenuItem("General Linear Model")) {
+			m_EditingGLM = true;
+		}
+
+		if (ImGui::BeginMenu("Benchmarks")) { // Results are written to the log
+			if (ImGui::MenuItem("Channel Submission")) NIRS::Benchmark::ChannelSubmission();
+			if (ImGui::MenuItem("Preprocessing")) NIRS::Benchmark::Preprocessing();
+			if (ImGui::MenuItem("Filter Throughput")) NIRS::Benchmark::FilterThroughput();
+			if (ImGui::MenuItem("Motion Correction")) NIRS::Benchmark::MotionCorrection();
+			if (ImGui::MenuItem("Resampling")) NIRS::Benchmark::Resampling();
+			if (ImGui::MenuItem("Block Averaging")) NIRS::Benchmark::BlockAveraging();
+			if (ImGui::MenuItem("Plot Frame")) NIRS::Benchmark::PlotFrame();
+			if (ImGui::MenuItem("Measurement Table")) NIRS::Benchmark::MeasurementTable(m_SNIRF ? std::filesystem::path(m_SNIRF->GetFilepath()) : std::filesystem::path());
+			if (ImGui::MenuItem("Storage Precision")) NIRS::Benchmark::StoragePrecision(m_SNIRF ? std::filesystem::path(m_SNIRF->GetFilepath()) : std::filesystem::path());
+			ImGui::EndMenu();
 		}
 
 		ImGui::EndMenu();
@@ -207,16 +926,17 @@ void PlottingLayer::HandleSelectedChannels(const std::vector<NIRS::ChannelID>& s
 {
 	m_SelectedChannels = selectedIDs;
 
-	if (selectedIDs.empty()) {
+	if (selectedIDs.empty() || !m_SNIRF) {
 		return;
 	}
 
 	// Get necessary data
-	auto time = m_SNIRF->GetTime();
-	auto channelMap = m_SNIRF->GetChannelMap();
-	auto channelRegistry = m_SNIRF->GetChannelDataRegistry();
+	const PlotSource source = GetPlotSource();
+	const auto& channelMap = m_SNIRF->GetChannelMap();
+	auto channelRegistry = source.Registry;
+	size_t sample_count = source.SampleCount; // The rest is not streamed in yet
 
-	if (time.empty()) {
+	if (sample_count == 0) {
 		return;
 	}
 
@@ -225,19 +945,20 @@ void PlottingLayer::HandleSelectedChannels(const std::vector<NIRS::ChannelID>& s
 	double maxY = std::numeric_limits<double>::lowest();
 
 	for (auto& channelID : selectedIDs) {
-		if (channelMap.find(channelID) == channelMap.end()) {
+		auto it = channelMap.find(channelID);
+		if (it == channelMap.end()) {
 			continue;
 		}
 
-		auto& channel = channelMap[channelID];
+		const auto& channel = it->second;
 
 		// Check HbO data if needed
 		if (m_PlottingWavelength == HBO_ONLY || m_PlottingWavelength == HBO_AND_HBR) {
 			auto hboData = channelRegistry->GetChannelData(channel.HBODataIndex);
 			if (!hboData.empty()) {
-				auto [minIt, maxIt] = std::minmax_element(hboData.begin(), hboData.end());
-				minY = std::min(minY, *minIt);
-				maxY = std::max(maxY, *maxIt);
+				auto [minIt, maxIt] = std::minmax_element(hboData.begin(), hboData.begin() + sample_count);
+				minY = std::min(minY, static_cast<double>(*minIt));
+				maxY = std::max(maxY, static_cast<double>(*maxIt));
 			}
 		}
 
@@ -245,9 +966,9 @@ void PlottingLayer::HandleSelectedChannels(const std::vector<NIRS::ChannelID>& s
 		if (m_PlottingWavelength == HBR_ONLY || m_PlottingWavelength == HBO_AND_HBR) {
 			auto hbrData = channelRegistry->GetChannelData(channel.HBRDataIndex);
 			if (!hbrData.empty()) {
-				auto [minIt, maxIt] = std::minmax_element(hbrData.begin(), hbrData.end());
-				minY = std::min(minY, *minIt);
-				maxY = std::max(maxY, *maxIt);
+				auto [minIt, maxIt] = std::minmax_element(hbrData.begin(), hbrData.begin() + sample_count);
+				minY = std::min(minY, static_cast<double>(*minIt));
+				maxY = std::max(maxY, static_cast<double>(*maxIt));
 			}
 		}
 	}
@@ -268,10 +989,21 @@ void PlottingLayer::HandleSelectedChannels(const std::vector<NIRS::ChannelID>& s
 
 void PlottingLayer::SetChannelValuesAtTimeIndex(int index)
 {
-	auto channelMap = m_SNIRF->GetChannelMap();
-	auto channelRegistry = m_SNIRF->GetChannelDataRegistry();
+	if (m_ProjectGLM && m_GLMResult) {
+		ProjectGLMResult();
+		return;
+	}
+	if (m_ProjectBlockAverage && m_BlockAverage) {
+		ProjectBlockAverage();
+		return;
+	}
+
+	const PlotSource source = GetPlotSource();
+	const auto& channelMap = m_SNIRF->GetChannelMap();
+	auto channelRegistry = source.Registry;
 
 	size_t timeIndex = static_cast<size_t>(index);
+	size_t sample_count = source.SampleCount;
 
 
 	std::map<NIRS::ChannelID, NIRS::ChannelValue> hboValues; // Your map to store results
@@ -282,12 +1014,28 @@ void PlottingLayer::SetChannelValuesAtTimeIndex(int index)
 		hbrValues[ID] = 0.0;
 	}
 
+	// One row of the time-major view holds every channel at this time point. While the file
+	// is still streaming in (or for lazy files) the per-channel views are read instead.
+	ChannelDataRegistry::ChannelView timepoint;
+	if (timeIndex < sample_count && source.Complete) {
+		timepoint = channelRegistry->GetTimepoint(timeIndex);
+	}
+
 	for (auto& ID : m_SelectedChannels) {
-		
-		std::vector<double> hbo = channelRegistry->GetChannelData(channelMap[ID].HBODataIndex);
-		std::vector<double> hbr = channelRegistry->GetChannelData(channelMap[ID].HBRDataIndex);
+		auto it = channelMap.find(ID);
+		if (it == channelMap.end()) continue;
+		const auto& channel = it->second;
+
+		if (!timepoint.empty()) {
+			hboValues[ID] = timepoint[channel.HBODataIndex];
+			hbrValues[ID] = timepoint[channel.HBRDataIndex];
+			continue;
+		}
+
+		auto hbo = channelRegistry->GetChannelData(channel.HBODataIndex);
+		auto hbr = channelRegistry->GetChannelData(channel.HBRDataIndex);
 
-		if (timeIndex >= 0 && timeIndex < hbo.size()) { // Within bounds
+		if (timeIndex >= 0 && timeIndex < std::min(hbo.size(), sample_count)) { // Within bounds and already loaded
 			hboValues[ID] = hbo[timeIndex];
 			hbrValues[ID] = hbr[timeIndex];
 		}
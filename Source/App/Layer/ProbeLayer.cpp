@@ -49,6 +49,12 @@ void ProbeLayer::OnAttach()
 		
 	});
 
+	EventBus::Instance().Subscribe<OnSNIRFChannelReady>([this](const OnSNIRFChannelReady& e) {
+		// Channels show up one by one while the file is still loading, OnUpdate rebuilds the visuals once per frame
+		m_ReadyChannels.insert(e.ChannelID);
+		m_ChannelVisualsDirty = true;
+	});
+
 	EventBus::Instance().Subscribe<OnChannelValuesUpdated>([this](const OnChannelValuesUpdated& e) {
 		this->UpdateHitDataTexture();
 	});
@@ -60,12 +66,14 @@ void ProbeLayer::OnDetach()
 
 void ProbeLayer::OnUpdate(float dt)
 {
+	if (!m_SNIRF) return; // Nothing to draw until the FileLayer hands over a SNIRF
 
 	if (m_DrawChannelProjections3D || m_DrawChannels3D || m_DrawChannels2D ||
 		m_DrawProbes2D || m_DrawProbes3D) {
 		UpdateProbeVisuals();
 		UpdateChannelVisuals();
 	}
+	else if (m_ChannelVisualsDirty) UpdateChannelVisuals();
 
 	if (m_DrawChannels2D && m_SNIRF->IsFileLoaded()) m_LineRenderer2D->Draw();
 	if (m_DrawChannels3D && m_SNIRF->IsFileLoaded()) m_LineRenderer3D->Draw(); 
@@ -100,7 +108,7 @@ void ProbeLayer::OnImGuiRender()
 {
 
 	ImGui::Begin("Probe Settings");
-	ImGui::TextWrapped("%s", m_SNIRF->IsFileLoaded() ? m_SNIRF->GetFilepath().c_str() : "...");
+	ImGui::TextWrapped("%s", m_SNIRF && m_SNIRF->IsFileLoaded() ? m_SNIRF->GetFilepath().c_str() : "...");
 
 	if (ImGui::Button("Project To Cortex")) {
 		ProjectChannelsToCortex();
@@ -241,6 +249,7 @@ void ProbeLayer::LoadSNIRF()
 
 	m_Channels = m_SNIRF->GetChannels();
 	m_ChannelMap = m_SNIRF->GetChannelMap();
+	m_ReadyChannels.clear(); // Filled by OnSNIRFChannelReady as the samples come in
 	m_ChannelProjectionIntersections.clear(); // Init it
 
 	for (size_t i = 0; i < m_Channels.size(); ++i) {
@@ -347,12 +356,14 @@ void ProbeLayer::UpdateProbeVisuals()
 
 void ProbeLayer::UpdateChannelVisuals()
 {
+	m_ChannelVisualsDirty = false;
 	m_LineRenderer2D->Clear();
 	m_LineRenderer3D->Clear();
 	m_ProjLineRenderer3D->Clear();
 
 	m_ChannelVisualsMap.clear();
 	for (const auto& [idx, channel] : m_ChannelMap) {
+		if (!m_ReadyChannels.count(channel.ID)) continue;
 
 		int sourceIndex = channel.SourceID - 1;
 		int detectorIndex = channel.DetectorID - 1;
@@ -415,6 +426,7 @@ void ProbeLayer::ProjectChannelsToCortex()
 	//m_ChannelProjectionIntersections.clear(); 
 
 	for (const auto& [idx, channel] : m_ChannelMap) {
+		if (!m_ChannelVisualsMap.count(idx)) continue; // Not loaded yet
 		const auto& cv = m_ChannelVisualsMap[idx];
 
 		auto line = cv.ProjectionLine3D;
@@ -81,6 +81,8 @@ void Application::Run()
 		float delta_time = time - m_LastTime;
 		m_LastTime = time;
 
+		EventBus::Instance().DispatchQueued(); // Events posted by worker threads since the last frame
+
 		if (!m_Minimized)
 		{
 			Renderer::BeginScene();
@@ -0,0 +1,90 @@
+#include "pch.h"
+#include "Core/MappedFile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::filesystem::path& filepath)
+{
+	HANDLE file = CreateFileW(filepath.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		NVIZ_ERROR("MappedFile : Could not open {}", filepath.string());
+		return;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return;
+	}
+
+	HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) {
+		NVIZ_ERROR("MappedFile : Could not map {}", filepath.string());
+		CloseHandle(file);
+		return;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL) {
+		NVIZ_ERROR("MappedFile : Could not map a view of {}", filepath.string());
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return;
+	}
+
+	m_FileHandle = file;
+	m_MappingHandle = mapping;
+	m_Data = static_cast<const uint8_t*>(view);
+	m_Size = static_cast<size_t>(size.QuadPart);
+}
+
+MappedFile::~MappedFile()
+{
+	if (m_Data) UnmapViewOfFile(m_Data);
+	if (m_MappingHandle) CloseHandle(m_MappingHandle);
+	if (m_FileHandle) CloseHandle(m_FileHandle);
+}
+
+#else
+
+MappedFile::MappedFile(const std::filesystem::path& filepath)
+{
+	int fd = open(filepath.c_str(), O_RDONLY);
+	if (fd < 0) {
+		NVIZ_ERROR("MappedFile : Could not open {}", filepath.string());
+		return;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return;
+	}
+
+	void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED) {
+		NVIZ_ERROR("MappedFile : Could not map {}", filepath.string());
+		close(fd);
+		return;
+	}
+
+	m_FileDescriptor = fd;
+	m_Data = static_cast<const uint8_t*>(view);
+	m_Size = static_cast<size_t>(st.st_size);
+}
+
+MappedFile::~MappedFile()
+{
+	if (m_Data) munmap(const_cast<uint8_t*>(m_Data), m_Size);
+	if (m_FileDescriptor >= 0) close(m_FileDescriptor);
+}
+
+#endif
@@ -0,0 +1,29 @@
+#include "pch.h"
+#include "Core/Memory.h"
+
+#ifdef _WIN32
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <fstream>
+#include <unistd.h>
+#endif
+
+namespace Memory {
+
+	size_t GetProcessResidentBytes()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+		return static_cast<size_t>(counters.WorkingSetSize);
+#else
+		// statm : total and resident size in pages
+		std::ifstream statm("/proc/self/statm");
+		size_t total = 0, resident = 0;
+		if (!(statm >> total >> resident)) return 0;
+		return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+	}
+
+}
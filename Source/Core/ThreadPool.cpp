@@ -0,0 +1,117 @@
+#include "pch.h"
+#include "Core/ThreadPool.h"
+
+ThreadPool::ThreadPool()
+{
+	// Leave one core for the render loop
+	unsigned int hardwareThreads = std::thread::hardware_concurrency();
+	size_t workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+
+	m_Workers.reserve(workerCount);
+	for (size_t i = 0; i < workerCount; i++) {
+		m_Workers.emplace_back([this]() { WorkerLoop(); });
+	}
+	NVIZ_INFO("ThreadPool : {} worker threads", workerCount);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+	}
+	m_Condition.notify_all();
+	for (auto& worker : m_Workers) {
+		if (worker.joinable()) worker.join();
+	}
+}
+
+void ThreadPool::ParallelFor(size_t begin, size_t end, const std::function<void(size_t)>& fn, size_t grain)
+{
+	if (end <= begin) return;
+	if (grain == 0) grain = 1;
+
+	const size_t count = end - begin;
+	const size_t blocks = (count + grain - 1) / grain;
+	if (blocks == 1) {
+		for (size_t i = begin; i < end; i++) fn(i);
+		return;
+	}
+
+	std::atomic<size_t> nextBlock{ 0 };
+	std::exception_ptr error;
+	std::mutex errorMutex;
+	auto fail = [&]() {
+		nextBlock.store(blocks); // No further blocks are started
+		std::lock_guard<std::mutex> lock(errorMutex);
+		if (!error) error = std::current_exception();
+	};
+	auto runBlocks = [&]() {
+		try {
+			for (size_t block = nextBlock.fetch_add(1); block < blocks; block = nextBlock.fetch_add(1)) {
+				size_t first = begin + block * grain;
+				size_t last = std::min(end, first + grain);
+				for (size_t i = first; i < last; i++) fn(i);
+			}
+		}
+		catch (...) {
+			fail();
+		}
+	};
+
+	// The helpers reference the locals above, every one of them has to finish before this returns
+	const void* group = &nextBlock;
+	size_t helpers = std::min(blocks - 1, m_Workers.size());
+	std::vector<std::future<void>> futures;
+	futures.reserve(helpers);
+	try {
+		for (size_t i = 0; i < helpers; i++) {
+			futures.push_back(SubmitToGroup(runBlocks, group));
+		}
+	}
+	catch (...) {
+		fail();
+	}
+
+	runBlocks();
+	for (auto& future : futures) Wait(future, group);
+	if (error) std::rethrow_exception(error);
+}
+
+void ThreadPool::Enqueue(std::function<void()> task, const void* group)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Tasks.push_back({ std::move(task), group });
+	}
+	m_Condition.notify_one();
+}
+
+bool ThreadPool::RunPendingTask(const void* group)
+{
+	std::function<void()> task;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto it = std::find_if(m_Tasks.begin(), m_Tasks.end(), [group](const Task& t) { return t.Group == group; });
+		if (it == m_Tasks.end()) return false;
+		task = std::move(it->Function);
+		m_Tasks.erase(it);
+	}
+	task();
+	return true;
+}
+
+void ThreadPool::WorkerLoop()
+{
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Condition.wait(lock, [this]() { return m_Stopping || !m_Tasks.empty(); });
+			if (m_Stopping && m_Tasks.empty()) return;
+			task = std::move(m_Tasks.front().Function);
+			m_Tasks.pop_front();
+		}
+		task();
+	}
+}
@@ -0,0 +1,629 @@
+#include "pch.h"
+#include "NIRS/Benchmark.h"
+
+#include "NIRS/ChannelDataRegistry.h"
+#include "NIRS/Snirf.h"
+#include "NIRS/Processing.h"
+#include "NIRS/Filter.h"
+#include "NIRS/Epochs.h"
+#include "NIRS/LevelOfDetail.h"
+
+#include "Core/Hash.h"
+#include "Core/Timer.h"
+#include "Core/Memory.h"
+#include "Core/AlignedBuffer.h"
+#include "Core/ThreadPool.h"
+
+#include <highfive/H5File.hpp>
+
+#include <random>
+#include <set>
+
+namespace Utils {
+
+	// Channels that look like raw intensities: a slow oscillation plus noise
+	template<typename T = NIRS::ChannelValue>
+	static std::vector<std::vector<T>> MakeSyntheticChannels(size_t channels, size_t samples, uint32_t seed = 42)
+	{
+		std::mt19937 rng(seed);
+		std::normal_distribution<double> noise(0.0, 0.01);
+
+		std::vector<std::vector<T>> data(channels, std::vector<T>(samples));
+		for (size_t c = 0; c < channels; c++) {
+			double phase = static_cast<double>(c) * 0.37;
+			for (size_t s = 0; s < samples; s++) {
+				data[c][s] = static_cast<T>(1.0 + 0.1 * std::sin(0.01 * s + phase) + noise(rng));
+			}
+		}
+		return data;
+	}
+
+	// Motion on top of the synthetic channels: a baseline shift every two minutes
+	// and a one second spike every three, on average
+	static void AddMotionArtifacts(std::vector<double>& channel, double samplingRate, uint32_t seed)
+	{
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<double> chance(0.0, 1.0);
+		std::normal_distribution<double> amplitude(0.0, 0.2);
+
+		const double shiftChance = 1.0 / (120.0 * samplingRate);
+		const double spikeChance = 1.0 / (180.0 * samplingRate);
+		const size_t spikeLength = static_cast<size_t>(samplingRate);
+
+		double shift = 0.0;
+		for (size_t s = 0; s < channel.size(); s++) {
+			if (chance(rng) < shiftChance) shift += amplitude(rng);
+			channel[s] += shift;
+
+			if (chance(rng) < spikeChance) {
+				const double height = 2.0 * amplitude(rng);
+				for (size_t k = 0; k < spikeLength && s + k < channel.size(); k++) {
+					channel[s + k] += height * std::sin(3.14159265358979 * k / spikeLength);
+				}
+			}
+		}
+	}
+
+	static double MaxJump(const std::vector<std::vector<double>>& data)
+	{
+		double jump = 0.0;
+		for (const auto& channel : data) {
+			for (size_t s = 1; s < channel.size(); s++) jump = std::max(jump, std::abs(channel[s] - channel[s - 1]));
+		}
+		return jump;
+	}
+
+	// The hash SubmitChannelData used before, std::hash<double> combined per sample
+	static size_t LegacyChannelHash(const std::vector<NIRS::ChannelValue>& data)
+	{
+		std::size_t seed = data.size();
+		std::hash<double> double_hasher;
+		for (double d : data) {
+			seed ^= double_hasher(d) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+		}
+		return seed;
+	}
+
+	template<typename F>
+	static double BestOfMillis(int repeats, F&& fn);
+
+	// The loop ParseData1 used before, all six datasets of every group. It only read the
+	// first half of the groups, here it reads all of them so the tables are the same size.
+	static void LegacyReadMeasurementGroups(const HighFive::Group& data, std::vector<NIRS::Measurement>& measurements)
+	{
+		for (size_t i = 0; i < measurements.size(); i++) {
+			HighFive::Group list = data.getGroup("measurementList" + std::to_string(i + 1));
+			auto& m = measurements[i];
+			list.getDataSet("dataType").read(m.DataType);
+			if (list.exist("dataTypeIndex")) list.getDataSet("dataTypeIndex").read(m.DataTypeIndex);
+			if (list.exist("dataTypeLabel")) list.getDataSet("dataTypeLabel").read(m.DataTypeLabel);
+			list.getDataSet("sourceIndex").read(m.SourceIndex);
+			list.getDataSet("detectorIndex").read(m.DetectorIndex);
+			list.getDataSet("wavelengthIndex").read(m.WavelengthIndex);
+		}
+	}
+
+	// First "nirs*" group of the file holding a "data*" group, or an empty string
+	static std::string FindFirstDataGroup(const HighFive::File& file)
+	{
+		auto names = file.listObjectNames();
+		std::sort(names.begin(), names.end());
+		for (const auto& nirsName : names) {
+			if (nirsName.rfind("nirs", 0) != 0) continue;
+			auto dataNames = file.getGroup(nirsName).listObjectNames();
+			std::sort(dataNames.begin(), dataNames.end());
+			for (const auto& dataName : dataNames) {
+				if (dataName.rfind("data", 0) == 0) return "/" + nirsName + "/" + dataName;
+			}
+		}
+		return "";
+	}
+
+	// Stands in for ImPlot reading every point it is given, so the compiler cannot drop the frame
+	template<typename T>
+	static double ReadPoints(const T* values, size_t count)
+	{
+		double sum = 0.0;
+		for (size_t i = 0; i < count; i++) sum += values[i];
+		return sum;
+	}
+
+	static double ToMegabytes(size_t bytes) { return static_cast<double>(bytes) / (1024.0 * 1024.0); }
+
+	// Store 'source' as T, then bandpass every channel the way the load-time preprocessing
+	// does: DefaultFilterLanes channels at a time into double buffers, the default Butterworth
+	// through FiltFiltChannels' SOSFilterBank lanes, and back into the store. The out-of-place
+	// ButterworthBandpassFilter does the same for the build's ChannelValue.
+	template<typename T>
+	static void BenchmarkStorePrecision(const std::vector<std::vector<double>>& source, int repeats)
+	{
+		const size_t channels = source.size();
+		const size_t samples = source.front().size();
+		const size_t lanes = 64 / sizeof(T); // Channels start on a cache line, as in the registry
+		const size_t stride = (samples + lanes - 1) / lanes * lanes;
+
+		size_t rssBefore = Memory::GetProcessResidentBytes();
+		AlignedBuffer<T> store(channels * stride);
+		size_t rssAfter = Memory::GetProcessResidentBytes();
+
+		double fillMs = BestOfMillis(repeats, [&]() {
+			for (size_t c = 0; c < channels; c++) {
+				std::transform(source[c].begin(), source[c].end(), store.Data() + c * stride, [](double v) { return static_cast<T>(v); });
+			}
+		});
+
+		const NIRS::PreprocessingSettings settings;
+		const float samplingRate = 10.0f;
+		std::vector<double> signals(static_cast<size_t>(NIRS::DefaultFilterLanes) * samples);
+		std::array<double*, NIRS::DefaultFilterLanes> lanePointers;
+		for (size_t i = 0; i < lanePointers.size(); i++) lanePointers[i] = signals.data() + i * samples;
+
+		double filterMs = BestOfMillis(repeats, [&]() {
+			for (size_t first = 0; first < channels; first += NIRS::DefaultFilterLanes) {
+				const size_t count = std::min<size_t>(NIRS::DefaultFilterLanes, channels - first);
+				for (size_t i = 0; i < count; i++) {
+					const T* data = store.Data() + (first + i) * stride;
+					std::copy(data, data + samples, lanePointers[i]);
+				}
+				NIRS::ButterworthBandpassFilter(Span<double* const>(lanePointers.data(), count), samples, samplingRate,
+					settings.LowerCutoff, settings.HigherCutoff, settings.FilterOrder);
+				for (size_t i = 0; i < count; i++) {
+					T* data = store.Data() + (first + i) * stride;
+					std::transform(lanePointers[i], lanePointers[i] + samples, data, [](double v) { return static_cast<T>(v); });
+				}
+			}
+		});
+
+		const double msamples = static_cast<double>(channels * samples) / 1e6;
+		NVIZ_INFO("    {:7} : store {:7.1f} MB, RSS +{:7.1f} MB, fill {:7.2f} ms, filtfilt {:7.2f} ms ({:.1f} MSamples/s)",
+			sizeof(T) == sizeof(float) ? "float32" : "float64",
+			ToMegabytes(store.Size() * sizeof(T)), ToMegabytes(rssAfter > rssBefore ? rssAfter - rssBefore : 0),
+			fillMs, filterMs, msamples / (filterMs / 1000.0));
+	}
+
+	// Largest absolute difference between two sets of channels
+	static double MaxDifference(const std::vector<std::vector<double>>& a, const std::vector<std::vector<double>>& b)
+	{
+		double diff = 0.0;
+		for (size_t c = 0; c < a.size(); c++) {
+			for (size_t s = 0; s < a[c].size(); s++) diff = std::max(diff, std::abs(a[c][s] - b[c][s]));
+		}
+		return diff;
+	}
+
+	template<int Lanes>
+	static void BenchmarkFilterBank(const Ref<const NIRS::FilterDesign>& design, const std::vector<std::vector<double>>& source,
+		const std::vector<std::vector<double>>& reference, int repeats, double msamples)
+	{
+		auto work = source;
+		std::vector<double*> channels;
+		for (auto& channel : work) channels.push_back(channel.data());
+
+		double ms = BestOfMillis(repeats, [&]() {
+			for (size_t c = 0; c < work.size(); c++) std::copy(source[c].begin(), source[c].end(), work[c].begin());
+			NIRS::FilterChannels<Lanes>(design, channels, source.front().size());
+		});
+		NVIZ_INFO("    SOS {} lanes   : {:8.2f} ms ({:6.1f} MSamples/s), max diff to scalar {:.3e}",
+			Lanes, ms, msamples / (ms / 1000.0), MaxDifference(work, reference));
+	}
+
+	template<typename F>
+	static double BestOfMillis(int repeats, F&& fn)
+	{
+		double best = std::numeric_limits<double>::max();
+		for (int r = 0; r < repeats; r++) {
+			Timer timer;
+			fn();
+			best = std::min(best, static_cast<double>(timer.ElapsedMillis()));
+		}
+		return best;
+	}
+}
+
+namespace NIRS::Benchmark {
+
+	void ChannelSubmission(size_t channels, size_t samples, int repeats)
+	{
+		// Every second channel repeats the one before it
+		auto unique = Utils::MakeSyntheticChannels((channels + 1) / 2, samples);
+		std::vector<const std::vector<NIRS::ChannelValue>*> submitted;
+		for (size_t c = 0; c < channels; c++) submitted.push_back(&unique[c / 2]);
+
+		const double megabytes = static_cast<double>(channels * samples * sizeof(NIRS::ChannelValue)) / (1024.0 * 1024.0);
+		NVIZ_INFO("Benchmark ChannelSubmission : {} channels x {} samples ({:.1f} MB), best of {}", channels, samples, megabytes, repeats);
+
+		size_t legacyHash = 0;
+		double legacyMs = Utils::BestOfMillis(repeats, [&]() {
+			for (auto* data : submitted) legacyHash ^= Utils::LegacyChannelHash(*data);
+		});
+
+		uint64_t fastHash = 0;
+		double fastMs = Utils::BestOfMillis(repeats, [&]() {
+			for (auto* data : submitted) fastHash ^= Hash::XXH64(data->data(), data->size() * sizeof(NIRS::ChannelValue));
+		});
+
+		NVIZ_INFO("    hash std::hash per sample : {:8.2f} ms ({:.2f} GB/s)", legacyMs, megabytes / 1024.0 / (legacyMs / 1000.0));
+		NVIZ_INFO("    hash xxHash64             : {:8.2f} ms ({:.2f} GB/s)", fastMs, megabytes / 1024.0 / (fastMs / 1000.0));
+
+		for (bool dedup : { true, false }) {
+			size_t stored = 0;
+			double ms = Utils::BestOfMillis(repeats, [&]() {
+				ChannelDataRegistry registry;
+				registry.SetDeduplication(dedup);
+				registry.Reserve(channels, samples);
+
+				std::set<int> indices;
+				for (auto* data : submitted) indices.insert(registry.SubmitChannelData(*data));
+				stored = indices.size();
+			});
+			NVIZ_INFO("    submit, dedup {:3}         : {:8.2f} ms, {} channels stored", dedup ? "on" : "off", ms, stored);
+		}
+
+		volatile uint64_t sink = legacyHash ^ fastHash; // Keeps the hash loops from being optimised away
+		(void)sink;
+	}
+
+
+	void StoragePrecision(const std::filesystem::path& snirfPath, size_t channels, size_t samples, int repeats)
+	{
+		NVIZ_INFO("Benchmark StoragePrecision : this build stores {} samples", NIRS::ChannelValueName);
+
+		if (!snirfPath.empty() && std::filesystem::exists(snirfPath)) {
+			SNIRFLoadSettings settings;
+			settings.LoadMode = ChannelLoadMode::Eager;
+			settings.UseSessionCache = false; // Time the HDF5 read and the preprocessing
+
+			size_t rssBefore = Memory::GetProcessResidentBytes();
+			Timer timer;
+			SNIRF snirf(snirfPath, settings);
+			double loadMs = timer.ElapsedMillis();
+			size_t rssAfter = Memory::GetProcessResidentBytes();
+
+			NVIZ_INFO("    load {} : {:.2f} ms, store {:.1f} MB, RSS +{:.1f} MB", snirfPath.filename().string(), loadMs,
+				Utils::ToMegabytes(snirf.GetChannelDataRegistry()->GetResidentBytes()),
+				Utils::ToMegabytes(rssAfter > rssBefore ? rssAfter - rssBefore : 0));
+		}
+
+		NVIZ_INFO("    synthetic : {} channels x {} samples, best of {}", channels, samples, repeats);
+		auto source = Utils::MakeSyntheticChannels<double>(channels, samples);
+		Utils::BenchmarkStorePrecision<float>(source, repeats);
+		Utils::BenchmarkStorePrecision<double>(source, repeats);
+	}
+
+
+	void MeasurementTable(const std::filesystem::path& snirfPath, int repeats)
+	{
+		if (snirfPath.empty() || !std::filesystem::exists(snirfPath)) {
+			NVIZ_WARN("Benchmark MeasurementTable : open a SNIRF file first");
+			return;
+		}
+
+		// Held throughout, a file loading in the background would otherwise call into HDF5 at the same time
+		std::lock_guard<std::mutex> hdf5Lock(SNIRF::GetHDF5Mutex());
+		try {
+			HighFive::File file(snirfPath.string(), HighFive::File::ReadOnly);
+			const std::string dataPath = Utils::FindFirstDataGroup(file);
+			if (dataPath.empty()) {
+				NVIZ_WARN("Benchmark MeasurementTable : no /nirs/data block in {}", snirfPath.filename().string());
+				return;
+			}
+			HighFive::Group data = file.getGroup(dataPath);
+			auto dims = data.getDataSet("dataTimeSeries").getDimensions();
+			std::vector<Measurement> measurements(dims.size() == 2 ? dims[1] : 0);
+
+			NVIZ_INFO("Benchmark MeasurementTable : {} {}, {} columns, best of {}", snirfPath.filename().string(), dataPath, measurements.size(), repeats);
+
+			double groupsMs = -1.0, legacyMs = -1.0;
+			if (data.exist("measurementList1")) {
+				groupsMs = Utils::BestOfMillis(repeats, [&]() { NIRS::ReadMeasurementGroups(data, measurements); });
+				legacyMs = Utils::BestOfMillis(repeats, [&]() { Utils::LegacyReadMeasurementGroups(data, measurements); });
+			}
+			double compactMs = -1.0;
+			if (data.exist("measurementLists")) {
+				compactMs = Utils::BestOfMillis(repeats, [&]() { NIRS::ReadMeasurementTable(data, measurements); });
+			}
+
+			if (legacyMs >= 0.0) {
+				NVIZ_INFO("    six reads per group     : {:8.2f} ms", legacyMs);
+				NVIZ_INFO("    measurementListN groups : {:8.2f} ms ({:.2f}x)", groupsMs, legacyMs / groupsMs);
+			}
+			else {
+				NVIZ_INFO("    the file has no measurementListN groups");
+			}
+			if (compactMs >= 0.0) {
+				if (legacyMs >= 0.0) NVIZ_INFO("    measurementLists table  : {:8.2f} ms ({:.2f}x)", compactMs, legacyMs / compactMs);
+				else NVIZ_INFO("    measurementLists table  : {:8.2f} ms", compactMs);
+			}
+			else {
+				NVIZ_INFO("    the file has no measurementLists table");
+			}
+		}
+		catch (const HighFive::Exception& e) {
+			NVIZ_ERROR("Benchmark MeasurementTable : {}", e.what());
+		}
+	}
+
+
+	void FilterThroughput(size_t channels, size_t samples, int repeats)
+	{
+		const double sampleRate = 10.0;
+		auto design = FilterDesignCache::GetButterworth(FilterBand::Bandpass, 5, sampleRate, 0.01, 0.1);
+		auto source = Utils::MakeSyntheticChannels<double>(channels, samples);
+		const double msamples = static_cast<double>(channels * samples) / 1e6;
+
+		NVIZ_INFO("Benchmark FilterThroughput : {} channels x {} samples, order 5 bandpass ({} sections), best of {}",
+			channels, samples, design->Sections.size(), repeats);
+
+		auto reference = source;
+		double scalarMs = Utils::BestOfMillis(repeats, [&]() {
+			for (size_t c = 0; c < channels; c++) {
+				std::copy(source[c].begin(), source[c].end(), reference[c].begin());
+				SOSFilter filter(design);
+				for (auto& v : reference[c]) v = filter.Process(v);
+			}
+		});
+		NVIZ_INFO("    SOS scalar    : {:8.2f} ms ({:6.1f} MSamples/s)", scalarMs, msamples / (scalarMs / 1000.0));
+
+		Utils::BenchmarkFilterBank<4>(design, source, reference, repeats, msamples);
+		Utils::BenchmarkFilterBank<8>(design, source, reference, repeats, msamples);
+
+		// The transfer function the sections replaced, for reference
+		std::vector<double> b = { 1.0 }, a = { 1.0 };
+		for (const auto& s : design->Sections) {
+			auto multiply = [](const std::vector<double>& p, std::array<double, 3> q) {
+				std::vector<double> r(p.size() + 2, 0.0);
+				for (size_t i = 0; i < p.size(); i++) for (size_t j = 0; j < 3; j++) r[i + j] += p[i] * q[j];
+				return r;
+			};
+			b = multiply(b, { s.B0, s.B1, s.B2 });
+			a = multiply(a, { 1.0, s.A1, s.A2 });
+		}
+
+		auto legacy = source;
+		double legacyMs = Utils::BestOfMillis(repeats, [&]() {
+			for (size_t c = 0; c < channels; c++) {
+				std::copy(source[c].begin(), source[c].end(), legacy[c].begin());
+				IIRFilter filter(b, a);
+				for (auto& v : legacy[c]) v = filter.process(v);
+			}
+		});
+		NVIZ_INFO("    IIRFilter tf  : {:8.2f} ms ({:6.1f} MSamples/s), max diff to scalar {:.3e}",
+			legacyMs, msamples / (legacyMs / 1000.0), Utils::MaxDifference(legacy, reference));
+	}
+
+
+	void Preprocessing(size_t channels, size_t samples, int repeats)
+	{
+		const float samplingRate = 10.0f;
+		auto& pool = ThreadPool::Instance();
+
+		ChannelDataRegistry raw;
+		raw.SetDeduplication(false);
+		raw.Reserve(channels, samples);
+		for (const auto& channel : Utils::MakeSyntheticChannels(channels, samples)) raw.SubmitChannelData(channel);
+
+		ChannelDataRegistry processed;
+		processed.Reserve(channels, samples);
+		for (size_t i = 0; i < channels; i++) processed.AllocateChannelData(samples);
+
+		auto preprocess = [&](size_t i) {
+			const int index = static_cast<int>(i);
+			PreprocessHemodynamicData(raw.GetChannelData(index), processed.GetMutableChannelData(index), samplingRate);
+		};
+
+		NVIZ_INFO("Benchmark Preprocessing : {} channels x {} samples, best of {}", channels, samples, repeats);
+
+		double serialMs = Utils::BestOfMillis(repeats, [&]() {
+			for (size_t i = 0; i < channels; i++) preprocess(i);
+		});
+		double parallelMs = Utils::BestOfMillis(repeats, [&]() {
+			pool.ParallelFor(0, channels, preprocess);
+		});
+
+		NVIZ_INFO("    serial            : {:8.2f} ms", serialMs);
+		NVIZ_INFO("    {:2} workers + main : {:8.2f} ms ({:.2f}x)", pool.GetWorkerCount(), parallelMs, serialMs / parallelMs);
+	}
+
+	void MotionCorrection(size_t channels, double hours, int repeats)
+	{
+		const float samplingRate = 10.0f;
+		const size_t samples = static_cast<size_t>(hours * 3600.0 * samplingRate);
+		auto& pool = ThreadPool::Instance();
+
+		auto source = Utils::MakeSyntheticChannels<double>(channels, samples);
+		for (size_t c = 0; c < channels; c++) Utils::AddMotionArtifacts(source[c], samplingRate, static_cast<uint32_t>(c));
+		auto work = source;
+
+		auto correct = [&](size_t c) {
+			std::copy(source[c].begin(), source[c].end(), work[c].begin());
+			TemporalDerivativeDistributionRepair(work[c], samplingRate);
+		};
+
+		NVIZ_INFO("Benchmark Motion Correction : TDDR over {} channels x {:.1f} h at {} Hz ({} samples), best of {}",
+			channels, hours, samplingRate, samples, repeats);
+
+		double serialMs = Utils::BestOfMillis(repeats, [&]() {
+			for (size_t c = 0; c < channels; c++) correct(c);
+		});
+		double parallelMs = Utils::BestOfMillis(repeats, [&]() {
+			pool.ParallelFor(0, channels, correct);
+		});
+
+		const double recordingSeconds = hours * 3600.0;
+		NVIZ_INFO("    serial            : {:8.2f} ms ({:.0f}x real time)", serialMs, recordingSeconds / (serialMs / 1000.0));
+		NVIZ_INFO("    {:2} workers + main : {:8.2f} ms ({:.0f}x real time, {:.2f}x)", pool.GetWorkerCount(), parallelMs,
+			recordingSeconds / (parallelMs / 1000.0), serialMs / parallelMs);
+		NVIZ_INFO("    largest jump      : {:.4f} before, {:.4f} after", Utils::MaxJump(source), Utils::MaxJump(work));
+	}
+
+	void Resampling(size_t channels, double hours, int repeats)
+	{
+		const double samplingRate = 50.0;
+		const double targetRate = 10.0;
+		const size_t samples = static_cast<size_t>(hours * 3600.0 * samplingRate);
+		auto& pool = ThreadPool::Instance();
+
+		const auto [up, down] = GetResamplingRatio(samplingRate, targetRate);
+		auto source = Utils::MakeSyntheticChannels(channels, samples);
+		std::vector<std::vector<NIRS::ChannelValue>> resampled(channels, std::vector<NIRS::ChannelValue>(GetResampledLength(samples, up, down)));
+
+		auto resample = [&](size_t c) { ResamplePolyphase(source[c], resampled[c], up, down); };
+		auto bandpass = [&](const std::vector<NIRS::ChannelValue>& channel, float rate) {
+			thread_local std::vector<double> signal;
+			signal.assign(channel.begin(), channel.end());
+			ButterworthBandpassFilter(signal, rate, 0.01f, 0.1f);
+		};
+
+		NVIZ_INFO("Benchmark Resampling : {} channels x {:.1f} h from {} Hz to {} Hz ({} / {}), best of {}",
+			channels, hours, samplingRate, targetRate, up, down, repeats);
+
+		double serialMs = Utils::BestOfMillis(repeats, [&]() {
+			for (size_t c = 0; c < channels; c++) resample(c);
+		});
+		double parallelMs = Utils::BestOfMillis(repeats, [&]() {
+			pool.ParallelFor(0, channels, resample);
+		});
+		double fullRateMs = Utils::BestOfMillis(repeats, [&]() {
+			pool.ParallelFor(0, channels, [&](size_t c) { bandpass(source[c], static_cast<float>(samplingRate)); });
+		});
+		double reducedRateMs = Utils::BestOfMillis(repeats, [&]() {
+			pool.ParallelFor(0, channels, [&](size_t c) { bandpass(resampled[c], static_cast<float>(targetRate)); });
+		});
+
+		const double inputSamples = static_cast<double>(channels) * samples;
+		NVIZ_INFO("    serial            : {:8.2f} ms ({:.1f} M input samples/s)", serialMs, inputSamples / (serialMs * 1000.0));
+		NVIZ_INFO("    {:2} workers + main : {:8.2f} ms ({:.2f}x)", pool.GetWorkerCount(), parallelMs, serialMs / parallelMs);
+		NVIZ_INFO("    bandpass          : {:8.2f} ms at {} Hz, {:.2f} ms at {} Hz ({:.2f}x)",
+			fullRateMs, samplingRate, reducedRateMs, targetRate, fullRateMs / reducedRateMs);
+	}
+
+	void BlockAveraging(size_t channels, double hours, size_t trials, int repeats)
+	{
+		const double samplingRate = 10.0;
+		const size_t samples = static_cast<size_t>(hours * 3600.0 * samplingRate);
+		const size_t arrays = channels * 2;
+		auto& pool = ThreadPool::Instance();
+
+		ChannelDataRegistry registry;
+		registry.SetDeduplication(false);
+		registry.Reserve(arrays, samples);
+		for (const auto& array : Utils::MakeSyntheticChannels(arrays, samples)) {
+			auto data = registry.GetMutableChannelData(registry.AllocateChannelData(samples));
+			std::copy(array.begin(), array.end(), data.begin());
+		}
+
+		// Trials evenly spread over the recording, conditions taking turns
+		std::vector<Stimulus> stimuli(3);
+		for (size_t c = 0; c < stimuli.size(); c++) stimuli[c].Name = "Condition " + std::to_string(c + 1);
+		const double spacing = hours * 3600.0 / (trials + 1);
+		for (size_t t = 0; t < trials; t++) stimuli[t % stimuli.size()].Events.push_back({ (t + 1) * spacing, 10.0, 1.0 });
+		const EventIndex events(stimuli);
+
+		NVIZ_INFO("Benchmark Block Averaging : {} trials over {} arrays x {:.1f} h at {} Hz, best of {}",
+			trials, arrays, hours, samplingRate, repeats);
+
+		const EpochSettings settings;
+		double serialMs = Utils::BestOfMillis(repeats, [&]() {
+			ComputeBlockAverage(events, registry, 0.0, samplingRate, samples, settings, false);
+		});
+		double parallelMs = Utils::BestOfMillis(repeats, [&]() {
+			ComputeBlockAverage(events, registry, 0.0, samplingRate, samples, settings, true);
+		});
+
+		NVIZ_INFO("    serial            : {:8.2f} ms", serialMs);
+		NVIZ_INFO("    {:2} workers + main : {:8.2f} ms ({:.2f}x)", pool.GetWorkerCount(), parallelMs, serialMs / parallelMs);
+	}
+
+	void PlotFrame(size_t channels, double hours, size_t plotted, size_t width, int frames, int repeats)
+	{
+		const double samplingRate = 10.0;
+		const size_t samples = static_cast<size_t>(hours * 3600.0 * samplingRate);
+		plotted = std::min(plotted, channels);
+
+		// What the plotting panel reads from a loaded file: the time axis, the channel map and the registry
+		ChannelDataRegistry registry;
+		registry.SetDeduplication(false);
+		registry.Reserve(channels * 2, samples);
+		for (const auto& array : Utils::MakeSyntheticChannels(channels * 2, samples)) {
+			auto data = registry.GetMutableChannelData(registry.AllocateChannelData(samples));
+			std::copy(array.begin(), array.end(), data.begin());
+		}
+		std::vector<double> time(samples);
+		for (size_t s = 0; s < samples; s++) time[s] = s / samplingRate;
+		std::map<ChannelID, Channel> channelMap;
+		for (size_t c = 0; c < channels; c++) {
+			Channel channel = {};
+			channel.ID = static_cast<ChannelID>(c + 1);
+			channel.HBODataIndex = static_cast<ChannelDataID>(2 * c);
+			channel.HBRDataIndex = static_cast<ChannelDataID>(2 * c + 1);
+			channelMap[channel.ID] = channel;
+		}
+		const auto pyramids = BuildMinMaxPyramids(registry, samples);
+
+		NVIZ_INFO("Benchmark Plot Frame : {} of {} channels (HbO and HbR) x {:.1f} h at {} Hz, {} px wide, zoomed out, {} frames, best of {}",
+			plotted, channels, hours, samplingRate, width, frames, repeats);
+
+		volatile double sink = 0.0;
+		size_t points = 0;
+
+		// The time series path before: the time axis and the channel map returned by value, every
+		// array copied into a vector of doubles and a new label string per line
+		auto copyingMap = [&]() { return channelMap; };
+		auto copyingTime = [&]() { return time; };
+		double copyingMs = Utils::BestOfMillis(repeats, [&]() {
+			for (int f = 0; f < frames; f++) {
+				auto frameTime = copyingTime();
+				auto frameMap = copyingMap();
+				for (size_t c = 1; c <= plotted; c++) {
+					auto& channel = frameMap[static_cast<ChannelID>(c)];
+					for (ChannelDataID index : { channel.HBODataIndex, channel.HBRDataIndex }) {
+						const std::string label = "Channel " + std::to_string(c) + (index == channel.HBODataIndex ? " - HbO" : " - HbR");
+						auto view = registry.GetChannelData(index);
+						std::vector<double> data(view.begin(), view.end());
+						sink = sink + Utils::ReadPoints(data.data(), data.size()) + label.size() + frameTime.front();
+					}
+				}
+			}
+		});
+
+		// References and views only, still every sample of every line
+		double viewsMs = Utils::BestOfMillis(repeats, [&]() {
+			char label[64];
+			for (int f = 0; f < frames; f++) {
+				const auto& frameMap = channelMap;
+				for (size_t c = 1; c <= plotted; c++) {
+					const auto& channel = frameMap.find(static_cast<ChannelID>(c))->second;
+					for (ChannelDataID index : { channel.HBODataIndex, channel.HBRDataIndex }) {
+						std::snprintf(label, sizeof(label), "Channel %zu - %s", c, index == channel.HBODataIndex ? "HbO" : "HbR");
+						auto view = registry.GetChannelData(index);
+						sink = sink + Utils::ReadPoints(view.data(), view.size()) + label[0];
+					}
+				}
+			}
+		});
+
+		// The time series path now: views through the pyramids, about two points per pixel column
+		double pyramidsMs = Utils::BestOfMillis(repeats, [&]() {
+			char label[64];
+			points = 0;
+			for (int f = 0; f < frames; f++) {
+				const auto& frameMap = channelMap;
+				for (size_t c = 1; c <= plotted; c++) {
+					const auto& channel = frameMap.find(static_cast<ChannelID>(c))->second;
+					for (ChannelDataID index : { channel.HBODataIndex, channel.HBRDataIndex }) {
+						std::snprintf(label, sizeof(label), "Channel %zu - %s", c, index == channel.HBODataIndex ? "HbO" : "HbR");
+						const auto range = pyramids[index].GetRange(registry.GetChannelData(index), 0, samples, width);
+						sink = sink + Utils::ReadPoints(range.Values.data(), range.Values.size()) + label[0];
+						points += range.Values.size();
+					}
+				}
+			}
+		});
+
+		const double lines = static_cast<double>(plotted * 2);
+		NVIZ_INFO("    copying           : {:8.3f} ms per frame ({:.0f} points per line)", copyingMs / frames, static_cast<double>(samples));
+		NVIZ_INFO("    views             : {:8.3f} ms per frame ({:.2f}x)", viewsMs / frames, copyingMs / viewsMs);
+		NVIZ_INFO("    views + pyramids  : {:8.3f} ms per frame ({:.2f}x, {:.0f} points per line)",
+			pyramidsMs / frames, copyingMs / pyramidsMs, points / (lines * frames));
+	}
+}
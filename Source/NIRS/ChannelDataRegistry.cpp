@@ -0,0 +1,363 @@
+#include "pch.h"
+#include "NIRS/ChannelDataRegistry.h"
+
+#include "Core/Hash.h"
+
+void ChannelDataRegistry::Reserve(size_t channels, size_t length)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	size_t needed = m_StorageUsed + channels * AlignedLength(length);
+	if (needed > m_Storage.Size()) m_Storage.Resize(needed);
+}
+
+int ChannelDataRegistry::AllocateChannelData(size_t length)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	int new_index = static_cast<int>(m_Entries.size());
+	ChannelEntry entry;
+	entry.Length = length;
+	entry.Offset = AppendStorage(length);
+	m_Entries.push_back(entry);
+	m_TimeMajorValid = false;
+	return new_index;
+}
+
+int ChannelDataRegistry::SubmitChannelData(Span<const Sample> data)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	uint64_t hash_val = 0;
+	if (m_Deduplicate) {
+		hash_val = HashChannelData(data);
+
+		auto [first, last] = m_LookupMap.equal_range(hash_val);
+		for (auto it = first; it != last; ++it) {
+			const auto& entry = m_Entries[it->second];
+			if (entry.Length == data.size() && std::memcmp(m_Storage.Data() + entry.Offset, data.data(), data.size_bytes()) == 0) {
+				return it->second;
+			}
+		}
+	}
+
+	int new_index = static_cast<int>(m_Entries.size());
+	size_t offset = AppendStorage(data.size());
+	std::copy(data.begin(), data.end(), m_Storage.Data() + offset);
+	ChannelEntry entry;
+	entry.Length = data.size();
+	entry.Offset = offset;
+	m_Entries.push_back(entry);
+	m_TimeMajorValid = false;
+
+	if (m_Deduplicate) m_LookupMap.emplace(hash_val, new_index);
+
+	return new_index;
+}
+
+int ChannelDataRegistry::AdoptChannelData(Ref<const void> owner, const Sample* data, size_t count, size_t length, size_t stride)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	int first_index = static_cast<int>(m_Entries.size());
+	for (size_t i = 0; i < count; i++) {
+		ChannelEntry entry;
+		entry.Length = length;
+		entry.External = data + i * stride;
+		m_Entries.push_back(entry);
+	}
+	m_Owners.push_back(std::move(owner));
+	m_TimeMajorValid = false;
+	return first_index;
+}
+
+int ChannelDataRegistry::RegisterLazyChannel(size_t length)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	int new_index = static_cast<int>(m_Entries.size());
+	ChannelEntry entry;
+	entry.Length = length;
+	entry.Lazy = true; // Nothing is resident until the channel is requested
+	m_Entries.push_back(entry);
+
+	m_LazyChannelCount++;
+	if (length > m_MaxLazyLength) {
+		m_MaxLazyLength = length;
+		ReleaseLazySlots(); // The slots no longer fit every lazy channel
+	}
+	return new_index;
+}
+
+void ChannelDataRegistry::SetChannelLoader(const ChannelLoader& loader)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Loader = loader;
+}
+
+void ChannelDataRegistry::SetCacheBudget(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_CacheBudgetBytes = bytes;
+	ReleaseLazySlots(); // Resized for the new budget on the next request
+}
+
+ChannelDataRegistry::ChannelView ChannelDataRegistry::GetChannelData(int index) const
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	ValidateIndex(index);
+
+	const auto& entry = m_Entries[index];
+	if (entry.Lazy) return GetLazyChannelData(index, lock);
+	if (entry.External) return { entry.External, entry.Length };
+	return { m_Storage.Data() + entry.Offset, entry.Length };
+}
+
+ChannelDataRegistry::MutableChannelView ChannelDataRegistry::GetMutableChannelData(int index)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	ValidateIndex(index);
+
+	const auto& entry = m_Entries[index];
+	if (entry.Lazy) {
+		NVIZ_ERROR("Channel data index {} is lazily loaded and cannot be written to.", index);
+		throw std::logic_error("Lazy channel data is read-only.");
+	}
+	if (entry.External) {
+		NVIZ_ERROR("Channel data index {} is adopted from external memory and cannot be written to.", index);
+		throw std::logic_error("Adopted channel data is read-only.");
+	}
+	m_TimeMajorValid = false;
+	return { m_Storage.Data() + entry.Offset, entry.Length };
+}
+
+ChannelDataRegistry::ChannelView ChannelDataRegistry::GetTimepoint(size_t sample) const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (!m_TimeMajorValid && !BuildTimeMajorView()) return {};
+
+	const size_t channels = m_Entries.size();
+	if (sample >= m_Entries[0].Length) return {};
+	return { m_TimeMajor.Data() + sample * channels, channels };
+}
+
+void ChannelDataRegistry::InvalidateTimeMajorView()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_TimeMajorValid = false;
+}
+
+bool ChannelDataRegistry::IsChannelResident(int index) const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	ValidateIndex(index);
+	return !m_Entries[index].Lazy || m_LRULookup.count(index) > 0;
+}
+
+size_t ChannelDataRegistry::GetChannelLength(int index) const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	ValidateIndex(index);
+	return m_Entries[index].Length;
+}
+
+size_t ChannelDataRegistry::GetResidentBytes() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_StorageUsed * sizeof(Sample) + m_LazyResidentBytes;
+}
+
+void ChannelDataRegistry::Clear()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	ReleaseLazySlots(); // Before the entries, evicting touches them
+
+	m_Storage.Release();
+	m_StorageUsed = 0;
+	m_Entries.clear();
+	m_LookupMap.clear();
+	m_Owners.clear();
+
+	m_Loader = nullptr;
+	m_LazyChannelCount = 0;
+	m_MaxLazyLength = 0;
+
+	m_TimeMajor.Release();
+	m_TimeMajorValid = false;
+}
+
+size_t ChannelDataRegistry::AppendStorage(size_t length)
+{
+	// Geometric growth keeps the amortised cost low when nothing was reserved
+	size_t offset = m_StorageUsed;
+	size_t needed = offset + AlignedLength(length);
+	if (needed > m_Storage.Size()) m_Storage.Resize(std::max(needed, m_Storage.Size() * 2));
+
+	m_StorageUsed = needed;
+	return offset;
+}
+
+void ChannelDataRegistry::ValidateIndex(int index) const
+{
+	if (index < 0 || static_cast<size_t>(index) >= m_Entries.size()) {
+		NVIZ_ERROR("Invalid channel data index: {}", index);
+		throw std::out_of_range("Invalid channel data index.");
+	}
+}
+
+ChannelDataRegistry::ChannelView ChannelDataRegistry::GetLazyChannelData(int index, std::unique_lock<std::mutex>& lock) const
+{
+	// Another thread may be reading this channel from the file, its samples are used once they are in
+	m_LoadCondition.wait(lock, [&]() { return static_cast<size_t>(index) >= m_Entries.size() || !m_Entries[index].Loading; });
+	ValidateIndex(index); // Cleared meanwhile
+
+	const auto& entry = m_Entries[index];
+	if (!m_LRULookup.count(index)) return LoadLazyChannel(index, lock);
+
+	TouchLazyChannel(index);
+	const auto& slot = m_LazySlots[entry.Slot];
+	return { slot->Data(), entry.Length, slot };
+}
+
+ChannelDataRegistry::ChannelView ChannelDataRegistry::LoadLazyChannel(int index, std::unique_lock<std::mutex>& lock) const
+{
+	if (!m_Loader) {
+		NVIZ_ERROR("No channel loader set, cannot fetch lazy channel data index: {}", index);
+		throw std::logic_error("Lazy channel requested without a channel loader.");
+	}
+
+	if (m_LazySlots.empty()) {
+		// As many slots as the budget allows, at least one so the caller always gets its data
+		m_LazySlotStride = AlignedLength(m_MaxLazyLength);
+		size_t slots = m_CacheBudgetBytes / std::max<size_t>(m_LazySlotStride * sizeof(Sample), 1);
+		slots = std::clamp<size_t>(slots, 1, m_LazyChannelCount);
+
+		m_LazySlots.resize(slots);
+		for (int slot = static_cast<int>(slots) - 1; slot >= 0; slot--) m_FreeSlots.push_back(slot);
+	}
+	if (m_FreeSlots.empty()) EvictLazyChannels();
+
+	const ChannelLoader loader = m_Loader;
+	const size_t length = m_Entries[index].Length;
+
+	// Every slot is being filled by another thread. The caller reads into a buffer of its own
+	// that is not kept, rather than waiting for a slot.
+	if (m_FreeSlots.empty()) {
+		const Ref<AlignedBuffer<Sample>> buffer = std::make_shared<AlignedBuffer<Sample>>(AlignedLength(length));
+		lock.unlock();
+		loader(index, { buffer->Data(), length });
+		lock.lock();
+		return { buffer->Data(), length, buffer };
+	}
+
+	// The slot is neither free nor in the LRU while the channel loads, so nobody else takes it
+	const int slotIndex = m_FreeSlots.back();
+	m_FreeSlots.pop_back();
+
+	// Views are only created under the lock, so a count of one means nobody else reads the buffer.
+	// Otherwise a view still shows the channel evicted from here and keeps that buffer to itself.
+	auto& slot = m_LazySlots[slotIndex];
+	if (!slot || slot.use_count() > 1) slot = std::make_shared<AlignedBuffer<Sample>>(m_LazySlotStride);
+	std::atomic_thread_fence(std::memory_order_acquire); // Pairs with the release of the last view
+
+	const Ref<AlignedBuffer<Sample>> buffer = slot;
+	const uint64_t generation = m_LazyGeneration;
+	m_Entries[index].Loading = true;
+
+	lock.unlock();
+	try {
+		loader(index, { buffer->Data(), length });
+	}
+	catch (...) {
+		// Back to the free list, a failed read must not cost a slot
+		lock.lock();
+		if (generation == m_LazyGeneration) {
+			m_FreeSlots.push_back(slotIndex);
+			m_Entries[index].Loading = false;
+		}
+		m_LoadCondition.notify_all();
+		throw;
+	}
+	lock.lock();
+	m_LoadCondition.notify_all();
+
+	// Released meanwhile, the caller still gets its samples but they are not kept
+	if (generation != m_LazyGeneration) return { buffer->Data(), length, buffer };
+
+	auto& entry = m_Entries[index];
+	entry.Slot = slotIndex;
+	entry.Loading = false;
+	m_LRU.push_front(index);
+	m_LRULookup[index] = m_LRU.begin();
+	m_LazyResidentBytes += m_LazySlotStride * sizeof(Sample);
+	return { buffer->Data(), length, buffer };
+}
+
+void ChannelDataRegistry::TouchLazyChannel(int index) const
+{
+	m_LRU.splice(m_LRU.begin(), m_LRU, m_LRULookup.at(index));
+}
+
+void ChannelDataRegistry::EvictLazyChannel(int index) const
+{
+	auto& entry = m_Entries[index];
+	m_FreeSlots.push_back(entry.Slot);
+	entry.Slot = -1;
+	m_LazyResidentBytes -= m_LazySlotStride * sizeof(Sample);
+
+	m_LRU.erase(m_LRULookup.at(index));
+	m_LRULookup.erase(index);
+}
+
+void ChannelDataRegistry::EvictLazyChannels() const
+{
+	// Free the least recently used slot. Slots being filled are in neither list, so this
+	// can leave the free list empty when every slot is in flight.
+	if (m_FreeSlots.empty() && !m_LRU.empty()) EvictLazyChannel(m_LRU.back());
+}
+
+void ChannelDataRegistry::ReleaseLazySlots() const
+{
+	while (!m_LRU.empty()) EvictLazyChannel(m_LRU.back());
+
+	m_LazySlots.clear(); // Buffers still held by views are freed with the last of them
+	m_LazySlotStride = 0;
+	m_FreeSlots.clear();
+
+	// Loads in flight finish into their own buffers, whoever waits on them loads again
+	m_LazyGeneration++;
+	for (auto& entry : m_Entries) entry.Loading = false;
+	m_LoadCondition.notify_all();
+}
+
+bool ChannelDataRegistry::BuildTimeMajorView() const
+{
+	if (m_Entries.empty() || m_LazyChannelCount > 0) return false;
+
+	const size_t channels = m_Entries.size();
+	const size_t samples = m_Entries[0].Length;
+	for (const auto& entry : m_Entries) {
+		if (entry.Length != samples) return false;
+	}
+
+	m_TimeMajor.Resize(samples * channels);
+
+	// Transposed in tiles so both the reads and the writes stay within a few cache lines
+	constexpr size_t Tile = 32;
+	const Sample* source = m_Storage.Data();
+	Sample* target = m_TimeMajor.Data();
+	for (size_t s0 = 0; s0 < samples; s0 += Tile) {
+		const size_t s1 = std::min(s0 + Tile, samples);
+		for (size_t c = 0; c < channels; c++) {
+			const auto& entry = m_Entries[c];
+			const Sample* channel = entry.External ? entry.External : source + entry.Offset;
+			for (size_t s = s0; s < s1; s++) {
+				target[s * channels + c] = channel[s];
+			}
+		}
+	}
+
+	m_TimeMajorValid = true;
+	return true;
+}
+
+uint64_t ChannelDataRegistry::HashChannelData(Span<const Sample> data) const
+{
+	return Hash::XXH64(data.data(), data.size_bytes());
+}
@@ -0,0 +1,96 @@
+#include "pch.h"
+#include "NIRS/Epochs.h"
+
+#include "Core/ThreadPool.h"
+#include "Core/Timer.h"
+
+NIRS::EpochLayout NIRS::GetEpochLayout(Span<const IndexedEvent> events, double startTime, double sampleRate, size_t sampleCount, const EpochSettings& settings)
+{
+	EpochLayout layout;
+	if (sampleRate <= 0.0) return layout;
+
+	layout.PreSamples = static_cast<size_t>(std::lround(std::max(0.0f, settings.PreStimulus) * sampleRate));
+	layout.Length = layout.PreSamples + static_cast<size_t>(std::lround(std::max(0.0f, settings.PostStimulus) * sampleRate)) + 1;
+
+	layout.Starts.reserve(events.size());
+	for (const auto& event : events) {
+		const long long onset = std::llround((event.Onset - startTime) * sampleRate);
+		const long long start = onset - static_cast<long long>(layout.PreSamples);
+		if (start < 0 || static_cast<size_t>(start) + layout.Length > sampleCount) continue;
+		layout.Starts.push_back(static_cast<size_t>(start));
+	}
+	return layout;
+}
+
+NIRS::BlockAverage NIRS::ComputeBlockAverage(const EventIndex& events, const ChannelDataRegistry& registry, double startTime, double sampleRate,
+	size_t sampleCount, const EpochSettings& settings, bool parallel)
+{
+	Timer timer;
+	BlockAverage result;
+	const size_t conditions = events.GetConditionCount();
+	const size_t arrays = registry.GetChannelCount();
+
+	std::vector<EpochLayout> layouts(conditions);
+	for (size_t c = 0; c < conditions; c++) layouts[c] = GetEpochLayout(events.GetEvents(c), startTime, sampleRate, sampleCount, settings);
+
+	const auto shape = GetEpochLayout({}, startTime, sampleRate, sampleCount, settings);
+	result.SampleRate = sampleRate;
+	result.Length = shape.Length;
+	result.StartTime = sampleRate > 0.0 ? -static_cast<double>(shape.PreSamples) / sampleRate : 0.0;
+	for (size_t c = 0; c < conditions; c++) {
+		result.Conditions.push_back(events.GetConditionName(c));
+		result.EpochCounts.push_back(layouts[c].GetEpochCount());
+		result.Mean.push_back(Eigen::MatrixXd::Zero(result.Length, arrays));
+		result.StandardError.push_back(Eigen::MatrixXd::Zero(result.Length, arrays));
+	}
+	if (result.Length == 0 || arrays == 0) return result;
+
+	const bool baseline = settings.BaselineCorrect && shape.PreSamples > 0;
+	auto average = [&](size_t i) {
+		auto data = registry.GetChannelData(static_cast<int>(i));
+		if (data.size() < sampleCount) return; // Not loaded yet, left at zero
+
+		// One baseline per epoch, kept for the second pass. Reused per thread.
+		thread_local std::vector<double> baselines;
+		for (size_t c = 0; c < conditions; c++) {
+			const auto& layout = layouts[c];
+			const size_t count = layout.GetEpochCount();
+			if (count == 0) continue;
+
+			// Columns of column-major matrices, contiguous like the epochs themselves
+			double* mean = result.Mean[c].col(static_cast<Eigen::Index>(i)).data();
+			baselines.assign(count, 0.0);
+			for (size_t e = 0; e < count; e++) {
+				const auto epoch = layout.GetEpoch(data, e);
+				if (baseline) {
+					double sum = 0.0;
+					for (size_t s = 0; s < layout.PreSamples; s++) sum += epoch[s];
+					baselines[e] = sum / layout.PreSamples;
+				}
+				for (size_t s = 0; s < layout.Length; s++) mean[s] += epoch[s] - baselines[e];
+			}
+			for (size_t s = 0; s < layout.Length; s++) mean[s] /= static_cast<double>(count);
+			if (count < 2) continue;
+
+			// Second pass over the same views rather than a running sum of squares, which
+			// cancels badly on raw intensities with a large offset
+			double* error = result.StandardError[c].col(static_cast<Eigen::Index>(i)).data();
+			for (size_t e = 0; e < count; e++) {
+				const auto epoch = layout.GetEpoch(data, e);
+				for (size_t s = 0; s < layout.Length; s++) {
+					const double deviation = epoch[s] - baselines[e] - mean[s];
+					error[s] += deviation * deviation;
+				}
+			}
+			const double scale = 1.0 / (static_cast<double>(count - 1) * count);
+			for (size_t s = 0; s < layout.Length; s++) error[s] = std::sqrt(error[s] * scale);
+		}
+	};
+	if (parallel) ThreadPool::Instance().ParallelFor(0, arrays, average);
+	else for (size_t i = 0; i < arrays; i++) average(i);
+
+	size_t epochs = 0;
+	for (size_t count : result.EpochCounts) epochs += count;
+	NVIZ_INFO("Averaged {} epochs of {} conditions over {} arrays in {:.2f} ms", epochs, conditions, arrays, timer.ElapsedMillis());
+	return result;
+}
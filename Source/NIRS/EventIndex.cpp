@@ -0,0 +1,51 @@
+#include "pch.h"
+#include "NIRS/EventIndex.h"
+
+namespace Utils {
+
+	static Span<const NIRS::IndexedEvent> FindOnsets(Span<const NIRS::IndexedEvent> events, double start, double end)
+	{
+		if (!(start < end)) return {};
+		auto byOnset = [](const NIRS::IndexedEvent& event, double time) { return event.Onset < time; };
+		const auto first = std::lower_bound(events.begin(), events.end(), start, byOnset);
+		const auto last = std::lower_bound(first, events.end(), end, byOnset);
+		return { first, static_cast<size_t>(last - first) };
+	}
+}
+
+NIRS::EventIndex::EventIndex(const std::vector<Stimulus>& stimuli)
+{
+	m_ConditionEvents.resize(stimuli.size());
+	for (size_t c = 0; c < stimuli.size(); c++) {
+		m_ConditionNames.push_back(stimuli[c].Name);
+
+		auto& events = m_ConditionEvents[c];
+		events.reserve(stimuli[c].Events.size());
+		for (const auto& event : stimuli[c].Events) {
+			events.push_back({ event.Onset, event.Duration, event.Amplitude, static_cast<uint32_t>(c) });
+			m_LongestDuration = std::max(m_LongestDuration, event.Duration);
+		}
+
+		// Files keep events in the order they were logged, which is not always by onset
+		std::stable_sort(events.begin(), events.end(), [](const IndexedEvent& a, const IndexedEvent& b) { return a.Onset < b.Onset; });
+		m_Events.insert(m_Events.end(), events.begin(), events.end());
+	}
+
+	std::stable_sort(m_Events.begin(), m_Events.end(), [](const IndexedEvent& a, const IndexedEvent& b) { return a.Onset < b.Onset; });
+}
+
+Span<const NIRS::IndexedEvent> NIRS::EventIndex::GetEvents(size_t condition) const
+{
+	if (condition >= m_ConditionEvents.size()) return {};
+	return m_ConditionEvents[condition];
+}
+
+Span<const NIRS::IndexedEvent> NIRS::EventIndex::GetEventsInWindow(double start, double end) const
+{
+	return Utils::FindOnsets(m_Events, start, end);
+}
+
+Span<const NIRS::IndexedEvent> NIRS::EventIndex::GetEventsInWindow(size_t condition, double start, double end) const
+{
+	return Utils::FindOnsets(GetEvents(condition), start, end);
+}
@@ -0,0 +1,611 @@
+#include "pch.h"
+#include "NIRS/Filter.h"
+
+#include <numeric>
+
+namespace Utils {
+
+	using Complex = std::complex<double>;
+
+	constexpr double PI = 3.14159265358979323846;
+
+	// Imaginary parts below this are treated as rounding noise of a real root
+	constexpr double RealTolerance = 1e-10;
+
+	struct ZPK {
+		std::vector<Complex> Zeros;
+		std::vector<Complex> Poles;
+		double Gain = 1.0;
+	};
+
+	// Normalised analog prototype, poles on the left half of the unit circle, no zeros
+	ZPK ButterworthPrototype(int order)
+	{
+		ZPK zpk;
+		for (int m = -order + 1; m < order; m += 2) {
+			zpk.Poles.push_back(-std::exp(Complex(0.0, PI * m / (2.0 * order))));
+		}
+		return zpk;
+	}
+
+	// Analog frequency (rad/s) that the bilinear transform maps to 'cutoff' Hz
+	double Prewarp(double cutoff, double sampleRate)
+	{
+		return 2.0 * sampleRate * std::tan(PI * cutoff / sampleRate);
+	}
+
+	Complex Product(const std::vector<Complex>& values, Complex offset, double sign)
+	{
+		Complex result = 1.0;
+		for (const auto& v : values) result *= offset + sign * v;
+		return result;
+	}
+
+	void LowpassTransform(ZPK& zpk, double wo)
+	{
+		const int degree = static_cast<int>(zpk.Poles.size() - zpk.Zeros.size());
+		for (auto& z : zpk.Zeros) z *= wo;
+		for (auto& p : zpk.Poles) p *= wo;
+		zpk.Gain *= std::pow(wo, degree);
+	}
+
+	void HighpassTransform(ZPK& zpk, double wo)
+	{
+		const int degree = static_cast<int>(zpk.Poles.size() - zpk.Zeros.size());
+		zpk.Gain *= std::real(Product(zpk.Zeros, 0.0, -1.0) / Product(zpk.Poles, 0.0, -1.0));
+		for (auto& z : zpk.Zeros) z = wo / z;
+		for (auto& p : zpk.Poles) p = wo / p;
+		zpk.Zeros.insert(zpk.Zeros.end(), degree, Complex(0.0));
+	}
+
+	// Each root r of the lowpass becomes the two roots of s^2 - r bw s + wo^2
+	std::vector<Complex> SplitRoots(const std::vector<Complex>& roots, double wo)
+	{
+		std::vector<Complex> split;
+		split.reserve(roots.size() * 2);
+		for (const auto& r : roots) split.push_back(r + std::sqrt(r * r - wo * wo));
+		for (const auto& r : roots) split.push_back(r - std::sqrt(r * r - wo * wo));
+		return split;
+	}
+
+	void BandpassTransform(ZPK& zpk, double wo, double bw)
+	{
+		const int degree = static_cast<int>(zpk.Poles.size() - zpk.Zeros.size());
+		for (auto& z : zpk.Zeros) z *= bw / 2.0;
+		for (auto& p : zpk.Poles) p *= bw / 2.0;
+		zpk.Zeros = SplitRoots(zpk.Zeros, wo);
+		zpk.Poles = SplitRoots(zpk.Poles, wo);
+		zpk.Zeros.insert(zpk.Zeros.end(), degree, Complex(0.0));
+		zpk.Gain *= std::pow(bw, degree);
+	}
+
+	void BandstopTransform(ZPK& zpk, double wo, double bw)
+	{
+		const int degree = static_cast<int>(zpk.Poles.size() - zpk.Zeros.size());
+		zpk.Gain *= std::real(Product(zpk.Zeros, 0.0, -1.0) / Product(zpk.Poles, 0.0, -1.0));
+		for (auto& z : zpk.Zeros) z = (bw / 2.0) / z;
+		for (auto& p : zpk.Poles) p = (bw / 2.0) / p;
+		zpk.Zeros = SplitRoots(zpk.Zeros, wo);
+		zpk.Poles = SplitRoots(zpk.Poles, wo);
+		zpk.Zeros.insert(zpk.Zeros.end(), degree, Complex(0.0, wo));
+		zpk.Zeros.insert(zpk.Zeros.end(), degree, Complex(0.0, -wo));
+	}
+
+	void BilinearTransform(ZPK& zpk, double sampleRate)
+	{
+		const double fs2 = 2.0 * sampleRate;
+		const int degree = static_cast<int>(zpk.Poles.size() - zpk.Zeros.size());
+		zpk.Gain *= std::real(Product(zpk.Zeros, fs2, -1.0) / Product(zpk.Poles, fs2, -1.0));
+		for (auto& z : zpk.Zeros) z = (fs2 + z) / (fs2 - z);
+		for (auto& p : zpk.Poles) p = (fs2 + p) / (fs2 - p);
+		zpk.Zeros.insert(zpk.Zeros.end(), degree, Complex(-1.0));
+	}
+
+	bool IsReal(const Complex& c) { return std::abs(c.imag()) <= RealTolerance; }
+
+	// Index of the root in 'roots' closest to 'target', -1 when empty
+	int NearestRoot(const std::vector<Complex>& roots, const Complex& target)
+	{
+		int best = -1;
+		for (int i = 0; i < static_cast<int>(roots.size()); i++) {
+			if (best < 0 || std::abs(roots[i] - target) < std::abs(roots[best] - target)) best = i;
+		}
+		return best;
+	}
+
+	Complex TakeRoot(std::vector<Complex>& roots, int index)
+	{
+		Complex root = roots[index];
+		roots.erase(roots.begin() + index);
+		return root;
+	}
+
+	// Groups conjugate pole pairs (and real poles two by two) into sections and gives
+	// each the zeros closest to it. Sections whose poles sit closest to the unit circle
+	// pick their zeros first and end up last in the cascade, as in scipy's zpk2sos.
+	std::vector<NIRS::BiquadSection> PairSections(const ZPK& zpk)
+	{
+		std::vector<Complex> complexPoles, realPoles, complexZeros, realZeros;
+		for (const auto& p : zpk.Poles) {
+			if (IsReal(p)) realPoles.push_back(p.real());
+			else if (p.imag() > 0.0) complexPoles.push_back(p);
+		}
+		for (const auto& z : zpk.Zeros) {
+			if (IsReal(z)) realZeros.push_back(z.real());
+			else if (z.imag() > 0.0) complexZeros.push_back(z);
+		}
+
+		auto distanceToCircle = [](const Complex& p) { return 1.0 - std::abs(p); };
+		std::sort(realPoles.begin(), realPoles.end(), [&](const Complex& a, const Complex& b) {
+			return distanceToCircle(a) < distanceToCircle(b);
+		});
+
+		struct PoleGroup { std::vector<Complex> Poles; double Distance; };
+		std::vector<PoleGroup> groups;
+		for (const auto& p : complexPoles) groups.push_back({ { p, std::conj(p) }, distanceToCircle(p) });
+		for (size_t i = 0; i < realPoles.size(); i += 2) {
+			PoleGroup group{ { realPoles[i] }, distanceToCircle(realPoles[i]) };
+			if (i + 1 < realPoles.size()) group.Poles.push_back(realPoles[i + 1]);
+			groups.push_back(group);
+		}
+		std::sort(groups.begin(), groups.end(), [](const PoleGroup& a, const PoleGroup& b) { return a.Distance < b.Distance; });
+
+		std::vector<NIRS::BiquadSection> sections(groups.size());
+		for (size_t g = 0; g < groups.size(); g++) {
+			const auto& poles = groups[g].Poles;
+
+			std::vector<Complex> zeros;
+			if (poles.size() == 2 && !complexZeros.empty()) {
+				Complex z = TakeRoot(complexZeros, NearestRoot(complexZeros, poles[0]));
+				zeros = { z, std::conj(z) };
+			}
+			else {
+				for (size_t i = 0; i < poles.size() && !realZeros.empty(); i++) {
+					zeros.push_back(TakeRoot(realZeros, NearestRoot(realZeros, poles[0])));
+				}
+			}
+
+			// Stored in reverse so the groups closest to the unit circle come last
+			auto& section = sections[groups.size() - 1 - g];
+			if (zeros.size() == 2) {
+				section.B1 = -std::real(zeros[0] + zeros[1]);
+				section.B2 = std::real(zeros[0] * zeros[1]);
+			}
+			else if (zeros.size() == 1) {
+				section.B1 = -zeros[0].real();
+			}
+
+			if (poles.size() == 2) {
+				section.A1 = -std::real(poles[0] + poles[1]);
+				section.A2 = std::real(poles[0] * poles[1]);
+			}
+			else {
+				section.A1 = -poles[0].real();
+			}
+		}
+
+		if (!sections.empty()) {
+			sections.front().B0 *= zpk.Gain;
+			sections.front().B1 *= zpk.Gain;
+			sections.front().B2 *= zpk.Gain;
+		}
+		return sections;
+	}
+
+	// Steady state of each section for a unit step, each scaled by the DC gain of the
+	// sections before it. Solves (I - A^T) z = b[1:] - a[1:] b0 for the 2x2 companion form.
+	std::vector<std::array<double, 2>> ComputeInitialState(const std::vector<NIRS::BiquadSection>& sections)
+	{
+		std::vector<std::array<double, 2>> state;
+		state.reserve(sections.size());
+
+		double scale = 1.0;
+		for (const auto& s : sections) {
+			const double b1 = s.B1 - s.A1 * s.B0;
+			const double b2 = s.B2 - s.A2 * s.B0;
+			const double z0 = (b1 + b2) / (1.0 + s.A1 + s.A2);
+			const double z1 = b2 - s.A2 * z0;
+			state.push_back({ scale * z0, scale * z1 });
+
+			scale *= (s.B0 + s.B1 + s.B2) / (1.0 + s.A1 + s.A2);
+		}
+		return state;
+	}
+
+	// Zeroth order modified Bessel function of the first kind, by its power series
+	double BesselI0(double x)
+	{
+		double sum = 1.0, term = 1.0;
+		const double quarter = 0.25 * x * x;
+		for (int k = 1; k < 64 && term > 1e-17 * sum; k++) {
+			term *= quarter / (static_cast<double>(k) * k);
+			sum += term;
+		}
+		return sum;
+	}
+}
+
+namespace NIRS {
+
+	double FilterDesign::GetMagnitudeResponse(double frequency) const
+	{
+		const Utils::Complex z1 = std::exp(Utils::Complex(0.0, -2.0 * Utils::PI * frequency / SampleRate)); // z^-1
+		const Utils::Complex z2 = z1 * z1;
+
+		Utils::Complex response = 1.0;
+		for (const auto& s : Sections) {
+			response *= (s.B0 + s.B1 * z1 + s.B2 * z2) / (1.0 + s.A1 * z1 + s.A2 * z2);
+		}
+		return std::abs(response);
+	}
+
+	FilterDesign DesignButterworth(FilterBand band, int order, double sampleRate, double lowCutoff, double highCutoff)
+	{
+		FilterDesign design;
+		design.Band = band;
+		design.Order = order;
+		design.SampleRate = sampleRate;
+		design.LowCutoff = lowCutoff;
+		design.HighCutoff = highCutoff;
+
+		const double nyquist = sampleRate / 2.0;
+		const bool needsLow = band != FilterBand::Lowpass;
+		const bool needsHigh = band != FilterBand::Highpass;
+		bool valid = order >= 1 && sampleRate > 0.0;
+		if (needsLow) valid = valid && lowCutoff > 0.0 && lowCutoff < nyquist;
+		if (needsHigh) valid = valid && highCutoff > 0.0 && highCutoff < nyquist;
+		if (needsLow && needsHigh) valid = valid && lowCutoff < highCutoff;
+		if (!valid) {
+			NVIZ_ERROR("Invalid Butterworth design: order {}, fs {} Hz, cutoffs {} - {} Hz", order, sampleRate, lowCutoff, highCutoff);
+			return design;
+		}
+
+		Utils::ZPK zpk = Utils::ButterworthPrototype(order);
+
+		const double low = needsLow ? Utils::Prewarp(lowCutoff, sampleRate) : 0.0;
+		const double high = needsHigh ? Utils::Prewarp(highCutoff, sampleRate) : 0.0;
+		switch (band) {
+		case FilterBand::Lowpass:	Utils::LowpassTransform(zpk, high); break;
+		case FilterBand::Highpass:	Utils::HighpassTransform(zpk, low); break;
+		case FilterBand::Bandpass:	Utils::BandpassTransform(zpk, std::sqrt(low * high), high - low); break;
+		case FilterBand::Bandstop:	Utils::BandstopTransform(zpk, std::sqrt(low * high), high - low); break;
+		}
+		Utils::BilinearTransform(zpk, sampleRate);
+
+		design.Sections = Utils::PairSections(zpk);
+		design.InitialState = Utils::ComputeInitialState(design.Sections);
+		return design;
+	}
+
+	size_t GetFiltFiltPadLength(const FilterDesign& design, size_t length)
+	{
+		size_t firstOrder = 0;
+		for (const auto& s : design.Sections) {
+			if (s.B2 == 0.0 && s.A2 == 0.0) firstOrder++;
+		}
+		const size_t taps = 2 * design.Sections.size() + 1 - firstOrder;
+		return std::min(3 * taps, length > 0 ? length - 1 : 0);
+	}
+
+	size_t GetFiltFiltScratchSize(const FilterDesign& design)
+	{
+		const size_t sections = design.Sections.size();
+		const size_t maxPad = 3 * (2 * sections + 1);
+		return 2 * sections + (maxPad + 1) + maxPad; // State, saved right edge, filtered right padding
+	}
+
+	void FiltFilt(const FilterDesign& design, Span<double> data, Span<double> scratch)
+	{
+		const size_t n = data.size();
+		const auto& sections = design.Sections;
+		if (n < 2 || sections.empty()) return;
+		NVIZ_ASSERT(scratch.size() >= GetFiltFiltScratchSize(design), "FiltFilt scratch is too small for the design");
+
+		const size_t pad = GetFiltFiltPadLength(design, n);
+		double* state = scratch.data();
+		double* edge = state + 2 * sections.size();	// data[n - 1 - k], overwritten by the forward pass
+		double* tail = edge + pad + 1;				// Forward output over the right padding
+
+		auto start = [&](double x0) {
+			for (size_t i = 0; i < sections.size(); i++) {
+				state[2 * i] = design.InitialState[i][0] * x0;
+				state[2 * i + 1] = design.InitialState[i][1] * x0;
+			}
+		};
+		auto step = [&](double x) {
+			for (size_t i = 0; i < sections.size(); i++) {
+				const auto& s = sections[i];
+				double* z = state + 2 * i;
+
+				double y = s.B0 * x + z[0];
+				z[0] = s.B1 * x - s.A1 * y + z[1];
+				z[1] = s.B2 * x - s.A2 * y;
+				x = y;
+			}
+			return x;
+		};
+
+		const double first = data[0];
+		const double last = data[n - 1];
+		for (size_t k = 0; k <= pad; k++) edge[k] = data[n - 1 - k];
+
+		// Forward over 2 x[0] - x[pad..1], the data, then 2 x[n-1] - x[n-2..n-1-pad]
+		start(2.0 * first - data[pad]);
+		for (size_t k = pad; k >= 1; k--) step(2.0 * first - data[k]);
+		for (size_t i = 0; i < n; i++) data[i] = step(data[i]);
+		for (size_t k = 0; k < pad; k++) tail[k] = step(2.0 * last - edge[k + 1]);
+
+		// Backward from the far end of the right padding, the left padding is never needed
+		start(pad > 0 ? tail[pad - 1] : data[n - 1]);
+		for (size_t k = pad; k-- > 0;) step(tail[k]);
+		for (size_t i = n; i-- > 0;) data[i] = step(data[i]);
+	}
+
+	PolyphaseFilter DesignPolyphaseFilter(int up, int down)
+	{
+		PolyphaseFilter filter;
+		if (up < 1 || down < 1) {
+			NVIZ_ERROR("Invalid resampling ratio {} / {}", up, down);
+			return filter;
+		}
+
+		const int divisor = std::gcd(up, down);
+		filter.Up = up / divisor;
+		filter.Down = down / divisor;
+
+		// firwin(2 * half + 1, 1 / max(up, down), window=('kaiser', 5.0)) * up
+		const int maxRate = std::max(filter.Up, filter.Down);
+		const double cutoff = 1.0 / maxRate; // Of Nyquist
+		const double beta = 5.0;
+		filter.HalfLength = 10 * maxRate;
+		const int taps = 2 * filter.HalfLength + 1;
+
+		std::vector<double> prototype(taps);
+		double sum = 0.0;
+		for (int n = 0; n < taps; n++) {
+			const double t = n - filter.HalfLength;
+			const double x = cutoff * t;
+			const double sinc = t == 0 ? 1.0 : std::sin(Utils::PI * x) / (Utils::PI * x);
+			const double r = 2.0 * n / (taps - 1) - 1.0;
+			const double window = Utils::BesselI0(beta * std::sqrt(std::max(0.0, 1.0 - r * r))) / Utils::BesselI0(beta);
+
+			prototype[n] = cutoff * sinc * window;
+			sum += prototype[n];
+		}
+		for (auto& h : prototype) h /= sum;
+
+		// Phase p holds h[p], h[p + up], ... reversed, so it lines up with ascending inputs.
+		// Each phase is scaled to unit gain at DC: their sums ripple by about 0.1 %, which
+		// on raw intensities would be a visible sawtooth riding on the offset.
+		filter.TapsPerPhase = (taps + filter.Up - 1) / filter.Up;
+		filter.Phases.assign(static_cast<size_t>(filter.Up) * filter.TapsPerPhase, 0.0);
+		for (int p = 0; p < filter.Up; p++) {
+			double* phase = filter.Phases.data() + static_cast<size_t>(p) * filter.TapsPerPhase;
+			double phaseSum = 0.0;
+			for (int j = 0; j < filter.TapsPerPhase; j++) {
+				const int n = p + j * filter.Up;
+				if (n < taps) phaseSum += phase[filter.TapsPerPhase - 1 - j] = prototype[n];
+			}
+			if (phaseSum != 0.0) {
+				for (int j = 0; j < filter.TapsPerPhase; j++) phase[j] /= phaseSum;
+			}
+		}
+		return filter;
+	}
+
+	std::mutex FilterDesignCache::s_Mutex;
+	std::map<FilterDesignKey, Ref<const FilterDesign>> FilterDesignCache::s_Designs;
+	std::map<std::pair<int, int>, Ref<const PolyphaseFilter>> FilterDesignCache::s_PolyphaseFilters;
+
+	Ref<const FilterDesign> FilterDesignCache::GetButterworth(FilterBand band, int order, double sampleRate, double lowCutoff, double highCutoff)
+	{
+		FilterDesignKey key{ band, order, sampleRate, lowCutoff, highCutoff };
+
+		std::lock_guard<std::mutex> lock(s_Mutex);
+		auto it = s_Designs.find(key);
+		if (it != s_Designs.end()) return it->second;
+
+		auto design = CreateRef<FilterDesign>(DesignButterworth(band, order, sampleRate, lowCutoff, highCutoff));
+		s_Designs.emplace(key, design);
+		return design;
+	}
+
+	Ref<const PolyphaseFilter> FilterDesignCache::GetPolyphase(int up, int down)
+	{
+		const std::pair<int, int> key{ up, down };
+
+		std::lock_guard<std::mutex> lock(s_Mutex);
+		auto it = s_PolyphaseFilters.find(key);
+		if (it != s_PolyphaseFilters.end()) return it->second;
+
+		auto filter = CreateRef<PolyphaseFilter>(DesignPolyphaseFilter(up, down));
+		s_PolyphaseFilters.emplace(key, filter);
+		return filter;
+	}
+
+	size_t FilterDesignCache::GetSize()
+	{
+		std::lock_guard<std::mutex> lock(s_Mutex);
+		return s_Designs.size() + s_PolyphaseFilters.size();
+	}
+
+	void FilterDesignCache::Clear()
+	{
+		std::lock_guard<std::mutex> lock(s_Mutex);
+		s_Designs.clear();
+		s_PolyphaseFilters.clear();
+	}
+
+	SOSFilter::SOSFilter(const Ref<const FilterDesign>& design)
+		: m_Design(design), m_State(design->Sections.size(), { 0.0, 0.0 })
+	{
+	}
+
+	double SOSFilter::Process(double x)
+	{
+		const auto& sections = m_Design->Sections;
+		for (size_t i = 0; i < sections.size(); i++) {
+			const auto& s = sections[i];
+			auto& z = m_State[i];
+
+			double y = s.B0 * x + z[0];
+			z[0] = s.B1 * x - s.A1 * y + z[1];
+			z[1] = s.B2 * x - s.A2 * y;
+			x = y;
+		}
+		return x;
+	}
+
+	void SOSFilter::Reset()
+	{
+		std::fill(m_State.begin(), m_State.end(), std::array<double, 2>{ 0.0, 0.0 });
+	}
+
+	template<int Lanes>
+	SOSFilterBank<Lanes>::SOSFilterBank(const Ref<const FilterDesign>& design)
+		: m_Design(design), m_State(design->Sections.size() * 2 * Lanes)
+	{
+	}
+
+	template<int Lanes>
+	void SOSFilterBank<Lanes>::Process(double* block, size_t samples)
+	{
+		using LaneMap = Eigen::Map<Lane>;
+
+		// Section by section over the whole block, so the state and coefficients stay in registers
+		const auto& sections = m_Design->Sections;
+		for (size_t i = 0; i < sections.size(); i++) {
+			const auto& s = sections[i];
+			LaneMap state0(m_State.Data() + (2 * i) * Lanes);
+			LaneMap state1(m_State.Data() + (2 * i + 1) * Lanes);
+
+			Lane z0 = state0, z1 = state1;
+			for (size_t n = 0; n < samples; n++) {
+				LaneMap x(block + n * Lanes);
+				Lane y = s.B0 * x + z0;
+				z0 = s.B1 * x - s.A1 * y + z1;
+				z1 = s.B2 * x - s.A2 * y;
+				x = y;
+			}
+			state0 = z0;
+			state1 = z1;
+		}
+	}
+
+	template<int Lanes>
+	void SOSFilterBank<Lanes>::Reset()
+	{
+		std::fill(m_State.Data(), m_State.Data() + m_State.Size(), 0.0);
+	}
+
+	template<int Lanes>
+	void SOSFilterBank<Lanes>::SetInitialState(const double* frame)
+	{
+		using LaneMap = Eigen::Map<Lane>;
+
+		const Eigen::Map<const Lane> x(frame);
+		const auto& initial = m_Design->InitialState;
+		for (size_t i = 0; i < initial.size(); i++) {
+			LaneMap(m_State.Data() + (2 * i) * Lanes) = initial[i][0] * x;
+			LaneMap(m_State.Data() + (2 * i + 1) * Lanes) = initial[i][1] * x;
+		}
+	}
+
+	template<int Lanes>
+	void FilterChannels(const Ref<const FilterDesign>& design, Span<double* const> channels, size_t samples)
+	{
+		constexpr size_t BlockSamples = 256;
+		thread_local AlignedBuffer<double> block;
+		block.Resize(BlockSamples * Lanes);
+
+		SOSFilterBank<Lanes> bank(design);
+		for (size_t first = 0; first < channels.size(); first += Lanes) {
+			const size_t lanes = std::min<size_t>(Lanes, channels.size() - first);
+			bank.Reset();
+
+			// Unused lanes stay zero and cost nothing but the arithmetic
+			std::fill(block.Data(), block.Data() + block.Size(), 0.0);
+			for (size_t start = 0; start < samples; start += BlockSamples) {
+				const size_t count = std::min(BlockSamples, samples - start);
+
+				for (size_t lane = 0; lane < lanes; lane++) {
+					const double* source = channels[first + lane] + start;
+					for (size_t n = 0; n < count; n++) block[n * Lanes + lane] = source[n];
+				}
+
+				bank.Process(block.Data(), count);
+
+				for (size_t lane = 0; lane < lanes; lane++) {
+					double* target = channels[first + lane] + start;
+					for (size_t n = 0; n < count; n++) target[n] = block[n * Lanes + lane];
+				}
+			}
+		}
+	}
+
+	template<int Lanes>
+	void FiltFiltChannels(const Ref<const FilterDesign>& design, Span<double* const> channels, size_t samples)
+	{
+		if (samples < 2 || design->Sections.empty()) return;
+
+		constexpr size_t BlockSamples = 256;
+		const size_t pad = GetFiltFiltPadLength(*design, samples);
+		thread_local AlignedBuffer<double> block, tail; // Interleaved, tail is the right padding
+		block.Resize(BlockSamples * Lanes);
+		if (tail.Size() < pad * Lanes) tail.Resize(pad * Lanes);
+
+		SOSFilterBank<Lanes> bank(design);
+		alignas(64) double frame[Lanes];
+
+		for (size_t first = 0; first < channels.size(); first += Lanes) {
+			const size_t lanes = std::min<size_t>(Lanes, channels.size() - first);
+			auto lane = [&](size_t l) { return channels[first + l]; };
+
+			// Runs 'count' frames read by source(lane, n) through the bank, each output to sink(lane, n, y)
+			auto pass = [&](size_t count, auto&& source, auto&& sink) {
+				for (size_t start = 0; start < count; start += BlockSamples) {
+					const size_t length = std::min(BlockSamples, count - start);
+					for (size_t l = 0; l < lanes; l++) {
+						for (size_t n = 0; n < length; n++) block[n * Lanes + l] = source(l, start + n);
+					}
+					bank.Process(block.Data(), length);
+					for (size_t l = 0; l < lanes; l++) {
+						for (size_t n = 0; n < length; n++) sink(l, start + n, block[n * Lanes + l]);
+					}
+				}
+			};
+			auto discard = [](size_t, size_t, double) {};
+
+			// Unused lanes stay zero, as do their states
+			std::fill(block.Data(), block.Data() + block.Size(), 0.0);
+			std::fill(tail.Data(), tail.Data() + tail.Size(), 0.0);
+			std::fill(frame, frame + Lanes, 0.0);
+
+			// Right padding 2 x[n-1] - x[n-2..n-1-pad], taken before the forward pass overwrites the data
+			for (size_t l = 0; l < lanes; l++) {
+				const double* x = lane(l);
+				for (size_t k = 0; k < pad; k++) tail[k * Lanes + l] = 2.0 * x[samples - 1] - x[samples - 2 - k];
+			}
+
+			// Forward over the left padding 2 x[0] - x[pad..1], the data and the right padding
+			for (size_t l = 0; l < lanes; l++) frame[l] = 2.0 * lane(l)[0] - lane(l)[pad];
+			bank.SetInitialState(frame);
+			pass(pad, [&](size_t l, size_t k) { return 2.0 * lane(l)[0] - lane(l)[pad - k]; }, discard);
+			pass(samples, [&](size_t l, size_t i) { return lane(l)[i]; }, [&](size_t l, size_t i, double y) { lane(l)[i] = y; });
+			bank.Process(tail.Data(), pad);
+
+			// Backward from the far end of the right padding, the left padding is never needed
+			for (size_t l = 0; l < lanes; l++) frame[l] = pad > 0 ? tail[(pad - 1) * Lanes + l] : lane(l)[samples - 1];
+			bank.SetInitialState(frame);
+			pass(pad, [&](size_t l, size_t k) { return tail[(pad - 1 - k) * Lanes + l]; }, discard);
+			pass(samples, [&](size_t l, size_t i) { return lane(l)[samples - 1 - i]; }, [&](size_t l, size_t i, double y) { lane(l)[samples - 1 - i] = y; });
+		}
+	}
+
+	template class SOSFilterBank<4>;
+	template class SOSFilterBank<8>;
+	template void FilterChannels<4>(const Ref<const FilterDesign>&, Span<double* const>, size_t);
+	template void FilterChannels<8>(const Ref<const FilterDesign>&, Span<double* const>, size_t);
+	template void FiltFiltChannels<4>(const Ref<const FilterDesign>&, Span<double* const>, size_t);
+	template void FiltFiltChannels<8>(const Ref<const FilterDesign>&, Span<double* const>, size_t);
+}
@@ -0,0 +1,219 @@
+#include "pch.h"
+#include "NIRS/GLM.h"
+
+#include "Core/ThreadPool.h"
+#include "Core/Timer.h"
+
+#include <Eigen/QR>
+
+namespace Utils {
+
+	// Arrays solved together per task, wide enough for the solve to run as matrix products
+	constexpr Eigen::Index GLMBlockArrays = 16;
+
+	static double GammaDensity(double t, double shape)
+	{
+		if (t <= 0.0) return 0.0;
+		return std::exp((shape - 1.0) * std::log(t) - t - std::lgamma(shape));
+	}
+
+	// Legendre polynomial of 'order' at x in [-1, 1], by the three-term recurrence
+	static double Legendre(int order, double x)
+	{
+		double previous = 1.0, current = x;
+		if (order == 0) return previous;
+		for (int n = 1; n < order; n++) {
+			const double next = ((2.0 * n + 1.0) * x * current - n * previous) / (n + 1.0);
+			previous = current;
+			current = next;
+		}
+		return current;
+	}
+
+	// fn(first, count) over blocks of GLMBlockArrays columns
+	template<typename F>
+	void ForEachArrayBlock(Eigen::Index arrays, F&& fn)
+	{
+		const size_t blocks = static_cast<size_t>((arrays + GLMBlockArrays - 1) / GLMBlockArrays);
+		ThreadPool::Instance().ParallelFor(0, blocks, [&](size_t block) {
+			const Eigen::Index first = static_cast<Eigen::Index>(block) * GLMBlockArrays;
+			fn(first, std::min(GLMBlockArrays, arrays - first));
+		});
+	}
+
+	// Prais-Winsten transform of every column in place: x[t] - rho x[t - 1], the first row scaled
+	// by sqrt(1 - rho^2) so it keeps the variance of the others
+	static void WhitenColumns(Eigen::Ref<Eigen::MatrixXd> columns, double rho)
+	{
+		const Eigen::Index n = columns.rows();
+		if (n == 0) return;
+		for (Eigen::Index c = 0; c < columns.cols(); c++) {
+			auto column = columns.col(c);
+			for (Eigen::Index t = n - 1; t > 0; t--) column[t] -= rho * column[t - 1];
+			column[0] *= std::sqrt(1.0 - rho * rho);
+		}
+	}
+}
+
+std::vector<double> NIRS::ComputeCanonicalHRF(double sampleRate, double length)
+{
+	const size_t count = std::max<size_t>(1, static_cast<size_t>(std::ceil(length * sampleRate)));
+	std::vector<double> hrf(count);
+
+	double sum = 0.0;
+	for (size_t i = 0; i < count; i++) {
+		const double t = i / sampleRate;
+		hrf[i] = Utils::GammaDensity(t, 6.0) - Utils::GammaDensity(t, 16.0) / 6.0;
+		sum += hrf[i];
+	}
+	for (auto& h : hrf) h /= sum;
+	return hrf;
+}
+
+NIRS::GLMDesign NIRS::BuildGLMDesign(const std::vector<Stimulus>& stimuli, Span<const double> time, double sampleRate, const GLMSettings& settings)
+{
+	GLMDesign design;
+	const Eigen::Index n = static_cast<Eigen::Index>(time.size());
+	if (n < 2 || sampleRate <= 0.0) return design;
+
+	const double start = time.front();
+	const double end = time.back();
+	const auto hrf = ComputeCanonicalHRF(sampleRate, settings.HRFLength);
+
+	std::vector<Eigen::VectorXd> columns;
+	Eigen::VectorXd boxcar(n);
+	for (const auto& stimulus : stimuli) {
+		boxcar.setZero();
+		bool inside = false;
+		for (const auto& event : stimulus.Events) {
+			if (event.Onset > end || event.Onset + event.Duration < start) continue;
+
+			// The sample rate is only approximate, an onset at the last time point can round past it
+			const Eigen::Index first = std::clamp<Eigen::Index>(static_cast<Eigen::Index>(std::lround((event.Onset - start) * sampleRate)), 0, n - 1);
+			const Eigen::Index last = std::min<Eigen::Index>(n - 1, static_cast<Eigen::Index>(std::lround((event.Onset + event.Duration - start) * sampleRate)));
+			for (Eigen::Index i = first; i <= std::max(first, last - 1); i++) boxcar[i] += event.Amplitude;
+			inside = true;
+		}
+		if (!inside) {
+			NVIZ_WARN("Stimulus {} has no event inside the data, it is left out of the design", stimulus.Name);
+			continue;
+		}
+
+		// Causal convolution truncated to the data, the kernel is far shorter than the run
+		Eigen::VectorXd regressor = Eigen::VectorXd::Zero(n);
+		for (Eigen::Index i = 0; i < n; i++) {
+			if (boxcar[i] == 0.0) continue;
+			const Eigen::Index span = std::min<Eigen::Index>(static_cast<Eigen::Index>(hrf.size()), n - i);
+			regressor.segment(i, span) += boxcar[i] * Eigen::Map<const Eigen::VectorXd>(hrf.data(), span);
+		}
+
+		columns.push_back(std::move(regressor));
+		design.Regressors.push_back(stimulus.Name);
+	}
+	design.ConditionCount = columns.size();
+
+	const int driftOrder = std::max(0, settings.DriftOrder);
+	design.Matrix.resize(n, static_cast<Eigen::Index>(columns.size()) + driftOrder + 1);
+	for (size_t c = 0; c < columns.size(); c++) design.Matrix.col(c) = columns[c];
+
+	for (int order = 0; order <= driftOrder; order++) {
+		auto drift = design.Matrix.col(columns.size() + order);
+		for (Eigen::Index i = 0; i < n; i++) drift[i] = Utils::Legendre(order, 2.0 * i / (n - 1) - 1.0);
+		design.Regressors.push_back(order == 0 ? "Constant" : "Drift " + std::to_string(order));
+	}
+	return design;
+}
+
+NIRS::GLMResult NIRS::FitGLM(const GLMDesign& design, const ChannelDataRegistry& registry, const GLMSettings& settings, bool parallel)
+{
+	Timer timer;
+	GLMResult result;
+	result.Regressors = design.Regressors;
+	result.ConditionCount = design.ConditionCount;
+
+	const Eigen::Index n = design.Matrix.rows();
+	const Eigen::Index p = design.Matrix.cols();
+	const Eigen::Index arrays = static_cast<Eigen::Index>(registry.GetChannelCount());
+	if (n <= p || arrays == 0) {
+		NVIZ_WARN("GLM needs more samples ({}) than regressors ({})", n, p);
+		return result;
+	}
+
+	// Samples x arrays, every array a column, in double whatever the storage precision
+	Eigen::MatrixXd Y(n, arrays);
+	auto read = [&](size_t i) {
+		auto data = registry.GetChannelData(static_cast<int>(i));
+		const Eigen::Index length = std::min<Eigen::Index>(n, static_cast<Eigen::Index>(data.size()));
+		auto column = Y.col(static_cast<Eigen::Index>(i));
+		for (Eigen::Index t = 0; t < length; t++) column[t] = data[t];
+		column.tail(n - length).setZero();
+	};
+	if (parallel) ThreadPool::Instance().ParallelFor(0, static_cast<size_t>(arrays), read);
+	else for (size_t i = 0; i < static_cast<size_t>(arrays); i++) read(i);
+
+	Eigen::MatrixXd X = design.Matrix;
+	Eigen::ColPivHouseholderQR<Eigen::MatrixXd> qr(X);
+
+	result.Betas.resize(p, arrays);
+	auto solve = [&]() {
+		Utils::ForEachArrayBlock(arrays, [&](Eigen::Index first, Eigen::Index count) {
+			result.Betas.middleCols(first, count) = qr.solve(Y.middleCols(first, count));
+		});
+	};
+	solve();
+
+	if (settings.Prewhiten) {
+		// Lag one autocorrelation of each array's residuals, averaged into one coefficient
+		Eigen::VectorXd rhos(arrays);
+		Utils::ForEachArrayBlock(arrays, [&](Eigen::Index first, Eigen::Index count) {
+			const Eigen::MatrixXd residuals = Y.middleCols(first, count) - X * result.Betas.middleCols(first, count);
+			for (Eigen::Index c = 0; c < count; c++) {
+				const auto r = residuals.col(c);
+				const double energy = r.squaredNorm();
+				rhos[first + c] = energy > 0.0 ? r.head(n - 1).dot(r.tail(n - 1)) / energy : 0.0;
+			}
+		});
+		result.AutoCorrelation = std::clamp(rhos.mean(), -0.99, 0.99);
+
+		Utils::WhitenColumns(X, result.AutoCorrelation);
+		Utils::ForEachArrayBlock(arrays, [&](Eigen::Index first, Eigen::Index count) {
+			Utils::WhitenColumns(Y.middleCols(first, count), result.AutoCorrelation);
+		});
+		qr.compute(X);
+		solve();
+	}
+
+	// The pivoting moves dependent regressors past the rank. Their betas are solved as zero and
+	// their variance is undefined, they get a t value of 0 instead of one from a near-zero pivot.
+	const Eigen::Index rank = qr.rank();
+	const auto& pivots = qr.colsPermutation().indices();
+	if (rank < p) {
+		std::string dropped;
+		for (Eigen::Index k = rank; k < p; k++) dropped += (dropped.empty() ? "" : ", ") + result.Regressors[pivots[k]];
+		NVIZ_WARN("GLM design is rank deficient ({} of {} regressors independent), overlapping conditions? No t values for : {}", rank, p, dropped);
+	}
+
+	// Diagonal of (X'X)^-1 from the same factorization over the independent regressors,
+	// X P = Q R gives P R^-1 R^-T P', whose entry for column pivots[k] is row k of R^-1 squared
+	result.DegreesOfFreedom = static_cast<size_t>(n - rank);
+	const Eigen::MatrixXd inverseR = qr.matrixR().topLeftCorner(rank, rank).triangularView<Eigen::Upper>().solve(Eigen::MatrixXd::Identity(rank, rank));
+	Eigen::VectorXd scale = Eigen::VectorXd::Zero(p);
+	for (Eigen::Index k = 0; k < rank; k++) scale[pivots[k]] = inverseR.row(k).norm();
+
+	result.TValues.resize(p, arrays);
+	Utils::ForEachArrayBlock(arrays, [&](Eigen::Index first, Eigen::Index count) {
+		const Eigen::MatrixXd residuals = Y.middleCols(first, count) - X * result.Betas.middleCols(first, count);
+		for (Eigen::Index c = 0; c < count; c++) {
+			const double sigma = std::sqrt(residuals.col(c).squaredNorm() / result.DegreesOfFreedom);
+			const auto betas = result.Betas.col(first + c);
+			for (Eigen::Index j = 0; j < p; j++) {
+				const double error = sigma * scale[j];
+				result.TValues(j, first + c) = error > 0.0 ? betas[j] / error : 0.0;
+			}
+		}
+	});
+
+	NVIZ_INFO("Fitted GLM of {} regressors to {} arrays x {} samples in {:.2f} ms (AR(1) {:.3f})",
+		p, arrays, n, timer.ElapsedMillis(), result.AutoCorrelation);
+	return result;
+}
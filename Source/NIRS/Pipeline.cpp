@@ -0,0 +1,501 @@
+#include "pch.h"
+#include "NIRS/Pipeline.h"
+#include "NIRS/Processing.h"
+#include "NIRS/Filter.h"
+
+#include "Core/Hash.h"
+#include "Core/ThreadPool.h"
+#include "Core/Timer.h"
+
+namespace Utils {
+
+	// One zeroed array per input array, allocated up front so the views handed to the
+	// workers stay valid while they write. Same lengths unless resampled by up / down.
+	static void AllocateOutput(const NIRS::StageResult& input, NIRS::StageResult& output, int up = 1, int down = 1)
+	{
+		const auto& source = *input.Data;
+		const size_t count = source.GetChannelCount();
+		auto lengthOf = [&](size_t i) { return NIRS::GetResampledLength(source.GetChannelLength(static_cast<int>(i)), up, down); };
+
+		size_t length = 0;
+		for (size_t i = 0; i < count; i++) length = std::max(length, lengthOf(i));
+
+		output.Data = CreateRef<ChannelDataRegistry>();
+		output.Data->SetDeduplication(false);
+		output.Data->Reserve(count, length);
+		for (size_t i = 0; i < count; i++) output.Data->AllocateChannelData(lengthOf(i));
+
+		output.SamplingRate = input.SamplingRate;
+		output.Time = input.Time;
+		output.Lazy = false;
+	}
+
+	// fn(i) for every array of the input. Lazy arrays are walked serially: every read goes
+	// to the file under one lock, and in parallel the readers would only churn the slot pool.
+	static void ForEachArray(const NIRS::StageResult& input, const std::function<void(size_t)>& fn)
+	{
+		const size_t count = input.Data->GetChannelCount();
+		if (input.Lazy) {
+			for (size_t i = 0; i < count; i++) fn(i);
+			return;
+		}
+		ThreadPool::Instance().ParallelFor(0, count, fn);
+	}
+
+	// fn(indices) for groups of up to DefaultFilterLanes consecutive arrays of one length,
+	// for the stages filtering one array per SIMD lane. Lazy arrays come one at a time, serially.
+	static void ForEachArrayGroup(const NIRS::StageResult& input, const std::function<void(Span<const int>)>& fn)
+	{
+		const auto& source = *input.Data;
+		const int count = static_cast<int>(source.GetChannelCount());
+		if (input.Lazy) {
+			for (int i = 0; i < count; i++) fn(Span<const int>(&i, 1));
+			return;
+		}
+
+		std::vector<std::vector<int>> groups;
+		for (int i = 0; i < count; i++) {
+			if (groups.empty() || groups.back().size() == static_cast<size_t>(NIRS::DefaultFilterLanes) ||
+				source.GetChannelLength(groups.back().front()) != source.GetChannelLength(i)) groups.emplace_back();
+			groups.back().push_back(i);
+		}
+		ThreadPool::Instance().ParallelFor(0, groups.size(), [&](size_t g) { fn(groups[g]); });
+	}
+
+	static uint64_t HashParameters(const std::vector<NIRS::StageParameter>& parameters, uint64_t seed)
+	{
+		uint64_t hash = seed;
+		for (const auto& parameter : parameters) {
+			switch (parameter.Type) {
+			case NIRS::StageParameter::Kind::Float: hash = Hash::XXH64(parameter.Value, sizeof(float), hash); break;
+			case NIRS::StageParameter::Kind::Int: hash = Hash::XXH64(parameter.Value, sizeof(int), hash); break;
+			case NIRS::StageParameter::Kind::Bool: hash = Hash::XXH64(parameter.Value, sizeof(bool), hash); break;
+			}
+		}
+		return hash;
+	}
+}
+
+NIRS::SignalType NIRS::GetSourceSignalType(const SNIRFRun& run)
+{
+	for (const auto& measurement : run.Measurements) {
+		if (measurement.DataType == 1) return SignalType::Intensity;
+		if (measurement.DataTypeLabel == "dOD") return SignalType::OpticalDensity;
+	}
+	return SignalType::Concentration;
+}
+
+NIRS::SignalType NIRS::GetProcessedSignalType(const SNIRFRun& run, const PreprocessingSettings& settings)
+{
+	const SignalType source = GetSourceSignalType(run);
+	if (source == SignalType::Concentration) return source;
+	return settings.ConvertToHemoglobin && MBLLStage().AcceptsRun(run) ? SignalType::Concentration : SignalType::OpticalDensity;
+}
+
+Ref<NIRS::ProcessingStage> NIRS::CreateStage(StageType type)
+{
+	switch (type) {
+	case StageType::OpticalDensity: return CreateRef<OpticalDensityStage>();
+	case StageType::MBLL: return CreateRef<MBLLStage>();
+	case StageType::Bandpass: return CreateRef<BandpassStage>();
+	case StageType::ZNormalize: return CreateRef<ZNormalizeStage>();
+	case StageType::TDDR: return CreateRef<TDDRStage>();
+	case StageType::ShortChannelRegression: return CreateRef<ShortChannelRegressionStage>();
+	case StageType::Resample: return CreateRef<ResampleStage>();
+	}
+	NVIZ_ASSERT(false, "Unknown stage type");
+	return nullptr;
+}
+
+// --- Stages ---
+
+void NIRS::OpticalDensityStage::Process(const StageContext&, const StageResult& input, StageResult& output) const
+{
+	Utils::AllocateOutput(input, output);
+	Utils::ForEachArray(input, [&](size_t i) {
+		const int index = static_cast<int>(i);
+		ConvertToOpticalDensity(input.Data->GetChannelData(index), output.Data->GetMutableChannelData(index));
+	});
+}
+
+std::vector<NIRS::StageParameter> NIRS::MBLLStage::GetParameters()
+{
+	return {
+		{ "DPF", StageParameter::Kind::Float, &DifferentialPathlengthFactor, 1.0f, 10.0f },
+		{ "Fallback Distance (cm)", StageParameter::Kind::Float, &FallbackDistance, 0.5f, 6.0f },
+	};
+}
+
+bool NIRS::MBLLStage::AcceptsRun(const SNIRFRun& run) const
+{
+	if (run.Channels.empty()) return false;
+	return std::all_of(run.Channels.begin(), run.Channels.end(), [](const Channel& channel) {
+		return channel.HBRWavelength > 0.0f && channel.HBOWavelength > 0.0f && channel.HBRDataIndex != channel.HBODataIndex;
+	});
+}
+
+void NIRS::MBLLStage::Process(const StageContext& context, const StageResult& input, StageResult& output) const
+{
+	Utils::AllocateOutput(input, output);
+	Utils::ForEachArray(input, [&](size_t i) {
+		const int index = static_cast<int>(i);
+		auto in = input.Data->GetChannelData(index);
+		std::copy(in.begin(), in.end(), output.Data->GetMutableChannelData(index).begin());
+	});
+
+	// One 2x2 system per source-detector pair, solved in place on the copy
+	const auto& channels = context.Run.Channels;
+	ThreadPool::Instance().ParallelFor(0, channels.size(), [&](size_t i) {
+		const auto& channel = channels[i];
+		const float distance = channel.Distance > 0.0f ? channel.Distance : FallbackDistance;
+		auto matrix = ComputeMBLLMatrix(channel.HBRWavelength, channel.HBOWavelength, distance, DifferentialPathlengthFactor);
+		ApplyModifiedBeerLambert(matrix, output.Data->GetMutableChannelData(channel.HBRDataIndex), output.Data->GetMutableChannelData(channel.HBODataIndex));
+	});
+}
+
+std::vector<NIRS::StageParameter> NIRS::BandpassStage::GetParameters()
+{
+	return {
+		{ "Lower Cutoff (Hz)", StageParameter::Kind::Float, &LowerCutoff, 0.0f, 1.0f },
+		{ "Higher Cutoff (Hz)", StageParameter::Kind::Float, &HigherCutoff, 0.0f, 5.0f },
+		{ "Order", StageParameter::Kind::Int, &Order, 1.0f, 10.0f },
+	};
+}
+
+void NIRS::BandpassStage::Process(const StageContext&, const StageResult& input, StageResult& output) const
+{
+	Utils::AllocateOutput(input, output);
+	const float samplingRate = static_cast<float>(input.SamplingRate);
+
+	Utils::ForEachArrayGroup(input, [&](Span<const int> group) {
+		std::array<Span<const NIRS::ChannelValue>, DefaultFilterLanes> in;
+		std::array<Span<NIRS::ChannelValue>, DefaultFilterLanes> out;
+		for (size_t i = 0; i < group.size(); i++) {
+			in[i] = input.Data->GetChannelData(group[i]);
+			out[i] = output.Data->GetMutableChannelData(group[i]);
+		}
+		ButterworthBandpassFilter(Span<const Span<const NIRS::ChannelValue>>(in.data(), group.size()),
+			Span<const Span<NIRS::ChannelValue>>(out.data(), group.size()), samplingRate, LowerCutoff, HigherCutoff, Order);
+	});
+}
+
+void NIRS::ZNormalizeStage::Process(const StageContext&, const StageResult& input, StageResult& output) const
+{
+	Utils::AllocateOutput(input, output);
+	Utils::ForEachArray(input, [&](size_t i) {
+		const int index = static_cast<int>(i);
+		auto in = input.Data->GetChannelData(index);
+		auto out = output.Data->GetMutableChannelData(index);
+		std::copy(in.begin(), in.end(), out.begin());
+		NormalizeZScore(out);
+	});
+}
+
+void NIRS::TDDRStage::Process(const StageContext&, const StageResult& input, StageResult& output) const
+{
+	Utils::AllocateOutput(input, output);
+	const float samplingRate = static_cast<float>(input.SamplingRate);
+
+	Utils::ForEachArray(input, [&](size_t i) {
+		const int index = static_cast<int>(i);
+		auto in = input.Data->GetChannelData(index);
+
+		thread_local std::vector<double> signal;
+		signal.assign(in.begin(), in.end());
+		TemporalDerivativeDistributionRepair(signal, samplingRate);
+
+		auto out = output.Data->GetMutableChannelData(index);
+		std::transform(signal.begin(), signal.end(), out.begin(), [](double v) { return static_cast<NIRS::ChannelValue>(v); });
+	});
+}
+
+std::vector<NIRS::StageParameter> NIRS::ShortChannelRegressionStage::GetParameters()
+{
+	return {
+		{ "Short Distance (cm)", StageParameter::Kind::Float, &ShortDistance, 0.1f, 3.0f },
+	};
+}
+
+void NIRS::ShortChannelRegressionStage::Process(const StageContext& context, const StageResult& input, StageResult& output) const
+{
+	Utils::AllocateOutput(input, output);
+	Utils::ForEachArray(input, [&](size_t i) {
+		const int index = static_cast<int>(i);
+		auto in = input.Data->GetChannelData(index);
+		std::copy(in.begin(), in.end(), output.Data->GetMutableChannelData(index).begin());
+	});
+
+	const auto& channels = context.Run.Channels;
+	std::vector<size_t> shorts;
+	for (size_t i = 0; i < channels.size(); i++) {
+		if (channels[i].Distance > 0.0f && channels[i].Distance < ShortDistance) shorts.push_back(i);
+	}
+	if (shorts.empty()) {
+		NVIZ_WARN("No channel of {} is shorter than {} cm, nothing to regress", context.Run.GetName(), ShortDistance);
+		return;
+	}
+
+	// Arrays regressed on each short channel, HbO and HbR apart. A deduplicated array
+	// shared by several channels is only claimed (and corrected) once.
+	const size_t arrays = output.Data->GetChannelCount();
+	std::vector<bool> claimed(arrays, false);
+	for (size_t s : shorts) claimed[channels[s].HBODataIndex] = claimed[channels[s].HBRDataIndex] = true;
+
+	std::vector<std::vector<int>> hboTargets(shorts.size()), hbrTargets(shorts.size());
+	for (const auto& channel : channels) {
+		if (claimed[channel.HBODataIndex] && claimed[channel.HBRDataIndex]) continue;
+
+		size_t nearest = 0;
+		float nearestDistance = std::numeric_limits<float>::max();
+		for (size_t s = 0; s < shorts.size(); s++) {
+			const float distance = glm::distance(channel.Position, channels[shorts[s]].Position);
+			if (distance < nearestDistance) {
+				nearest = s;
+				nearestDistance = distance;
+			}
+		}
+
+		if (!claimed[channel.HBODataIndex]) hboTargets[nearest].push_back(static_cast<int>(channel.HBODataIndex));
+		if (!claimed[channel.HBRDataIndex]) hbrTargets[nearest].push_back(static_cast<int>(channel.HBRDataIndex));
+		claimed[channel.HBODataIndex] = claimed[channel.HBRDataIndex] = true;
+	}
+
+	// One batched solve per short channel and chromophore
+	ThreadPool::Instance().ParallelFor(0, shorts.size() * 2, [&](size_t task) {
+		const auto& shortChannel = channels[shorts[task / 2]];
+		const bool hbo = (task % 2) == 0;
+		const auto& targets = hbo ? hboTargets[task / 2] : hbrTargets[task / 2];
+		if (targets.empty()) return;
+
+		std::vector<Span<NIRS::ChannelValue>> longChannels;
+		longChannels.reserve(targets.size());
+		for (int index : targets) longChannels.push_back(output.Data->GetMutableChannelData(index));
+
+		const int regressor = static_cast<int>(hbo ? shortChannel.HBODataIndex : shortChannel.HBRDataIndex);
+		RegressShortChannel(output.Data->GetChannelData(regressor), longChannels);
+	});
+}
+
+std::vector<NIRS::StageParameter> NIRS::ResampleStage::GetParameters()
+{
+	return {
+		{ "Target Rate (Hz)", StageParameter::Kind::Float, &TargetRate, 0.5f, 50.0f },
+	};
+}
+
+void NIRS::ResampleStage::Process(const StageContext&, const StageResult& input, StageResult& output) const
+{
+	const auto [up, down] = GetResamplingRatio(input.SamplingRate, TargetRate);
+	Utils::AllocateOutput(input, output, up, down);
+	Utils::ForEachArray(input, [&](size_t i) {
+		const int index = static_cast<int>(i);
+		ResamplePolyphase(input.Data->GetChannelData(index), output.Data->GetMutableChannelData(index), up, down);
+	});
+
+	// Uniform at the new rate from the first time point, the rate is exactly the ratio's
+	output.SamplingRate = input.SamplingRate * up / down;
+	const double start = input.Time.empty() ? 0.0 : input.Time.front();
+	output.Time.resize(GetResampledLength(input.Time.size(), up, down));
+	for (size_t i = 0; i < output.Time.size(); i++) output.Time[i] = start + i / output.SamplingRate;
+
+	if (std::abs(output.SamplingRate - TargetRate) > 1e-3 * TargetRate) {
+		NVIZ_WARN("Resampled {} Hz by {} / {} to {:.4f} Hz, the closest ratio to {} Hz", input.SamplingRate, up, down, output.SamplingRate, TargetRate);
+	}
+}
+
+// --- Pipeline ---
+
+Ref<NIRS::ProcessingPipeline> NIRS::ProcessingPipeline::CreateDefault()
+{
+	auto pipeline = CreateRef<ProcessingPipeline>();
+	StageID id = pipeline->AddStage(StageType::OpticalDensity, Source);
+	id = pipeline->AddStage(StageType::Bandpass, id);
+	pipeline->AddStage(StageType::MBLL, id);
+	return pipeline;
+}
+
+Ref<NIRS::ProcessingPipeline> NIRS::ProcessingPipeline::CreateDefault(const SNIRFRun& run)
+{
+	auto pipeline = CreateRef<ProcessingPipeline>();
+	const SignalType source = GetSourceSignalType(run);
+
+	StageID id = Source;
+	if (source == SignalType::Intensity) id = pipeline->AddStage(StageType::OpticalDensity, id);
+	id = pipeline->AddStage(StageType::Bandpass, id);
+	if (source != SignalType::Concentration && MBLLStage().AcceptsRun(run)) pipeline->AddStage(StageType::MBLL, id);
+	return pipeline;
+}
+
+NIRS::ProcessingPipeline::StageID NIRS::ProcessingPipeline::AddStage(StageType type, StageID input)
+{
+	return AddStage(CreateStage(type), input);
+}
+
+NIRS::ProcessingPipeline::StageID NIRS::ProcessingPipeline::AddStage(const Ref<ProcessingStage>& stage, StageID input)
+{
+	NVIZ_ASSERT(input == Source || FindNode(input), "Stage input does not exist");
+
+	Node node;
+	node.ID = m_NextID++;
+	node.Input = input;
+	node.Stage = stage;
+	m_Nodes.push_back(node);
+
+	m_Output = node.ID;
+	return node.ID;
+}
+
+void NIRS::ProcessingPipeline::RemoveStage(StageID id)
+{
+	auto it = std::find_if(m_Nodes.begin(), m_Nodes.end(), [id](const Node& node) { return node.ID == id; });
+	if (it == m_Nodes.end()) return;
+
+	const StageID input = it->Input;
+	m_Nodes.erase(it);
+
+	for (auto& node : m_Nodes) {
+		if (node.Input == id) node.Input = input;
+	}
+	if (m_Output == id) m_Output = input;
+}
+
+Ref<NIRS::ProcessingStage> NIRS::ProcessingPipeline::GetStage(StageID id) const
+{
+	const Node* node = FindNode(id);
+	return node ? node->Stage : nullptr;
+}
+
+NIRS::ProcessingPipeline::StageID NIRS::ProcessingPipeline::GetInput(StageID id) const
+{
+	const Node* node = FindNode(id);
+	return node ? node->Input : Source;
+}
+
+std::vector<NIRS::ProcessingPipeline::StageID> NIRS::ProcessingPipeline::GetChain(StageID id) const
+{
+	std::vector<StageID> chain;
+	for (const Node* node = FindNode(id); node; node = FindNode(node->Input)) chain.push_back(node->ID);
+	std::reverse(chain.begin(), chain.end());
+	return chain;
+}
+
+bool NIRS::ProcessingPipeline::Validate(const SNIRFRun& run, StageID output, std::string* error) const
+{
+	SignalType type = GetSourceSignalType(run);
+	for (StageID id : GetChain(output)) {
+		const auto& stage = *GetStage(id);
+		if (!stage.Enabled) continue;
+
+		if (!stage.AcceptsInput(type)) {
+			if (error) *error = stage.GetName() + " cannot process " + SignalTypeToString(type) + " data";
+			return false;
+		}
+		if (!stage.AcceptsRun(run)) {
+			if (error) *error = stage.GetName() + " cannot process " + run.GetName() + ", its channels lack what the stage needs";
+			return false;
+		}
+		type = stage.GetOutputType(type);
+	}
+	return true;
+}
+
+Ref<const NIRS::StageResult> NIRS::ProcessingPipeline::Run(const SNIRFRun& run, StageID output)
+{
+	Timer timer;
+
+	// Checked up front, so a stage that cannot run does not leave the ones above it computed for nothing
+	std::string error;
+	if (!Validate(run, output, &error)) {
+		NVIZ_ERROR("Processing stream does not fit {}: {}", run.GetName(), error);
+		return nullptr;
+	}
+
+	// The raw registry is shared, not copied. A different run, or more samples streamed in, is a new source.
+	const size_t loadedSamples = run.LoadedSamples.load(std::memory_order_acquire);
+	const void* identity[] = { &run, run.Registry.get() };
+	const uint64_t sourceKey = Hash::XXH64(&loadedSamples, sizeof(loadedSamples), Hash::XXH64(identity, sizeof(identity)));
+
+	if (!m_Source || sourceKey != m_SourceKey) {
+		auto source = CreateRef<StageResult>();
+		source->Data = run.Registry;
+		source->Type = GetSourceSignalType(run);
+		source->SamplingRate = run.SamplingRate;
+		source->Time = run.Time;
+		source->Lazy = run.LazyLoaded;
+
+		m_Source = source;
+		m_SourceKey = sourceKey;
+	}
+
+	m_RecomputedCount = 0;
+	const StageContext context{ run };
+	uint64_t key = 0;
+	auto result = Evaluate(context, output, key);
+
+	NVIZ_INFO("Ran processing stream on {}: {} of {} stages recomputed in {:.2f} ms",
+		run.GetName(), m_RecomputedCount, GetChain(output).size(), timer.ElapsedMillis());
+	return result;
+}
+
+void NIRS::ProcessingPipeline::ClearCache()
+{
+	for (auto& node : m_Nodes) {
+		node.Result = nullptr;
+		node.Key = 0;
+	}
+	m_Source = nullptr;
+	m_SourceKey = 0;
+}
+
+NIRS::ProcessingPipeline::Node* NIRS::ProcessingPipeline::FindNode(StageID id)
+{
+	auto it = std::find_if(m_Nodes.begin(), m_Nodes.end(), [id](const Node& node) { return node.ID == id; });
+	return it == m_Nodes.end() ? nullptr : &*it;
+}
+
+const NIRS::ProcessingPipeline::Node* NIRS::ProcessingPipeline::FindNode(StageID id) const
+{
+	auto it = std::find_if(m_Nodes.begin(), m_Nodes.end(), [id](const Node& node) { return node.ID == id; });
+	return it == m_Nodes.end() ? nullptr : &*it;
+}
+
+Ref<const NIRS::StageResult> NIRS::ProcessingPipeline::Evaluate(const StageContext& context, StageID id, uint64_t& key)
+{
+	if (id == Source) {
+		key = m_SourceKey;
+		return m_Source;
+	}
+
+	Node* node = FindNode(id);
+	NVIZ_ASSERT(node, "Stage does not exist");
+
+	uint64_t inputKey = 0;
+	auto input = Evaluate(context, node->Input, inputKey);
+	if (!input) return nullptr;
+
+	auto& stage = *node->Stage;
+	if (!stage.Enabled) {
+		key = inputKey;
+		return input;
+	}
+
+	const StageType type = stage.GetType();
+	key = Utils::HashParameters(stage.GetParameters(), Hash::XXH64(&type, sizeof(type), inputKey));
+	if (node->Result && node->Key == key) return node->Result;
+
+	if (!stage.AcceptsInput(input->Type)) {
+		NVIZ_ERROR("{} stage cannot process {} data", stage.GetName(), SignalTypeToString(input->Type));
+		return nullptr;
+	}
+
+	Timer timer;
+	auto result = CreateRef<StageResult>();
+	stage.Process(context, *input, *result);
+	result->Type = stage.GetOutputType(input->Type);
+	NVIZ_INFO("  {} took {:.2f} ms", stage.GetName(), timer.ElapsedMillis());
+
+	node->Result = result;
+	node->Key = key;
+	m_RecomputedCount++;
+	return result;
+}
@@ -1,59 +1,394 @@
 #include "pch.h"
 #include "NIRS/Processing.h"
+#include "NIRS/Filter.h"
 
+#include <Eigen/LU>
+#include <Eigen/QR>
 
+#include <numeric>
 
+namespace Utils {
 
-void NIRS::PreprocessHemodynamicData(const std::vector<NIRS::ChannelValue>& rawData, std::vector<NIRS::ChannelValue>& processedData, float samplingRate)
+	// Prahl, "Tabulated molar extinction coefficient for hemoglobin in water", 1/(cm M)
+	struct ExtinctionRow { double Wavelength, HbO, HbR; };
+	constexpr ExtinctionRow ExtinctionTable[] = {
+		{ 650, 368.0, 3750.12 }, { 660, 319.6, 3226.56 }, { 670, 294.0, 2795.12 }, { 680, 277.6, 2407.92 },
+		{ 690, 276.0, 2051.96 }, { 700, 290.0, 1794.28 }, { 710, 314.0, 1540.48 }, { 720, 348.0, 1325.88 },
+		{ 730, 390.0, 1102.20 }, { 740, 446.0, 1115.88 }, { 750, 518.0, 1405.24 }, { 760, 586.0, 1548.52 },
+		{ 770, 650.0, 1311.88 }, { 780, 710.0, 1075.44 }, { 790, 756.0, 890.80 },  { 800, 816.0, 761.72 },
+		{ 810, 864.0, 717.08 },  { 820, 916.0, 693.76 },  { 830, 974.0, 693.04 },  { 840, 1022.0, 692.36 },
+		{ 850, 1058.0, 691.32 }, { 860, 1092.0, 694.32 }, { 870, 1128.0, 705.84 }, { 880, 1154.0, 726.44 },
+		{ 890, 1178.0, 743.60 }, { 900, 1198.0, 761.84 }, { 910, 1214.0, 774.56 }, { 920, 1224.0, 777.36 },
+		{ 930, 1222.0, 763.84 }, { 940, 1214.0, 693.44 }, { 950, 1204.0, 602.24 },
+	};
+
+	template<typename T>
+	void ToOpticalDensity(Span<const NIRS::ChannelValue> rawData, T* out)
+	{
+		double initial_intensity = rawData[0];
+		const double EPSILON = 1e-9;
+
+		if (initial_intensity < EPSILON) initial_intensity = EPSILON;
+
+		for (size_t i = 0; i < rawData.size(); i++) {
+			double intensity = rawData[i];
+
+			if (intensity < EPSILON) { // Cannot divide by zero or take log of zero
+				out[i] = 0;
+				continue;
+			}
+
+			out[i] = static_cast<T>(std::log10(initial_intensity / intensity));
+		}
+	}
+
+	// The Butterworth design for a bandpass, nullptr when there is nothing to filter
+	static Ref<const NIRS::FilterDesign> GetBandpassDesign(float sampleRate, float lowerCutoff, float higherCutoff, int order)
+	{
+		const float nyquist = sampleRate / 2.0f;
+		const bool hasLower = lowerCutoff > 0.0f;
+		const bool hasHigher = higherCutoff < nyquist;
+
+		NIRS::FilterBand band = NIRS::FilterBand::Bandpass;
+		if (hasLower && !hasHigher) band = NIRS::FilterBand::Highpass;
+		else if (!hasLower && hasHigher) band = NIRS::FilterBand::Lowpass;
+		else if (!hasLower && !hasHigher) {
+			NVIZ_WARN("Bandpass {} - {} Hz covers the whole band at {} Hz, data left unfiltered", lowerCutoff, higherCutoff, sampleRate);
+			return nullptr;
+		}
+
+		auto design = NIRS::FilterDesignCache::GetButterworth(band, order, sampleRate, lowerCutoff, higherCutoff);
+		if (design->Sections.empty()) return nullptr; // The design logged why
+		return design;
+	}
+}
+
+void NIRS::PreprocessHemodynamicData(Span<const NIRS::ChannelValue> rawData, Span<NIRS::ChannelValue> processedData, float samplingRate, const PreprocessingSettings& settings)
 {
+	NVIZ_ASSERT(processedData.size() == rawData.size(), "Processed series must be as long as the raw one");
+	if (rawData.empty()) return;
+
+	// Working copy in double whatever the storage precision. Reused per thread, so after
+	// the first channel nothing here allocates.
+	thread_local std::vector<double> signal;
+	signal.resize(rawData.size());
+
 	// Convert to Optical Density
-	double initial_intensity = rawData[0];
-	const double EPSILON = 1e-9;
+	Utils::ToOpticalDensity(rawData, signal.data());
+
+	// Bandpass Filter
+	ButterworthBandpassFilter(signal, samplingRate, settings.LowerCutoff, settings.HigherCutoff, settings.FilterOrder);
 
-	if (initial_intensity < EPSILON) initial_intensity = EPSILON;
+	// Optical Density to Hemoglobin Concentrations needs both wavelengths, see ApplyModifiedBeerLambert
+	std::transform(signal.begin(), signal.end(), processedData.begin(), [](double v) { return static_cast<NIRS::ChannelValue>(v); });
+}
+
+void NIRS::PreprocessHemodynamicData(Span<const Span<const NIRS::ChannelValue>> rawData, Span<const Span<NIRS::ChannelValue>> processedData, float samplingRate, const PreprocessingSettings& settings)
+{
+	NVIZ_ASSERT(processedData.size() == rawData.size(), "Every raw series needs a processed one");
+	if (rawData.empty() || rawData[0].empty()) return;
 
-	processedData.resize(rawData.size());
-	for (size_t i = 0; i < rawData.size(); i++) {
-		double intensity = rawData[i];
-		
-		if (intensity < EPSILON) { // Cannot divide by zero or take log of zero
-			processedData[i] = 0.0f;
-			continue;
+	// One double working copy per lane, back to back and reused per thread like the single series version
+	const size_t samples = rawData[0].size();
+	thread_local std::vector<double> signals;
+	signals.resize(std::min<size_t>(DefaultFilterLanes, rawData.size()) * samples);
+
+	std::array<double*, DefaultFilterLanes> channels;
+	for (size_t first = 0; first < rawData.size(); first += DefaultFilterLanes) {
+		const size_t count = std::min<size_t>(DefaultFilterLanes, rawData.size() - first);
+		for (size_t i = 0; i < count; i++) {
+			NVIZ_ASSERT(rawData[first + i].size() == samples && processedData[first + i].size() == samples, "Series must all be as long");
+			channels[i] = signals.data() + i * samples;
+			Utils::ToOpticalDensity(rawData[first + i], channels[i]);
 		}
-		
-		processedData[i] = std::log10(initial_intensity / intensity);
 
+		ButterworthBandpassFilter(Span<double* const>(channels.data(), count), samples, samplingRate, settings.LowerCutoff, settings.HigherCutoff, settings.FilterOrder);
+
+		for (size_t i = 0; i < count; i++) {
+			std::transform(channels[i], channels[i] + samples, processedData[first + i].begin(), [](double v) { return static_cast<NIRS::ChannelValue>(v); });
+		}
 	}
-	// Bandpass Filter
-	// 0.01 to 0.5 Hz - Typical hemodynamic response range
-	// High order Butterworth filter implementation would go here
+}
+
+void NIRS::ButterworthBandpassFilter(Span<double> data, float sampleRate, float lowerCutoff, float higherCutoff, int order)
+{
+	auto design = Utils::GetBandpassDesign(sampleRate, lowerCutoff, higherCutoff, order);
+	if (!design) return;
+
+	thread_local std::vector<double> scratch;
+	scratch.resize(std::max(scratch.size(), GetFiltFiltScratchSize(*design)));
+	FiltFilt(*design, data, scratch);
+}
+
+void NIRS::ButterworthBandpassFilter(Span<double* const> channels, size_t samples, float sampleRate, float lowerCutoff, float higherCutoff, int order)
+{
+	auto design = Utils::GetBandpassDesign(sampleRate, lowerCutoff, higherCutoff, order);
+	if (!design) return;
+
+	FiltFiltChannels(design, channels, samples);
+}
+
+void NIRS::ButterworthBandpassFilter(Span<const Span<const NIRS::ChannelValue>> input, Span<const Span<NIRS::ChannelValue>> output,
+	float sampleRate, float lowerCutoff, float higherCutoff, int order)
+{
+	NVIZ_ASSERT(output.size() == input.size(), "Every input series needs an output one");
+	if (input.empty() || input[0].empty()) return;
+
+	const size_t samples = input[0].size();
+	thread_local std::vector<double> signals;
+	signals.resize(std::min<size_t>(DefaultFilterLanes, input.size()) * samples);
+
+	std::array<double*, DefaultFilterLanes> channels;
+	for (size_t first = 0; first < input.size(); first += DefaultFilterLanes) {
+		const size_t count = std::min<size_t>(DefaultFilterLanes, input.size() - first);
+		for (size_t i = 0; i < count; i++) {
+			NVIZ_ASSERT(input[first + i].size() == samples && output[first + i].size() == samples, "Series must all be as long");
+			channels[i] = signals.data() + i * samples;
+			std::copy(input[first + i].begin(), input[first + i].end(), channels[i]);
+		}
+
+		ButterworthBandpassFilter(Span<double* const>(channels.data(), count), samples, sampleRate, lowerCutoff, higherCutoff, order);
+
+		for (size_t i = 0; i < count; i++) {
+			std::transform(channels[i], channels[i] + samples, output[first + i].begin(), [](double v) { return static_cast<NIRS::ChannelValue>(v); });
+		}
+	}
+}
+
+size_t NIRS::GetResampledLength(size_t length, int up, int down)
+{
+	return (length * static_cast<size_t>(up) + down - 1) / static_cast<size_t>(down);
+}
+
+std::pair<int, int> NIRS::GetResamplingRatio(double sampleRate, double targetRate, int maxUp)
+{
+	std::pair<int, int> best{ 1, 1 };
+	if (sampleRate <= 0.0 || targetRate <= 0.0) return best;
+
+	constexpr double tolerance = 1e-3;
+	double bestError = std::numeric_limits<double>::max();
+	for (int up = 1; up <= maxUp; up++) {
+		const int down = std::max(1, static_cast<int>(std::lround(up * sampleRate / targetRate)));
+		const double error = std::abs(sampleRate * up / down - targetRate) / targetRate;
+		if (error < bestError) {
+			best = { up, down };
+			bestError = error;
+		}
+		if (error <= tolerance) break;
+	}
+
+	const int divisor = std::gcd(best.first, best.second);
+	return { best.first / divisor, best.second / divisor };
+}
 
+void NIRS::ResamplePolyphase(Span<const NIRS::ChannelValue> input, Span<NIRS::ChannelValue> output, int up, int down)
+{
+	const size_t n = input.size();
+	const size_t count = std::min(output.size(), GetResampledLength(n, up, down));
+	if (n == 0 || count == 0) return;
+
+	auto filter = FilterDesignCache::GetPolyphase(up, down);
+	if (filter->Phases.empty()) return;
+
+	// Output m sits at upsampled position m * down + half, which picks the phase and the newest
+	// input it reaches. The window reaches taps - 1 inputs back, past the edges near both ends.
+	const int64_t upRate = filter->Up, downRate = filter->Down, taps = filter->TapsPerPhase, half = filter->HalfLength;
+	const int64_t first = half / upRate - (taps - 1);
+	const int64_t last = (static_cast<int64_t>(count - 1) * downRate + half) / upRate;
+	const int64_t left = std::max<int64_t>(0, -first);
+	const int64_t right = std::max<int64_t>(0, last - static_cast<int64_t>(n) + 1);
+
+	thread_local std::vector<double> padded;
+	padded.resize(left + n + right);
+	std::fill_n(padded.begin(), left, static_cast<double>(input[0]));
+	std::copy(input.begin(), input.end(), padded.begin() + left);
+	std::fill_n(padded.begin() + left + n, right, static_cast<double>(input[n - 1]));
+
+	for (size_t m = 0; m < count; m++) {
+		const int64_t position = static_cast<int64_t>(m) * downRate + half;
+		const int64_t newest = position / upRate;
+
+		Eigen::Map<const Eigen::VectorXd> phase(filter->Phases.data() + (position % upRate) * taps, taps);
+		Eigen::Map<const Eigen::VectorXd> window(padded.data() + left + newest - (taps - 1), taps);
+		output[m] = static_cast<NIRS::ChannelValue>(phase.dot(window));
+	}
+}
+
+NIRS::ExtinctionCoefficients NIRS::GetExtinctionCoefficients(double wavelength)
+{
+	const auto& table = Utils::ExtinctionTable;
+	constexpr size_t rows = sizeof(table) / sizeof(table[0]);
+
+	if (wavelength <= table[0].Wavelength) return { table[0].HbO, table[0].HbR };
+	if (wavelength >= table[rows - 1].Wavelength) return { table[rows - 1].HbO, table[rows - 1].HbR };
+
+	size_t i = 1;
+	while (table[i].Wavelength < wavelength) i++;
+	const auto& lo = table[i - 1];
+	const auto& hi = table[i];
+	const double t = (wavelength - lo.Wavelength) / (hi.Wavelength - lo.Wavelength);
+	return { lo.HbO + t * (hi.HbO - lo.HbO), lo.HbR + t * (hi.HbR - lo.HbR) };
+}
+
+Eigen::Matrix2d NIRS::ComputeMBLLMatrix(double hbrWavelength, double hboWavelength, double distanceCm, double dpf)
+{
+	// OD(l) = (eHbO(l) HbO + eHbR(l) HbR) * distance * DPF, one row per wavelength
+	const auto first = GetExtinctionCoefficients(hbrWavelength);
+	const auto second = GetExtinctionCoefficients(hboWavelength);
+
+	Eigen::Matrix2d system;
+	system << first.HbO, first.HbR,
+		second.HbO, second.HbR;
+	system *= distanceCm * dpf;
+
+	constexpr double MolarToMicromolar = 1e6;
+	return system.inverse() * MolarToMicromolar;
+}
+
+void NIRS::ApplyModifiedBeerLambert(const Eigen::Matrix2d& matrix, Span<NIRS::ChannelValue> hbr, Span<NIRS::ChannelValue> hbo)
+{
+	NVIZ_ASSERT(hbr.size() == hbo.size(), "Both wavelengths of a channel must be equally long");
+
+	// Every timepoint of the pair is one column, solved a block of columns per matrix product
+	constexpr Eigen::Index Block = 256;
+	Eigen::Matrix<double, 2, Block> density;
+	Eigen::Matrix<double, 2, Block> concentration;
+
+	for (size_t start = 0; start < hbr.size(); start += Block) {
+		const Eigen::Index count = static_cast<Eigen::Index>(std::min<size_t>(Block, hbr.size() - start));
+		for (Eigen::Index i = 0; i < count; i++) {
+			density(0, i) = hbr[start + i];
+			density(1, i) = hbo[start + i];
+		}
+
+		concentration.leftCols(count).noalias() = matrix * density.leftCols(count);
+
+		for (Eigen::Index i = 0; i < count; i++) {
+			hbo[start + i] = static_cast<NIRS::ChannelValue>(concentration(0, i));
+			hbr[start + i] = static_cast<NIRS::ChannelValue>(concentration(1, i));
+		}
+	}
+}
 
-    std::vector<double> signal;
-    signal.reserve(processedData.size());
-    for (auto& v : processedData) signal.push_back(v);
+void NIRS::ConvertToOpticalDensity(Span<const NIRS::ChannelValue> intensity, Span<NIRS::ChannelValue> opticalDensity)
+{
+	NVIZ_ASSERT(intensity.size() == opticalDensity.size(), "Optical density must be as long as the intensity");
+	if (intensity.empty()) return;
+	Utils::ToOpticalDensity(intensity, opticalDensity.data());
+}
 
-    ButterworthBandpassFilter(signal, samplingRate, 0.01f, 0.1f);
-	// Optical Density to Hemoglobin Concentrations via Modified Beer-Lambert Law
+void NIRS::NormalizeZScore(Span<NIRS::ChannelValue> data)
+{
+	if (data.empty()) return;
 
-    processedData = signal;
+	double sum = 0.0;
+	for (auto v : data) sum += v;
+	const double mean = sum / data.size();
 
+	double squares = 0.0;
+	for (auto v : data) squares += (v - mean) * (v - mean);
+	const double deviation = std::sqrt(squares / data.size());
+	const double scale = deviation > 0.0 ? 1.0 / deviation : 0.0; // A flat channel becomes all zeros
+
+	for (auto& v : data) v = static_cast<NIRS::ChannelValue>((v - mean) * scale);
 }
 
-std::vector<double> zeroPhaseFilter(IIRFilter& filter, const std::vector<double>& input)
+void NIRS::TemporalDerivativeDistributionRepair(Span<double> data, float sampleRate)
 {
-	auto forward = filter.process(input);
-	std::vector<double> reversed(forward.rbegin(), forward.rend());
-	filter = IIRFilter(filter); // reset state
-	auto backward = filter.process(reversed);
-	return std::vector<double>(backward.rbegin(), backward.rend());
+	const size_t length = data.size();
+	if (length < 3) return;
+
+	using Array = Eigen::Map<Eigen::ArrayXd>;
+	const Eigen::Index count = static_cast<Eigen::Index>(length);
+
+	thread_local std::vector<double> low, derivative, weights, deviation, median, scratch;
+	low.assign(data.begin(), data.end());
+	derivative.resize(length - 1);
+	weights.resize(length - 1);
+	deviation.resize(length - 1);
+	median.resize(length - 1);
+
+	// Only the slow part is repaired, the rest (cardiac, noise) is added back untouched
+	constexpr float SplitFrequency = 0.5f;
+	if (sampleRate > 2.0f * SplitFrequency) {
+		auto design = FilterDesignCache::GetButterworth(FilterBand::Lowpass, 3, sampleRate, 0.0, SplitFrequency);
+		if (!design->Sections.empty()) {
+			scratch.resize(std::max(scratch.size(), GetFiltFiltScratchSize(*design)));
+			FiltFilt(*design, low, scratch);
+		}
+	}
+
+	Array signal(data.data(), count);
+	Array slow(low.data(), count);
+	signal -= slow; // High frequency remainder
+	const double slowMean = slow.mean();
+
+	Array d(derivative.data(), count - 1);
+	Array w(weights.data(), count - 1);
+	Array dev(deviation.data(), count - 1);
+	d = slow.tail(count - 1) - slow.head(count - 1);
+	w.setOnes();
+
+	// Iteratively reweighted robust mean of the derivative
+	constexpr int MaxIterations = 50;
+	constexpr double Tune = 4.685;				// Tukey's biweight tuning constant
+	constexpr double MADToSigma = 1.4826;		// Median absolute deviation to sigma for normal data
+	const double tolerance = std::sqrt(std::numeric_limits<double>::epsilon());
+
+	double mu = std::numeric_limits<double>::infinity();
+	for (int iteration = 0; iteration < MaxIterations; iteration++) {
+		const double previous = mu;
+		mu = (w * d).sum() / w.sum();
+		dev = (d - mu).abs();
+
+		// Median in linear time, averaging the middle pair like numpy for even counts
+		std::copy(deviation.begin(), deviation.end(), median.begin());
+		const size_t mid = median.size() / 2;
+		std::nth_element(median.begin(), median.begin() + mid, median.end());
+		double mad = median[mid];
+		if (median.size() % 2 == 0) mad = 0.5 * (mad + *std::max_element(median.begin(), median.begin() + mid));
+
+		const double sigma = MADToSigma * mad;
+		if (sigma <= 0.0) break; // Mostly flat derivative, nothing stands out
+
+		auto r = dev / (sigma * Tune);
+		w = (r < 1.0).select((1.0 - r.square()).square(), 0.0);
+
+		if (std::abs(mu - previous) < tolerance * std::max(std::abs(mu), std::abs(previous))) break;
+	}
+
+	// Integrate the repaired derivative, keep the slow part's mean, then add the fast part back
+	d = w * (d - mu);
+	low[0] = 0.0;
+	for (size_t i = 1; i < length; i++) low[i] = low[i - 1] + derivative[i - 1];
+	signal += slow + (slowMean - slow.mean());
 }
-void NIRS::ButterworthBandpassFilter(std::vector<double>& data, float sampleRate, float lowerCutoff, float higherCutoff)
+
+void NIRS::RegressShortChannel(Span<const NIRS::ChannelValue> shortChannel, Span<const Span<NIRS::ChannelValue>> longChannels)
 {
-	// Precalcuatled using Scipy's butter function
-	std::vector<double> b = { 4.4568762392924175e-07, 0.0, -2.2284381196462087e-06, 0.0, 4.456876239292417e-06, 0.0, -4.456876239292417e-06, 0.0, 2.2284381196462087e-06, 0.0, -4.4568762392924175e-07, };
+	if (longChannels.empty() || shortChannel.empty()) return;
 
-	std::vector<double> a = { 1.0, -9.632908071507657, 41.76951188974173, -107.36208543704004, 181.1533213783332, -209.6623428034052, 168.56546947437533, -92.96027493337579, 33.65376715250092, -7.222126070431862, 0.6976674208093903, };
-	IIRFilter filter(b, a);
-	data = zeroPhaseFilter(filter, data);
+	const Eigen::Index samples = static_cast<Eigen::Index>(shortChannel.size());
+	const Eigen::Index count = static_cast<Eigen::Index>(longChannels.size());
+
+	Eigen::MatrixXd design(samples, 2);
+	design.col(0).setOnes();
+	for (Eigen::Index i = 0; i < samples; i++) design(i, 1) = shortChannel[i];
+
+	// One long channel per column, so a single solve covers all of them
+	Eigen::MatrixXd targets(samples, count);
+	for (Eigen::Index c = 0; c < count; c++) {
+		const auto& channel = longChannels[c];
+		NVIZ_ASSERT(channel.size() == shortChannel.size(), "Long and short channels must be equally long");
+		for (Eigen::Index i = 0; i < samples; i++) targets(i, c) = channel[i];
+	}
+
+	Eigen::ColPivHouseholderQR<Eigen::MatrixXd> qr(design);
+	const Eigen::MatrixXd beta = qr.solve(targets); // 2 x count: intercept, short channel weight
+	targets.noalias() -= design.col(1) * beta.row(1);
+
+	for (Eigen::Index c = 0; c < count; c++) {
+		auto& channel = longChannels[c];
+		for (Eigen::Index i = 0; i < samples; i++) channel[i] = static_cast<NIRS::ChannelValue>(targets(i, c));
+	}
 }
@@ -0,0 +1,211 @@
+#include "pch.h"
+#include "NIRS/Quality.h"
+#include "NIRS/Processing.h"
+#include "NIRS/SnirfCache.h"
+
+#include "Core/Hash.h"
+#include "Core/ThreadPool.h"
+#include "Core/Timer.h"
+
+#include <Eigen/Core>
+
+#include <numeric>
+
+namespace Utils {
+
+	constexpr int CardiacFilterOrder = 3;
+	constexpr double Pi = 3.14159265358979323846;
+
+	// Cardiac bandpass and z-score, in double whatever the storage precision
+	static void PrepareCardiacSignal(Span<const NIRS::ChannelValue> data, std::vector<double>& out, double sampleRate, const NIRS::QualitySettings& settings)
+	{
+		out.assign(data.begin(), data.end());
+		NIRS::ButterworthBandpassFilter(out, static_cast<float>(sampleRate), settings.CardiacLowCutoff, settings.CardiacHighCutoff, CardiacFilterOrder);
+
+		Eigen::Map<Eigen::ArrayXd> signal(out.data(), static_cast<Eigen::Index>(out.size()));
+		signal -= signal.mean();
+		const double deviation = std::sqrt(signal.square().mean());
+		if (deviation > 0.0) signal /= deviation;
+	}
+
+	static float Median(std::vector<float> values)
+	{
+		if (values.empty()) return 0.0f;
+		const size_t mid = values.size() / 2;
+		std::nth_element(values.begin(), values.begin() + mid, values.end());
+		return values[mid];
+	}
+}
+
+NIRS::ChannelQuality NIRS::ComputeChannelQuality(Span<const NIRS::ChannelValue> first, Span<const NIRS::ChannelValue> second,
+	double sampleRate, const QualitySettings& settings)
+{
+	NVIZ_ASSERT(first.size() == second.size(), "Both wavelengths of a channel must be equally long");
+
+	ChannelQuality quality;
+	const size_t window = static_cast<size_t>(std::round(settings.WindowSeconds * sampleRate));
+	const size_t step = std::max<size_t>(1, static_cast<size_t>(std::round(settings.StepSeconds * sampleRate)));
+	if (sampleRate <= 2.0 * settings.CardiacLowCutoff || window < 2 || first.size() < window) return quality;
+
+	thread_local std::vector<double> a, b, correlation, weights, cosines, sines;
+	Utils::PrepareCardiacSignal(first, a, sampleRate, settings);
+	Utils::PrepareCardiacSignal(second, b, sampleRate, settings);
+
+	// Every window shares the cross-correlation length, so the Hamming window and the
+	// DFT rows of the cardiac bins are built once per channel
+	const Eigen::Index n = static_cast<Eigen::Index>(window);
+	const Eigen::Index lags = 2 * n - 1;
+	correlation.resize(lags);
+
+	weights.resize(lags);
+	for (Eigen::Index i = 0; i < lags; i++) weights[i] = 0.54 - 0.46 * std::cos(2.0 * Utils::Pi * i / (lags - 1));
+	const double weightSum = std::accumulate(weights.begin(), weights.end(), 0.0);
+
+	const Eigen::Index firstBin = static_cast<Eigen::Index>(std::ceil(settings.CardiacLowCutoff * lags / sampleRate));
+	const Eigen::Index lastBin = std::min<Eigen::Index>(lags / 2, static_cast<Eigen::Index>(std::floor(settings.CardiacHighCutoff * lags / sampleRate)));
+	const Eigen::Index bins = std::max<Eigen::Index>(0, lastBin - firstBin + 1);
+
+	cosines.resize(bins * lags);
+	sines.resize(bins * lags);
+	for (Eigen::Index k = 0; k < bins; k++) {
+		for (Eigen::Index i = 0; i < lags; i++) {
+			const double phase = 2.0 * Utils::Pi * (firstBin + k) * i / lags;
+			cosines[k * lags + i] = weights[i] * std::cos(phase);
+			sines[k * lags + i] = weights[i] * std::sin(phase);
+		}
+	}
+	using RowMajor = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+	Eigen::Map<const RowMajor> cosineRows(cosines.data(), bins, lags);
+	Eigen::Map<const RowMajor> sineRows(sines.data(), bins, lags);
+	Eigen::Map<const Eigen::VectorXd> c(correlation.data(), lags);
+
+	const size_t windows = (first.size() - window) / step + 1;
+	quality.SCI.resize(windows);
+	quality.PSP.resize(windows);
+
+	size_t good = 0;
+	for (size_t w = 0; w < windows; w++) {
+		Eigen::Map<const Eigen::VectorXd> x(a.data() + w * step, n);
+		Eigen::Map<const Eigen::VectorXd> y(b.data() + w * step, n);
+
+		const double energy = std::sqrt(x.squaredNorm() * y.squaredNorm());
+		if (energy <= 0.0) {
+			quality.SCI[w] = quality.PSP[w] = 0.0f;
+			continue;
+		}
+
+		// Unbiased cross-correlation scaled so lag zero is the correlation coefficient,
+		// correlation[n - 1 + m] = n / (n - |m|) * sum x[i + m] y[i] / energy
+		for (Eigen::Index m = 0; m < n; m++) {
+			const double scale = static_cast<double>(n) / (n - m) / energy;
+			correlation[n - 1 + m] = x.segment(m, n - m).dot(y.head(n - m)) * scale;
+			correlation[n - 1 - m] = x.head(n - m).dot(y.segment(m, n - m)) * scale;
+		}
+
+		// One-sided power of the windowed correlation at the cardiac bins, as periodogram(..., 'power')
+		double peak = 0.0;
+		if (bins > 0) {
+			const Eigen::VectorXd re = cosineRows * c;
+			const Eigen::VectorXd im = sineRows * c;
+			peak = 2.0 * (re.array().square() + im.array().square()).maxCoeff() / (weightSum * weightSum);
+		}
+
+		quality.SCI[w] = static_cast<float>(correlation[n - 1]);
+		quality.PSP[w] = static_cast<float>(peak);
+		if (quality.SCI[w] >= settings.SCIThreshold && quality.PSP[w] >= settings.PSPThreshold) good++;
+	}
+
+	quality.MedianSCI = Utils::Median(quality.SCI);
+	quality.MedianPSP = Utils::Median(quality.PSP);
+	quality.GoodFraction = static_cast<float>(good) / windows;
+	return quality;
+}
+
+Ref<const NIRS::QualityReport> NIRS::ComputeRunQuality(const SNIRFRun& run, const QualitySettings& settings)
+{
+	Timer timer;
+	auto report = CreateRef<QualityReport>();
+	report->Settings = settings;
+	report->WindowStep = settings.StepSeconds;
+	report->Channels.resize(run.Channels.size());
+
+	if (!run.Channels.empty() && run.Channels.front().HBRWavelength <= 0.0f) {
+		NVIZ_WARN("{} holds processed data, SCI and PSP are meant for the raw wavelengths", run.GetName());
+	}
+
+	const auto& registry = *run.Registry;
+	auto compute = [&](size_t i) {
+		const auto& channel = run.Channels[i];
+		report->Channels[i] = ComputeChannelQuality(registry.GetChannelData(channel.HBRDataIndex),
+			registry.GetChannelData(channel.HBODataIndex), run.SamplingRate, settings);
+	};
+
+	// Lazy channels are read one after the other, every read goes to the file under one lock
+	if (run.LazyLoaded) {
+		for (size_t i = 0; i < run.Channels.size(); i++) compute(i);
+	}
+	else {
+		ThreadPool::Instance().ParallelFor(0, run.Channels.size(), compute);
+	}
+
+	for (const auto& channel : report->Channels) report->WindowCount = std::max(report->WindowCount, channel.SCI.size());
+
+	NVIZ_INFO("Computed SCI / PSP of {} channels over {} windows of {} in {:.2f} ms",
+		run.Channels.size(), report->WindowCount, run.GetName(), timer.ElapsedMillis());
+	return report;
+}
+
+// --- Cache ---
+
+std::mutex NIRS::ChannelQualityCache::s_Mutex;
+std::map<uint64_t, Ref<const NIRS::QualityReport>> NIRS::ChannelQualityCache::s_Reports;
+
+Ref<const NIRS::QualityReport> NIRS::ChannelQualityCache::Get(const std::string& filepath, const SNIRFRun& run, const QualitySettings& settings)
+{
+	const uint64_t key = GetKey(filepath, run, settings);
+	{
+		std::lock_guard<std::mutex> lock(s_Mutex);
+		auto it = s_Reports.find(key);
+		if (it != s_Reports.end()) return it->second;
+	}
+
+	// Computed outside the lock, a report of another file can be looked up meanwhile
+	auto report = ComputeRunQuality(run, settings);
+
+	std::lock_guard<std::mutex> lock(s_Mutex);
+	return s_Reports.emplace(key, report).first->second;
+}
+
+Ref<const NIRS::QualityReport> NIRS::ChannelQualityCache::Find(const std::string& filepath, const SNIRFRun& run, const QualitySettings& settings)
+{
+	const uint64_t key = GetKey(filepath, run, settings);
+
+	std::lock_guard<std::mutex> lock(s_Mutex);
+	auto it = s_Reports.find(key);
+	return it == s_Reports.end() ? nullptr : it->second;
+}
+
+size_t NIRS::ChannelQualityCache::GetSize()
+{
+	std::lock_guard<std::mutex> lock(s_Mutex);
+	return s_Reports.size();
+}
+
+void NIRS::ChannelQualityCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(s_Mutex);
+	s_Reports.clear();
+}
+
+uint64_t NIRS::ChannelQualityCache::GetKey(const std::string& filepath, const SNIRFRun& run, const QualitySettings& settings)
+{
+	const std::string runName = run.GetName();
+	const size_t samples = run.LoadedSamples.load(std::memory_order_acquire);
+	const int64_t modified = GetSourceModifiedTime(filepath); // A file rewritten at the same path gets new reports, as with the session cache
+
+	uint64_t key = Hash::XXH64(filepath.data(), filepath.size());
+	key = Hash::XXH64(&modified, sizeof(modified), key);
+	key = Hash::XXH64(runName.data(), runName.size(), key);
+	key = Hash::XXH64(&samples, sizeof(samples), key);
+	return Hash::XXH64(&settings, sizeof(settings), key);
+}
@@ -1,6 +1,14 @@
 #include "pch.h"
 #include "NIRS/Snirf.h"
 #include "NIRS/Processing.h"
+#include "NIRS/Filter.h"
+#include "NIRS/Pipeline.h"
+#include "NIRS/SnirfCache.h"
+
+#include "Core/Timer.h"
+#include "Core/ThreadPool.h"
+
+#include <cstring>
 
 #include <HighFive/H5File.hpp>
 #include <highfive/H5DataSet.hpp>
@@ -37,6 +45,13 @@ namespace Utils {
         }
     }
     template <typename T>
+    T read_scalar_or(const Group& group, const std::string& name, const T& fallback) {
+        if (!group.exist(name)) return fallback;
+        T value = fallback;
+        group.getDataSet(name).read(value);
+        return value;
+    }
+    template <typename T>
     std::vector<T> read_2d_flat_vector(const Group& group, const std::string& name) {
         try {
             DataSet dataset = group.getDataSet(name);
@@ -122,25 +137,167 @@ namespace Utils {
     }
 }
 
+namespace Utils {
+    constexpr int CW_AMPLITUDE_DATA_TYPE = 1;
+    constexpr int PROCESSED_DATA_TYPE = 99999;
+
+    // What the channel table needs from a run's own probe, positions in cm
+    struct ProbeGeometry {
+        std::vector<double> Wavelengths; // File order, measurement wavelengthIndex is 1-indexed into it
+        std::vector<Eigen::Vector3d> Sources;
+        std::vector<Eigen::Vector3d> Detectors;
+    };
+
+    double LengthUnitToCentimetres(const std::string& unit) {
+        if (unit == "mm") return 0.1;
+        if (unit == "cm") return 1.0;
+        if (unit == "m") return 100.0;
+        NVIZ_WARN("Unknown LengthUnit '{}', assuming mm", unit);
+        return 0.1;
+    }
+
+    // 3D positions when the probe has them, else the 2D layout with z = 0
+    std::vector<Eigen::Vector3d> ReadPositions(const Group& probe, const std::string& name3D, const std::string& name2D, double scale) {
+        const std::string& name = probe.exist(name3D) ? name3D : name2D;
+        if (!probe.exist(name)) return {};
+
+        DataSet dataset = probe.getDataSet(name);
+        auto dims = dataset.getDimensions();
+        if (dims.size() != 2 || dims[1] < 2) return {};
+
+        std::vector<double> flat(dims[0] * dims[1]);
+        dataset.read_raw<double>(flat.data());
+
+        std::vector<Eigen::Vector3d> positions(dims[0]);
+        for (size_t i = 0; i < dims[0]; i++) {
+            const double* row = flat.data() + i * dims[1];
+            positions[i] = Eigen::Vector3d(row[0], row[1], dims[1] > 2 ? row[2] : 0.0) * scale;
+        }
+        return positions;
+    }
+
+    ProbeGeometry ReadProbeGeometry(const Group& nirs) {
+        ProbeGeometry geometry;
+        if (!nirs.exist("probe")) return geometry;
+        Group probe = nirs.getGroup("probe");
+
+        std::string lengthUnit = "mm";
+        if (nirs.exist("metaDataTags")) lengthUnit = read_scalar_or<std::string>(nirs.getGroup("metaDataTags"), "LengthUnit", lengthUnit);
+        const double scale = LengthUnitToCentimetres(lengthUnit);
+
+        if (probe.exist("wavelengths")) geometry.Wavelengths = read_vector<double>(probe, "wavelengths");
+        geometry.Sources = ReadPositions(probe, "sourcePos3D", "sourcePos2D", scale);
+        geometry.Detectors = ReadPositions(probe, "detectorPos3D", "detectorPos2D", scale);
+        return geometry;
+    }
+
+    bool IsLabel(const std::string& label, const char* expected) {
+        return label.size() == std::strlen(expected) && std::equal(label.begin(), label.end(), expected,
+            [](char a, char b) { return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b)); });
+    }
+
+    struct ColumnPair { size_t HbR; size_t HbO; };
+
+    // Pairs the dataTimeSeries columns of every source-detector pair, in order of first appearance.
+    // Raw intensity pairs its two wavelengths, the shorter one being the more HbR sensitive.
+    // Processed data pairs its HbR and HbO labelled columns and ignores the rest (HbT).
+    // Returns nothing when a pair does not match up.
+    std::vector<ColumnPair> PairColumns(const std::vector<Measurement>& measurements, const std::vector<double>& wavelengths) {
+        std::vector<std::pair<int, int>> order;
+        std::map<std::pair<int, int>, std::vector<size_t>> columns;
+        for (size_t c = 0; c < measurements.size(); c++) {
+            auto key = std::make_pair(measurements[c].SourceIndex, measurements[c].DetectorIndex);
+            auto& list = columns[key];
+            if (list.empty()) order.push_back(key);
+            list.push_back(c);
+        }
+
+        auto wavelengthOf = [&](size_t column) {
+            int index = measurements[column].WavelengthIndex;
+            return index >= 1 && index <= static_cast<int>(wavelengths.size()) ? wavelengths[index - 1] : 0.0;
+        };
+
+        std::vector<ColumnPair> pairs;
+        pairs.reserve(order.size());
+        for (const auto& key : order) {
+            const auto& list = columns[key];
+            if (measurements[list.front()].DataType == PROCESSED_DATA_TYPE) {
+                auto hbr = std::find_if(list.begin(), list.end(), [&](size_t c) { return IsLabel(measurements[c].DataTypeLabel, "HbR"); });
+                auto hbo = std::find_if(list.begin(), list.end(), [&](size_t c) { return IsLabel(measurements[c].DataTypeLabel, "HbO"); });
+                if (hbr == list.end() || hbo == list.end()) return {};
+                pairs.push_back({ *hbr, *hbo });
+            }
+            else {
+                if (list.size() != 2) return {};
+                double first = wavelengthOf(list[0]);
+                double second = wavelengthOf(list[1]);
+                if (first <= 0.0 || second <= 0.0 || first == second) return {};
+                pairs.push_back(first < second ? ColumnPair{ list[0], list[1] } : ColumnPair{ list[1], list[0] });
+            }
+        }
+        return pairs;
+    }
+
+    // "nirs" -> 1, "nirs2" -> 2, "data10" -> 10. Returns -1 for names that are not indexed groups.
+    int ParseGroupIndex(const std::string& name, const std::string& prefix) {
+        if (name.rfind(prefix, 0) != 0) return -1;
+        std::string suffix = name.substr(prefix.size());
+        if (suffix.empty()) return 1;
+        if (!std::all_of(suffix.begin(), suffix.end(), ::isdigit)) return -1;
+        return std::stoi(suffix);
+    }
+
+    std::vector<std::string> ListIndexedGroups(const Group& group, const std::string& prefix) {
+        std::vector<std::pair<int, std::string>> indexed;
+        for (const auto& name : group.listObjectNames()) {
+            int index = ParseGroupIndex(name, prefix);
+            if (index >= 0 && group.getObjectType(name) == ObjectType::Group) indexed.push_back({ index, name });
+        }
+        std::sort(indexed.begin(), indexed.end());
+
+        std::vector<std::string> names;
+        for (auto& [index, name] : indexed) names.push_back(name);
+        return names;
+    }
+}
+
+// The HDF5 library is not reentrant, every call into HighFive goes through this lock.
+// Runs are read one at a time, the CPU work after the read runs in parallel.
+static std::mutex s_HDF5Mutex;
+
+std::mutex& SNIRF::GetHDF5Mutex()
+{
+    return s_HDF5Mutex;
+}
+
 SNIRF::SNIRF()
 {
-	m_ChannelDataRegistry = CreateRef<ChannelDataRegistry>();
+    m_Runs = { CreateRef<SNIRFRun>() }; // Placeholder so the getters are valid before a file is loaded
 }
 
-SNIRF::SNIRF(const std::filesystem::path& filepath)
+SNIRF::SNIRF(const std::filesystem::path& filepath) : SNIRF()
 {
-    m_ChannelDataRegistry = CreateRef<ChannelDataRegistry>();
 	LoadFile(filepath);
 }
 
+SNIRF::SNIRF(const std::filesystem::path& filepath, const SNIRFLoadSettings& settings) : SNIRF()
+{
+    m_LoadSettings = settings;
+    LoadFile(filepath);
+}
+
 
 
 void SNIRF::Print()
 {
+    const auto& run = ActiveRun();
     NVIZ_INFO("SNIRF File       : {}", m_Filepath.string());
-	NVIZ_INFO("Sample Rate : {} Hz", m_SamplingRate);
+    NVIZ_INFO("Runs             : {} (active : {})", m_Runs.size(), run.GetName());
+	NVIZ_INFO("Sample Rate : {} Hz", run.SamplingRate);
     NVIZ_INFO("     Sources     : {}", m_Sources2D.size());
     NVIZ_INFO("     Detectors   : {}", m_Detectors2D.size());
+    NVIZ_INFO("     Stimuli     : {} ({} events)", run.Stimuli.size(), run.Events.GetEventCount());
+    NVIZ_INFO("     Aux         : {}", run.Aux.size());
 
     //NVIZ_INFO("Landmarks : 3D{}", m_Landmarks.size());
     //auto print_count = std::min((size_t)3, m_Landmarks.size());
@@ -150,9 +307,9 @@ void SNIRF::Print()
     //    NVIZ_INFO("    {} : ( {}, {}, {} )", lm.Name, lm.Position.x, lm.Position.y, lm.Position.z);
     //}
 
-    NVIZ_INFO("Wavelengths : {}, {}", m_Wavelengths[0], m_Wavelengths[1]);
+    if (m_Wavelengths.size() >= 2) NVIZ_INFO("Wavelengths : {}, {}", m_Wavelengths[0], m_Wavelengths[1]);
 
-    NVIZ_INFO("Channel Data : {} channels, {} time points", m_ChannelData.rows(), m_ChannelData.cols());
+    NVIZ_INFO("Channel Data : {} channels, {} time points", run.NumDataColumns, run.Time.size());
 }
 
 void SNIRF::LoadFile(const std::filesystem::path& filepath)
@@ -161,6 +318,248 @@ void SNIRF::LoadFile(const std::filesystem::path& filepath)
         NVIZ_ERROR("File does not exist: {0}", filepath.string().c_str());
         return;
 	}
+    ClearProbe();
+    m_Runs = { CreateRef<SNIRFRun>() };
+    m_ActiveRun = 0;
+    m_File = nullptr;
+
+    Timer timer;
+    m_Filepath = filepath;
+
+    // The session cache holds the run list, the probe and the first run
+    const auto cachePath = GetSessionCachePath(filepath, "");
+    const uint64_t cacheKey = ComputeSessionCacheKey(filepath, m_LoadSettings.Preprocessing, "");
+    if (m_LoadSettings.UseSessionCache && LoadSessionCache(*m_Runs[0], cachePath, cacheKey, true)) {
+        auto& run = *m_Runs[0];
+        if (m_MetadataLoadedCallback) m_MetadataLoadedCallback(run);
+        if (!run.HasProcessedData()) PreprocessRun(run);
+        else NotifyChannelsReady(run);
+        Print();
+        NVIZ_INFO("Load Time : {:.2f} ms", timer.ElapsedMillis());
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> hdf5Lock(s_HDF5Mutex);
+        OpenFile();
+
+        Group root_group = m_File->getGroup("/");
+
+        m_Runs.clear();
+        for (const auto& nirsName : Utils::ListIndexedGroups(root_group, "nirs")) {
+            Group nirs = root_group.getGroup(nirsName);
+            for (const auto& dataName : Utils::ListIndexedGroups(nirs, "data")) {
+                auto run = CreateRef<SNIRFRun>();
+                run->NirsName = nirsName;
+                run->DataName = dataName;
+                m_Runs.push_back(run);
+            }
+        }
+        if (m_Runs.empty()) {
+            NVIZ_ERROR("No /nirs/data blocks found in {}", filepath.string());
+            m_Runs = { CreateRef<SNIRFRun>() };
+            m_File = nullptr;
+            return;
+        }
+
+        Group nirs = root_group.getGroup(m_Runs[0]->NirsName);
+        Group metadata = nirs.getGroup("metaDataTags");
+        Group probe = nirs.getGroup("probe");
+
+        ParseMetadataTags(metadata);
+        ParseProbe(probe); // THIS MUST BE FIRST
+        m_ProbeNirsName = m_Runs[0]->NirsName;
+    }
+
+    LoadRun(0);
+    if (m_LoadSettings.UseSessionCache && !m_Runs[0]->LazyLoaded) WriteSessionCache(*m_Runs[0], cachePath, cacheKey);
+
+    Print();
+    NVIZ_INFO("Load Time : {:.2f} ms", timer.ElapsedMillis());
+}
+
+void SNIRF::SetActiveRun(size_t index)
+{
+    if (index >= m_Runs.size()) {
+        NVIZ_ERROR("Invalid run index: {}", index);
+        return;
+    }
+
+    const auto& run = *m_Runs[index];
+    if (run.NirsName != m_ProbeNirsName) { // Measurement indices refer to the probe of their own nirs entry
+        std::lock_guard<std::mutex> hdf5Lock(s_HDF5Mutex);
+        OpenFile();
+        ClearProbe();
+        Group probe = m_File->getGroup("/" + run.NirsName).getGroup("probe");
+        ParseProbe(probe);
+        m_ProbeNirsName = run.NirsName;
+    }
+
+    LoadRun(index);
+    m_ActiveRun = index;
+    Print();
+}
+
+bool SNIRF::LoadRun(size_t index)
+{
+    if (index >= m_Runs.size()) return false;
+
+    auto& run = *m_Runs[index];
+    std::lock_guard<std::mutex> runLock(run.LoadMutex);
+    if (run.Loaded.load(std::memory_order_acquire)) return true;
+
+    Timer timer;
+    const auto cachePath = GetSessionCachePath(m_Filepath, run.GetName());
+    const uint64_t cacheKey = ComputeSessionCacheKey(m_Filepath, m_LoadSettings.Preprocessing, run.GetName());
+    bool fromCache = index != 0 && m_LoadSettings.UseSessionCache && LoadSessionCache(run, cachePath, cacheKey, false);
+
+    if (fromCache) {
+        if (m_MetadataLoadedCallback) m_MetadataLoadedCallback(run);
+        if (!run.HasProcessedData()) PreprocessRun(run);
+        else NotifyChannelsReady(run);
+    }
+    else {
+        {
+            std::lock_guard<std::mutex> hdf5Lock(s_HDF5Mutex);
+            OpenFile();
+            Group nirs = m_File->getGroup("/" + run.NirsName);
+            ParseDataBlock(nirs.getGroup(run.DataName), run);
+            ParseStimuli(nirs, run);
+            ParseAux(nirs, run);
+        }
+
+        // The CPU side of the load, runs concurrently with other runs reading from the file
+        PreprocessRun(run);
+
+        if (index != 0 && m_LoadSettings.UseSessionCache && !run.LazyLoaded) WriteSessionCache(run, cachePath, cacheKey);
+    }
+
+    run.Loaded.store(true, std::memory_order_release);
+    ReleaseFileIfUnused();
+
+    NVIZ_INFO("Run {} : {} channels, {} samples in {:.2f} ms", run.GetName(), run.Channels.size(), run.Time.size(), timer.ElapsedMillis());
+    return true;
+}
+
+void SNIRF::PreprocessRun(SNIRFRun& run)
+{
+    run.ProcessedRegistry->Clear();
+    if (run.LazyLoaded) { // Lazy channels are not touched until someone asks for them
+        NotifyChannelsReady(run);
+        return;
+    }
+
+    Timer timer;
+    const auto& raw = *run.Registry;
+    auto& processed = *run.ProcessedRegistry;
+    const size_t count = raw.GetChannelCount();
+
+    // Allocated up front, the views handed to the workers stay valid while they write
+    processed.SetDeduplication(false);
+    processed.Reserve(count, run.Time.size());
+    for (size_t i = 0; i < count; i++) processed.AllocateChannelData(raw.GetChannelLength(static_cast<int>(i)));
+
+    // Aux signals are no light intensities, they are carried over as they are
+    std::vector<bool> aux(count, false);
+    for (const auto& channel : run.Aux) {
+        aux[channel.DataIndex] = true;
+        auto data = raw.GetChannelData(channel.DataIndex);
+        std::copy(data.begin(), data.end(), processed.GetMutableChannelData(channel.DataIndex).begin());
+    }
+
+    // One task per group of raw arrays rather than per channel, deduplicated arrays are shared by
+    // several channels. Groups hold up to DefaultFilterLanes arrays of one length, whose bandpass
+    // runs one array per SIMD lane.
+    std::vector<std::vector<int>> groups;
+    for (size_t i = 0; i < count; i++) {
+        if (aux[i]) continue;
+        const int index = static_cast<int>(i);
+        if (groups.empty() || groups.back().size() == static_cast<size_t>(DefaultFilterLanes) ||
+            raw.GetChannelLength(groups.back().front()) != raw.GetChannelLength(index)) groups.emplace_back();
+        groups.back().push_back(index);
+    }
+
+    // A channel is done once the groups holding its arrays are filtered, the group task that
+    // finishes its last array takes it to concentrations and reports it ready
+    std::vector<std::vector<size_t>> arrayChannels(count);
+    std::unique_ptr<std::atomic<int>[]> pendingArrays(new std::atomic<int>[run.Channels.size()]);
+    for (size_t c = 0; c < run.Channels.size(); c++) {
+        const auto& channel = run.Channels[c];
+        arrayChannels[channel.HBRDataIndex].push_back(c);
+        if (channel.HBODataIndex != channel.HBRDataIndex) arrayChannels[channel.HBODataIndex].push_back(c);
+        pendingArrays[c].store(channel.HBODataIndex != channel.HBRDataIndex ? 2 : 1, std::memory_order_relaxed);
+    }
+
+    // Only raw intensities are turned into optical density, processed files are bandpassed as they are.
+    // Optical density goes to concentrations, one 2x2 system per channel. Every channel or none,
+    // so the whole registry holds one kind of signal.
+    const float samplingRate = static_cast<float>(run.SamplingRate);
+    const auto& settings = m_LoadSettings.Preprocessing;
+    const SignalType sourceType = GetSourceSignalType(run);
+    const bool mbll = sourceType != SignalType::Concentration && GetProcessedSignalType(run, settings) == SignalType::Concentration;
+    ThreadPool::Instance().ParallelFor(0, groups.size(), [&](size_t g) {
+        std::array<Span<const ChannelValue>, DefaultFilterLanes> inputs;
+        std::array<Span<ChannelValue>, DefaultFilterLanes> outputs;
+        const auto& group = groups[g];
+        for (size_t i = 0; i < group.size(); i++) {
+            inputs[i] = raw.GetChannelData(group[i]);
+            outputs[i] = processed.GetMutableChannelData(group[i]);
+        }
+        Span<const Span<const ChannelValue>> in(inputs.data(), group.size());
+        Span<const Span<ChannelValue>> out(outputs.data(), group.size());
+        if (sourceType == SignalType::Intensity) PreprocessHemodynamicData(in, out, samplingRate, settings);
+        else ButterworthBandpassFilter(in, out, samplingRate, settings.LowerCutoff, settings.HigherCutoff, settings.FilterOrder);
+
+        for (int index : group) {
+            for (size_t c : arrayChannels[index]) {
+                if (pendingArrays[c].fetch_sub(1, std::memory_order_acq_rel) != 1) continue;
+                const auto& channel = run.Channels[c];
+                if (mbll) {
+                    const float distance = channel.Distance > 0.0f ? channel.Distance : settings.FallbackDistance;
+                    auto matrix = ComputeMBLLMatrix(channel.HBRWavelength, channel.HBOWavelength, distance, settings.DifferentialPathlengthFactor);
+                    ApplyModifiedBeerLambert(matrix, processed.GetMutableChannelData(channel.HBRDataIndex), processed.GetMutableChannelData(channel.HBODataIndex));
+                }
+                if (m_ChannelReadyCallback) m_ChannelReadyCallback(run, channel.ID);
+            }
+        }
+    });
+    processed.InvalidateTimeMajorView();
+
+    NVIZ_INFO("Preprocessed {} arrays of {} in {:.2f} ms", count, run.GetName(), timer.ElapsedMillis());
+}
+
+void SNIRF::NotifyChannelsReady(const SNIRFRun& run)
+{
+    if (!m_ChannelReadyCallback) return;
+    for (const auto& channel : run.Channels) m_ChannelReadyCallback(run, channel.ID);
+}
+
+void SNIRF::LoadAllRuns()
+{
+    Timer timer;
+    ThreadPool::Instance().ParallelFor(0, m_Runs.size(), [this](size_t i) {
+        LoadRun(i);
+    });
+    NVIZ_INFO("Loaded {} runs in {:.2f} ms", m_Runs.size(), timer.ElapsedMillis());
+}
+
+void SNIRF::OpenFile()
+{
+    // Caller holds s_HDF5Mutex
+    if (!m_File) m_File = CreateRef<File>(m_Filepath.string(), File::ReadOnly); //Utils::ParseHDF5(filepath.string());
+}
+
+void SNIRF::ReleaseFileIfUnused()
+{
+    std::lock_guard<std::mutex> hdf5Lock(s_HDF5Mutex);
+    for (const auto& run : m_Runs) {
+        if (!run->Loaded.load(std::memory_order_acquire) || run->LazyLoaded) return;
+    }
+    m_File = nullptr; // Everything is in memory, no need to hold the file open
+}
+
+void SNIRF::ClearProbe()
+{
     m_Source2DMap.clear();
     m_Detector2DMap.clear();
     m_Source3DMap.clear();
@@ -170,27 +569,8 @@ void SNIRF::LoadFile(const std::filesystem::path& filepath)
     m_Sources3D.clear();
     m_Detectors3D.clear();
     //m_Landmarks.clear();
-    m_ChannelMap.clear();
-    m_Channels.clear();
     m_Wavelengths.clear();
-    m_ChannelData.resize(0, 0);
-    m_ChannelDataRegistry->Clear();
-
-    m_Filepath = filepath;
-    File file(filepath.string(), File::ReadOnly); //Utils::ParseHDF5(filepath.string());
-
-	Group root_group = file.getGroup("/");
-    Group nirs = root_group.getGroup("/nirs");
-    Group data1 = nirs.getGroup("data1");
-
-	Group metadata = nirs.getGroup("metaDataTags");
-    Group probe = nirs.getGroup("probe");
-
-    ParseMetadataTags(metadata);
-	ParseProbe(probe); // THIS MUST BE FIRST
-    ParseData1(data1);
-
-    Print();
+    m_ProbeNirsName = "";
 }
 
 
@@ -302,8 +682,7 @@ void SNIRF::ParseProbe(const HighFive::Group& probe)
         auto dims = wavelengths.getDimensions();
         std::vector<int> wl(dims[0]);
 		wavelengths.read(wl);
-		m_Wavelengths = wl; 
-        std::sort(m_Wavelengths.begin(), m_Wavelengths.end()); // Sort in ascending order to make sure HbR is the 0th 
+		m_Wavelengths = wl; // File order, measurement wavelengthIndex points into it
     }
 
     //auto landmarkLabels = probe.getDataSet("landmarkLabels");
@@ -332,109 +711,339 @@ void SNIRF::ParseProbe(const HighFive::Group& probe)
     //}
 }
 
-void SNIRF::ParseData1(const HighFive::Group& data1)
+void SNIRF::ParseDataBlock(const HighFive::Group& data, SNIRFRun& run)
 {
 
-    DataSet time = data1.getDataSet("time");
+    DataSet time = data.getDataSet("time");
     {
         std::vector<double> time_data(time.getDimensions()[0]);
         time.read(time_data);
 
-        m_Time.resize(time_data.size());
-		std::copy(time_data.begin(), time_data.end(), m_Time.begin());
+        run.Time.resize(time_data.size());
+		std::copy(time_data.begin(), time_data.end(), run.Time.begin());
 
         float total_duration = time_data.back() - time_data.front();
         size_t num_intervals = time_data.size() - 1;
         float avg_dt = total_duration / num_intervals;
         float sampling_rate = 1.0f / avg_dt;
-        m_SamplingRate = sampling_rate;
-		m_DurationSeconds = total_duration;
+        run.SamplingRate = sampling_rate;
+		run.DurationSeconds = total_duration;
         NVIZ_INFO("Sampling Rate (Fs): {} Hz", sampling_rate);
         NVIZ_INFO("Duration (Seconds): {} ", total_duration);
     }
 
 
-    using Map_RM = Eigen::Map<const Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>>;
-    auto dataTimeSeries = data1.getDataSet("dataTimeSeries");
+    // dataTimeSeries is stored time-major (samples x columns). Read it in hyperslabs of
+    // ChunkSamples rows and scatter each chunk straight into the per-column storage,
+    // so only one full copy of the data plus a single chunk is ever resident.
+    // In lazy mode nothing is read here, columns are fetched when first requested.
+    auto dataTimeSeries = data.getDataSet("dataTimeSeries");
+    std::vector<int> columnDataIndices;
     {
         auto dims = dataTimeSeries.getDimensions();
-        auto nd_array = std::vector<double>(dims[0] * dims[1]);
-        dataTimeSeries.read_raw<double>(nd_array.data());
-        m_ChannelData = Map_RM(nd_array.data(), dims[0], dims[1]).transpose();
-	}
+        NVIZ_ASSERT(dims.size() == 2, "dataTimeSeries MUST BE 2D");
 
-    // --- CREATES CHANNELS ---
+        const size_t numSamples = dims[0];
+        const size_t numColumns = dims[1];
+        run.NumDataColumns = numColumns;
 
-	// The first half is hbr, the second half is hbo
-    NVIZ_ASSERT((m_ChannelData.rows() % 2) == 0, "CHANNEL NUM MUST BE EVEN, NOT ODD");
+        const size_t totalBytes = numSamples * numColumns * sizeof(NIRS::ChannelValue);
+        run.LazyLoaded = m_LoadSettings.LoadMode == ChannelLoadMode::Lazy ||
+            (m_LoadSettings.LoadMode == ChannelLoadMode::Auto && totalBytes > m_LoadSettings.ChannelCacheBudgetBytes);
 
-	std::string base_name = "measurementList";
-    for (size_t i = 0; i < m_ChannelData.rows() / 2; i++)
-    {
-        int hbr_index = i;
-		int hbo_index = hbr_index + (m_ChannelData.rows() / 2);
+        // ParseAux appends the aux signals after the columns, they are always resident. Reserved
+        // here with the columns so the views handed out later stay valid.
+        const size_t auxCount = Utils::ListIndexedGroups(m_File->getGroup("/" + run.NirsName), "aux").size();
 
-		auto name = base_name + std::to_string(i+1);
+        columnDataIndices.resize(numColumns);
+        if (run.LazyLoaded) {
+            run.Registry->Reserve(auxCount, numSamples); // The lazy columns live in their own slots
 
-		auto measurementList = data1.getGroup(name);
+            // Registry index -> dataTimeSeries column, each lookup is a single column hyperslab
+            std::unordered_map<int, size_t> indexToColumn;
+            for (size_t c = 0; c < numColumns; c++) {
+                columnDataIndices[c] = run.Registry->RegisterLazyChannel(numSamples);
+                indexToColumn[columnDataIndices[c]] = c;
+            }
 
-        auto dataType = 0;
-        measurementList.getDataSet("dataType").read(dataType);
-		auto dataTypeIndex = 0;
-        measurementList.getDataSet("dataTypeIndex").read(dataTypeIndex);
-        std::string dataTypeLabel = "";
-        measurementList.getDataSet("dataTypeLabel").read(dataTypeLabel);
+            auto file = m_File; // Keep the file alive for as long as the loader can be called
+            run.Registry->SetCacheBudget(m_LoadSettings.ChannelCacheBudgetBytes);
+            run.Registry->SetChannelLoader([file, dataTimeSeries, indexToColumn, numSamples](int index, ChannelDataRegistry::MutableChannelView out) {
+                std::lock_guard<std::mutex> hdf5Lock(s_HDF5Mutex);
+                size_t column = indexToColumn.at(index);
+                dataTimeSeries.select({ 0, column }, { numSamples, 1 }).read_raw<NIRS::ChannelValue>(out.data()); // HDF5 converts to the storage precision
+            });
 
-        int sourceIndex = 0;
-        measurementList.getDataSet("sourceIndex").read(sourceIndex);
+            run.LoadedSamples.store(numSamples, std::memory_order_release);
+            NVIZ_INFO("Lazy channel loading : {} columns, cache budget {} MB", numColumns, m_LoadSettings.ChannelCacheBudgetBytes / (1024 * 1024));
+        }
+        else {
+            run.Registry->Reserve(numColumns + auxCount, numSamples); // One allocation holds both
+            for (size_t c = 0; c < numColumns; c++) {
+                columnDataIndices[c] = run.Registry->AllocateChannelData(numSamples);
+            }
+        }
+	}
+
+    // --- CREATES CHANNELS ---
+    ParseMeasurementLists(data, run);
+
+    // Read from the run's own nirs entry, the probe members belong to the active one
+    auto geometry = Utils::ReadProbeGeometry(m_File->getGroup("/" + run.NirsName));
+
+    auto pairs = Utils::PairColumns(run.Measurements, geometry.Wavelengths);
+    const bool paired = !pairs.empty();
+    if (!paired) {
+        // Older exports: the first half is hbr, the second half is hbo
+        NVIZ_WARN("Measurement list of {} does not pair up by source and detector, assuming HbR then HbO halves", run.GetName());
+        NVIZ_ASSERT((run.NumDataColumns % 2) == 0, "CHANNEL NUM MUST BE EVEN, NOT ODD");
+        for (size_t i = 0; i < run.NumDataColumns / 2; i++) pairs.push_back({ i, i + run.NumDataColumns / 2 });
+    }
 
-        int detectorIndex = 0;
-        measurementList.getDataSet("detectorIndex").read(detectorIndex);
+    const bool rawIntensity = paired && std::all_of(run.Measurements.begin(), run.Measurements.end(),
+        [](const NIRS::Measurement& m) { return m.DataType == Utils::CW_AMPLITUDE_DATA_TYPE; });
+
+    // The channel table is built from the measurement table in one pass
+    run.Channels.reserve(pairs.size());
+    for (size_t i = 0; i < pairs.size(); i++)
+    {
+        const auto& measurement = run.Measurements[pairs[i].HbR];
 
-        int wavelengthIndex = 0;
-        measurementList.getDataSet("wavelengthIndex").read(wavelengthIndex);
-        
 		NIRS::Channel channel;
 		channel.ID = i; // As long as its unique this should be fine
-		channel.SourceID = sourceIndex; // These are 1-indexed, TODO : Fix 
-		channel.DetectorID = detectorIndex;
+		channel.SourceID = measurement.SourceIndex; // These are 1-indexed, TODO : Fix 
+		channel.DetectorID = measurement.DetectorIndex;
        
-        { // Load HBR
-            auto channel_row = m_ChannelData.row(hbr_index);
-            std::vector<double> channel_data_vec(channel_row.size());
-            std::copy(channel_row.data(), channel_row.data() + channel_row.size(), channel_data_vec.begin());
+        channel.HBRDataIndex = columnDataIndices[pairs[i].HbR];
+        channel.HBODataIndex = columnDataIndices[pairs[i].HbO];
 
-            std::vector<double> processed;
-            PreprocessHemodynamicData(channel_data_vec, processed, m_SamplingRate);
+        if (rawIntensity) {
+            channel.HBRWavelength = static_cast<float>(geometry.Wavelengths[run.Measurements[pairs[i].HbR].WavelengthIndex - 1]);
+            channel.HBOWavelength = static_cast<float>(geometry.Wavelengths[run.Measurements[pairs[i].HbO].WavelengthIndex - 1]);
+        }
 
-            channel.HBRDataIndex = m_ChannelDataRegistry->SubmitChannelData(channel_data_vec);
-        };
-        
-        { // Load HBO
-            auto channel_row = m_ChannelData.row(hbo_index);
-            std::vector<double> channel_data_vec(channel_row.size());
-            std::copy(channel_row.data(), channel_row.data() + channel_row.size(), channel_data_vec.begin());
+        // Separation and midpoint for every channel, short channel regression needs them on processed data too
+        const size_t source = measurement.SourceIndex - 1;
+        const size_t detector = measurement.DetectorIndex - 1;
+        if (source < geometry.Sources.size() && detector < geometry.Detectors.size()) {
+            const Eigen::Vector3d midpoint = 0.5 * (geometry.Sources[source] + geometry.Detectors[detector]);
+            channel.Distance = static_cast<float>((geometry.Sources[source] - geometry.Detectors[detector]).norm());
+            channel.Position = glm::vec3(static_cast<float>(midpoint.x()), static_cast<float>(midpoint.y()), static_cast<float>(midpoint.z()));
+        }
+
+		run.Channels.push_back(channel);
+        run.ChannelMap[channel.ID] = channel;
+    }
 
-            std::vector<double> processed;
-            PreprocessHemodynamicData(channel_data_vec, processed, m_SamplingRate);
+    // The channel table and the (still empty) channel arrays exist from here on,
+    // readers can look at the first GetLoadedSampleCount() samples while the rest streams in
+    if (m_MetadataLoadedCallback) m_MetadataLoadedCallback(run);
 
-            channel.HBODataIndex = m_ChannelDataRegistry->SubmitChannelData(channel_data_vec);
-        };
+    if (!run.LazyLoaded) {
+        const size_t numSamples = run.Time.size();
+        const size_t numColumns = run.NumDataColumns;
+
+        size_t chunkSamples = m_LoadSettings.ChunkSamples;
+        if (chunkSamples == 0 || chunkSamples > numSamples) chunkSamples = numSamples;
+
+        std::vector<NIRS::ChannelValue> chunk(chunkSamples * numColumns); // HDF5 converts to the storage precision
+        for (size_t offset = 0; offset < numSamples; offset += chunkSamples) {
+            const size_t count = std::min(chunkSamples, numSamples - offset);
+
+            dataTimeSeries.select({ offset, 0 }, { count, numColumns }).read_raw<NIRS::ChannelValue>(chunk.data());
+
+            for (size_t c = 0; c < numColumns; c++) {
+                auto columnData = run.Registry->GetMutableChannelData(columnDataIndices[c]);
+                for (size_t s = 0; s < count; s++) {
+                    columnData[offset + s] = chunk[s * numColumns + c];
+                }
+            }
+
+            run.Registry->InvalidateTimeMajorView(); // The main thread may have transposed a partial store
+            run.LoadedSamples.store(offset + count, std::memory_order_release);
+            if (m_ChunkLoadedCallback) m_ChunkLoadedCallback(offset + count, numSamples);
+        }
+    }
+}
+
+bool NIRS::ReadMeasurementTable(const HighFive::Group& data, std::vector<Measurement>& measurements)
+{
+    if (!data.exist("measurementLists")) return false;
+    Group lists = data.getGroup("measurementLists");
+
+    auto sourceIndex = Utils::read_vector<int>(lists, "sourceIndex");
+    auto detectorIndex = Utils::read_vector<int>(lists, "detectorIndex");
+    const size_t numColumns = measurements.size();
+    if (sourceIndex.size() < numColumns || detectorIndex.size() < numColumns) {
+        NVIZ_ERROR("measurementLists of {} has {} entries for {} columns, reading the measurementList groups instead",
+            data.getPath(), std::min(sourceIndex.size(), detectorIndex.size()), numColumns);
+        return false;
+    }
+
+    auto wavelengthIndex = Utils::read_vector<int>(lists, "wavelengthIndex");
+    auto dataType = Utils::read_vector<int>(lists, "dataType");
+    auto dataTypeIndex = lists.exist("dataTypeIndex") ? Utils::read_vector<int>(lists, "dataTypeIndex") : std::vector<int>{};
+    auto dataTypeLabel = lists.exist("dataTypeLabel") ? Utils::read_vector<std::string>(lists, "dataTypeLabel") : std::vector<std::string>{};
+
+    for (size_t i = 0; i < numColumns; i++) {
+        auto& m = measurements[i];
+        m.SourceIndex = sourceIndex[i];
+        m.DetectorIndex = detectorIndex[i];
+        m.WavelengthIndex = i < wavelengthIndex.size() ? wavelengthIndex[i] : 0;
+        m.DataType = i < dataType.size() ? dataType[i] : 0;
+        m.DataTypeIndex = i < dataTypeIndex.size() ? dataTypeIndex[i] : 0;
+        m.DataTypeLabel = i < dataTypeLabel.size() ? dataTypeLabel[i] : "";
+    }
+    return true;
+}
+
+void NIRS::ReadMeasurementGroups(const HighFive::Group& data, std::vector<Measurement>& measurements)
+{
+    const std::string base_name = "measurementList";
+    for (size_t i = 0; i < measurements.size(); i++) {
+        Group measurementList = data.getGroup(base_name + std::to_string(i + 1));
+
+        auto& m = measurements[i];
+        measurementList.getDataSet("sourceIndex").read(m.SourceIndex);
+        measurementList.getDataSet("detectorIndex").read(m.DetectorIndex);
+        measurementList.getDataSet("wavelengthIndex").read(m.WavelengthIndex);
+        measurementList.getDataSet("dataType").read(m.DataType);
+        m.DataTypeIndex = Utils::read_scalar_or<int>(measurementList, "dataTypeIndex", 0);
+
+        constexpr int PROCESSED_DATA_TYPE = 99999; // The label is only meaningful for processed data
+        if (m.DataType == PROCESSED_DATA_TYPE) {
+            m.DataTypeLabel = Utils::read_scalar_or<std::string>(measurementList, "dataTypeLabel", "");
+        }
+    }
+}
 
-		m_Channels.push_back(channel);
-        m_ChannelMap[channel.ID] = channel;
+void SNIRF::ParseMeasurementLists(const HighFive::Group& data, SNIRFRun& run)
+{
+    // HDF5 serialises every call behind its global lock (and is not safe to call from
+    // several threads at all without the thread-safe build), so reading the groups
+    // concurrently does not help. Instead we read as few datasets as possible:
+    // the SNIRF v1.1 compact 'measurementLists' table is one read per field for all
+    // columns, the per-group fallback skips the optional string label unless needed.
+    Timer timer;
+    const size_t numColumns = run.NumDataColumns;
+    run.Measurements.clear();
+    run.Measurements.resize(numColumns);
+
+    const bool compact = NIRS::ReadMeasurementTable(data, run.Measurements);
+    if (!compact) NIRS::ReadMeasurementGroups(data, run.Measurements);
+
+    NVIZ_INFO("Measurement Table : {} entries in {:.2f} ms ({})", numColumns, timer.ElapsedMillis(), compact ? "measurementLists" : "measurementListN groups");
+    if (!run.Measurements.empty()) {
+        const auto& m = run.Measurements.front();
+        NVIZ_INFO("    dataType         : {0}", m.DataType);
+        NVIZ_INFO("    dataTypeIndex    : {0}", m.DataTypeIndex);
+        NVIZ_INFO("    dataTypeLabel    : {0}", m.DataTypeLabel); // Either raw-DC, or conc or something else
+        NVIZ_INFO("    Source ID        : {0}", m.SourceIndex);
+        NVIZ_INFO("    Detector ID      : {0}", m.DetectorIndex);
+        NVIZ_INFO("    Wavelength Index : {0}", m.WavelengthIndex);
+    }
+}
+
+void SNIRF::ParseStimuli(const HighFive::Group& nirs, SNIRFRun& run)
+{
+    run.Stimuli.clear();
+    for (const auto& stimName : Utils::ListIndexedGroups(nirs, "stim")) {
+        Group stim = nirs.getGroup(stimName);
+
+        NIRS::Stimulus stimulus;
+        stimulus.Name = Utils::read_scalar_or<std::string>(stim, "name", stimName);
+
+        // Rows of (onset, duration, amplitude), extra columns are described by dataLabels and ignored.
+        // Conditions without events are often written as an empty or 1D dataset.
+        if (stim.exist("data")) {
+            auto dims = stim.getDataSet("data").getDimensions();
+            std::vector<double> values;
+            size_t columns = 0;
+            if (dims.size() == 2 && dims[0] > 0) {
+                values = Utils::read_2d_flat_vector<double>(stim, "data");
+                columns = dims[1];
+            }
+            else if (dims.size() == 1 && dims[0] > 0) {
+                values = Utils::read_vector<double>(stim, "data"); // A single event stored flat
+                columns = values.size();
+            }
 
-        if (i == 1) {
-            NVIZ_INFO("Measurement List : {0}", name);
-            NVIZ_INFO("    dataType         : {0}", dataType);
-            NVIZ_INFO("    dataTypeIndex    : {0}", dataTypeIndex);
-            NVIZ_INFO("    dataTypeLabel    : {0}", dataTypeLabel); // Either raw-DC, or conc or something else
-            NVIZ_INFO("    Channel          : ");
-            NVIZ_INFO("    Source ID        : {0}", channel.SourceID);
-            NVIZ_INFO("    Detector ID      : {0}", channel.DetectorID);
-            NVIZ_INFO("    HBO Data Index   : {0}", channel.HBODataIndex);
-            NVIZ_INFO("    HBR Data Index   : {0}", channel.HBRDataIndex);
+            if (columns >= 3) {
+                const size_t rows = values.size() / columns;
+                for (size_t row = 0; row < rows; row++) {
+                    const double* event = values.data() + row * columns;
+                    stimulus.Events.push_back({ event[0], event[1], event[2] });
+                }
+            }
+            else if (columns > 0) {
+                NVIZ_WARN("{}/{}/data has {} columns, expected onset, duration and amplitude", run.NirsName, stimName, columns);
+            }
         }
+
+        NVIZ_INFO("Stimulus {} : {} events", stimulus.Name, stimulus.Events.size());
+        run.Stimuli.push_back(std::move(stimulus));
     }
+    run.Events = NIRS::EventIndex(run.Stimuli);
 }
 
+void SNIRF::ParseAux(const HighFive::Group& nirs, SNIRFRun& run)
+{
+    run.Aux.clear();
+    const size_t numSamples = run.Time.size();
+    for (const auto& auxName : Utils::ListIndexedGroups(nirs, "aux")) {
+        Group aux = nirs.getGroup(auxName);
+        if (!aux.exist("dataTimeSeries") || !aux.exist("time")) {
+            NVIZ_WARN("{}/{} has no dataTimeSeries or time, skipping it", run.NirsName, auxName);
+            continue;
+        }
+
+        NIRS::AuxChannel channel;
+        channel.Name = Utils::read_scalar_or<std::string>(aux, "name", auxName);
+        channel.Unit = Utils::read_scalar_or<std::string>(aux, "dataUnit", "");
+        const double timeOffset = Utils::read_scalar_or<double>(aux, "timeOffset", 0.0);
+
+        // Written as a plain vector or as a single column
+        auto dims = aux.getDataSet("dataTimeSeries").getDimensions();
+        std::vector<double> values;
+        if (dims.size() == 2 && dims[0] > 0 && dims[1] > 0) {
+            auto flat = Utils::read_2d_flat_vector<double>(aux, "dataTimeSeries");
+            values.resize(dims[0]);
+            for (size_t i = 0; i < values.size(); i++) values[i] = flat[i * dims[1]];
+            if (dims[1] > 1) NVIZ_WARN("{}/{} has {} columns, only the first is kept", run.NirsName, auxName, dims[1]);
+        }
+        else if (dims.size() == 1) {
+            values = Utils::read_vector<double>(aux, "dataTimeSeries");
+        }
+
+        auto time = Utils::read_vector<double>(aux, "time");
+        if (values.empty() || time.size() != values.size()) {
+            NVIZ_WARN("{}/{} has {} samples but {} time points, skipping it", run.NirsName, auxName, values.size(), time.size());
+            continue;
+        }
+        for (auto& t : time) t += timeOffset;
+
+        // Aux devices run on their own clock, interpolating at the run's sample times lets
+        // the signal share the data columns' indexing, rate and plotting
+        channel.DataIndex = run.Registry->AllocateChannelData(numSamples);
+        auto out = run.Registry->GetMutableChannelData(channel.DataIndex);
+        size_t next = 0;
+        for (size_t i = 0; i < numSamples; i++) {
+            const double t = run.Time[i];
+            while (next < time.size() && time[next] < t) next++;
+
+            double value;
+            if (next == 0) value = values.front();
+            else if (next == time.size()) value = values.back();
+            else {
+                const double span = time[next] - time[next - 1];
+                const double w = span > 0.0 ? (t - time[next - 1]) / span : 1.0;
+                value = values[next - 1] + w * (values[next] - values[next - 1]);
+            }
+            out[i] = static_cast<NIRS::ChannelValue>(value);
+        }
+
+        NVIZ_INFO("Aux {} : {} samples{}{}", channel.Name, values.size(), channel.Unit.empty() ? "" : " in ", channel.Unit);
+        run.Aux.push_back(std::move(channel));
+    }
+    run.Registry->InvalidateTimeMajorView();
+}
@@ -0,0 +1,355 @@
+#include "pch.h"
+#include "NIRS/SnirfCache.h"
+#include "NIRS/Snirf.h"
+
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <tuple>
+#include <limits>
+
+#include "Core/MappedFile.h"
+#include "Core/Timer.h"
+
+namespace Utils {
+
+    // FNV-1a, plenty for a cache key
+    uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0xcbf29ce484222325ull) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        uint64_t hash = seed;
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    template<typename T>
+    void WriteSection(std::ofstream& out, NIRS::SessionCacheHeader& header, NIRS::SessionCacheSection section, const T* data, size_t count) {
+        static const char padding[NIRS::SessionCacheAlignment] = {};
+
+        size_t position = static_cast<size_t>(out.tellp());
+        size_t aligned = NIRS::AlignSessionCacheOffset(position);
+        out.write(padding, aligned - position);
+
+        header.Sections[section] = { aligned, count, sizeof(T) };
+        if (count > 0) out.write(reinterpret_cast<const char*>(data), count * sizeof(T));
+    }
+
+    template<typename T>
+    const T* ReadSection(const MappedFile& file, const NIRS::SessionCacheHeader& header, NIRS::SessionCacheSection section) {
+        const auto& info = header.Sections[section];
+        if (info.ElementSize != sizeof(T)) return nullptr;
+        if (info.Offset % NIRS::SessionCacheAlignment != 0) return nullptr;
+        if (info.Offset > file.GetSize() || info.Count > (file.GetSize() - info.Offset) / info.ElementSize) return nullptr;
+        return file.As<T>(info.Offset);
+    }
+}
+
+namespace NIRS {
+
+    std::filesystem::path GetSessionCachePath(const std::filesystem::path& snirfPath, const std::string& runName)
+    {
+        auto cachePath = snirfPath;
+        if (!runName.empty()) {
+            std::string suffix = runName;
+            std::replace(suffix.begin(), suffix.end(), '/', '.');
+            cachePath += "." + suffix;
+        }
+        cachePath += ".nvizcache";
+        return cachePath;
+    }
+
+    int64_t GetSourceModifiedTime(const std::filesystem::path& snirfPath)
+    {
+        std::error_code ec;
+        auto time = std::filesystem::last_write_time(snirfPath, ec);
+        if (ec) return 0;
+        return static_cast<int64_t>(time.time_since_epoch().count());
+    }
+
+    uint64_t ComputeSessionCacheKey(const std::filesystem::path& snirfPath, const PreprocessingSettings& settings, const std::string& runName)
+    {
+        std::error_code ec;
+        std::string path = std::filesystem::absolute(snirfPath, ec).generic_string();
+        int64_t modified = GetSourceModifiedTime(snirfPath);
+
+        uint64_t key = Utils::HashBytes(path.data(), path.size());
+        key = Utils::HashBytes(&modified, sizeof(modified), key);
+        key = Utils::HashBytes(runName.data(), runName.size(), key);
+        key = Utils::HashBytes(&settings.LowerCutoff, sizeof(settings.LowerCutoff), key);
+        key = Utils::HashBytes(&settings.HigherCutoff, sizeof(settings.HigherCutoff), key);
+        key = Utils::HashBytes(&settings.FilterOrder, sizeof(settings.FilterOrder), key);
+        key = Utils::HashBytes(&settings.ConvertToHemoglobin, sizeof(settings.ConvertToHemoglobin), key);
+        key = Utils::HashBytes(&settings.DifferentialPathlengthFactor, sizeof(settings.DifferentialPathlengthFactor), key);
+        key = Utils::HashBytes(&settings.FallbackDistance, sizeof(settings.FallbackDistance), key);
+        key = Utils::HashBytes(&SessionCacheVersion, sizeof(SessionCacheVersion), key);
+
+        const uint32_t sampleSize = sizeof(ChannelValue); // float and double builds keep separate caches
+        key = Utils::HashBytes(&sampleSize, sizeof(sampleSize), key);
+        return key;
+    }
+}
+
+using namespace NIRS;
+
+void SNIRF::WriteSessionCache(const SNIRFRun& run, const std::filesystem::path& cachePath, uint64_t key)
+{
+    Timer timer;
+
+    const size_t numSamples = run.Time.size();
+    const size_t numArrays = run.Registry->GetChannelCount();
+    const size_t stride = AlignSessionCacheOffset(numSamples * sizeof(ChannelValue)) / sizeof(ChannelValue);
+
+    std::vector<CachedMeasurement> measurements(run.Measurements.size());
+    for (size_t i = 0; i < run.Measurements.size(); i++) {
+        const auto& m = run.Measurements[i];
+        auto& c = measurements[i];
+        c.SourceIndex = m.SourceIndex;
+        c.DetectorIndex = m.DetectorIndex;
+        c.WavelengthIndex = m.WavelengthIndex;
+        c.DataType = m.DataType;
+        c.DataTypeIndex = m.DataTypeIndex;
+        std::strncpy(c.DataTypeLabel, m.DataTypeLabel.c_str(), sizeof(c.DataTypeLabel) - 1);
+    }
+
+    std::vector<CachedRunName> runs(m_Runs.size());
+    for (size_t i = 0; i < m_Runs.size(); i++) {
+        std::strncpy(runs[i].NirsName, m_Runs[i]->NirsName.c_str(), sizeof(runs[i].NirsName) - 1);
+        std::strncpy(runs[i].DataName, m_Runs[i]->DataName.c_str(), sizeof(runs[i].DataName) - 1);
+    }
+
+    std::vector<CachedStimulus> stimuli(run.Stimuli.size());
+    std::vector<StimulusEvent> events;
+    for (size_t i = 0; i < run.Stimuli.size(); i++) {
+        const auto& stimulus = run.Stimuli[i];
+        std::strncpy(stimuli[i].Name, stimulus.Name.c_str(), sizeof(stimuli[i].Name) - 1);
+        stimuli[i].FirstEvent = static_cast<uint32_t>(events.size());
+        stimuli[i].EventCount = static_cast<uint32_t>(stimulus.Events.size());
+        events.insert(events.end(), stimulus.Events.begin(), stimulus.Events.end());
+    }
+
+    std::vector<CachedAuxChannel> aux(run.Aux.size());
+    for (size_t i = 0; i < run.Aux.size(); i++) {
+        std::strncpy(aux[i].Name, run.Aux[i].Name.c_str(), sizeof(aux[i].Name) - 1);
+        std::strncpy(aux[i].Unit, run.Aux[i].Unit.c_str(), sizeof(aux[i].Unit) - 1);
+        aux[i].DataIndex = run.Aux[i].DataIndex;
+    }
+
+    // The probe members belong to one nirs entry, runs from any other entry are written without it
+    const bool writeProbe = run.NirsName == m_ProbeNirsName;
+
+    SessionCacheHeader header;
+    std::memcpy(header.Magic, SessionCacheMagic, sizeof(header.Magic));
+    header.Version = SessionCacheVersion;
+    header.HeaderSize = sizeof(SessionCacheHeader);
+    header.Key = key;
+    header.SourceModifiedTime = GetSourceModifiedTime(m_Filepath);
+    header.SamplingRate = run.SamplingRate;
+    header.DurationSeconds = run.DurationSeconds;
+    header.NumSamples = numSamples;
+    header.NumDataArrays = numArrays;
+    header.DataArrayStride = stride;
+
+    // Written to a temporary file first so a crash never leaves a half written cache behind
+    auto tempPath = cachePath;
+    tempPath += ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            NVIZ_WARN("Could not write session cache : {}", cachePath.string());
+            return;
+        }
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header)); // Placeholder, rewritten below
+
+        Utils::WriteSection(out, header, CACHE_SOURCES_2D, m_Sources2D.data(), writeProbe ? m_Sources2D.size() : 0);
+        Utils::WriteSection(out, header, CACHE_DETECTORS_2D, m_Detectors2D.data(), writeProbe ? m_Detectors2D.size() : 0);
+        Utils::WriteSection(out, header, CACHE_SOURCES_3D, m_Sources3D.data(), writeProbe ? m_Sources3D.size() : 0);
+        Utils::WriteSection(out, header, CACHE_DETECTORS_3D, m_Detectors3D.data(), writeProbe ? m_Detectors3D.size() : 0);
+        Utils::WriteSection(out, header, CACHE_WAVELENGTHS, m_Wavelengths.data(), writeProbe ? m_Wavelengths.size() : 0);
+        Utils::WriteSection(out, header, CACHE_MEASUREMENTS, measurements.data(), measurements.size());
+        Utils::WriteSection(out, header, CACHE_CHANNELS, run.Channels.data(), run.Channels.size());
+        Utils::WriteSection(out, header, CACHE_TIME, run.Time.data(), run.Time.size());
+        Utils::WriteSection(out, header, CACHE_RUNS, runs.data(), runs.size());
+        Utils::WriteSection(out, header, CACHE_STIMULI, stimuli.data(), stimuli.size());
+        Utils::WriteSection(out, header, CACHE_STIMULUS_EVENTS, events.data(), events.size());
+        Utils::WriteSection(out, header, CACHE_AUX, aux.data(), aux.size());
+
+        // Channel arrays, each one padded to the alignment so they can be used straight from the mapping
+        std::vector<ChannelValue> padding(stride - numSamples, 0);
+        auto writeArrays = [&](SessionCacheSection section, const ChannelDataRegistry& registry) {
+            Utils::WriteSection<ChannelValue>(out, header, section, nullptr, 0);
+            header.Sections[section].Count = numArrays * stride;
+            for (size_t i = 0; i < numArrays; i++) {
+                auto data = registry.GetChannelData(static_cast<int>(i));
+                out.write(reinterpret_cast<const char*>(data.data()), data.size_bytes());
+                out.write(reinterpret_cast<const char*>(padding.data()), padding.size() * sizeof(ChannelValue));
+            }
+        };
+        writeArrays(CACHE_CHANNEL_DATA, *run.Registry);
+        if (run.ProcessedRegistry->GetChannelCount() == numArrays) {
+            writeArrays(CACHE_PROCESSED_DATA, *run.ProcessedRegistry);
+        }
+        else {
+            Utils::WriteSection<ChannelValue>(out, header, CACHE_PROCESSED_DATA, nullptr, 0);
+        }
+
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        if (!out) {
+            NVIZ_WARN("Could not write session cache : {}", cachePath.string());
+            return;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tempPath, cachePath, ec);
+    if (ec) {
+        NVIZ_WARN("Could not write session cache : {} ({})", cachePath.string(), ec.message());
+        std::filesystem::remove(tempPath, ec);
+        return;
+    }
+
+    NVIZ_INFO("Session Cache : wrote {} in {:.2f} ms", cachePath.string(), timer.ElapsedMillis());
+}
+
+bool SNIRF::LoadSessionCache(SNIRFRun& run, const std::filesystem::path& cachePath, uint64_t key, bool loadProbe)
+{
+    if (!std::filesystem::exists(cachePath)) return false;
+
+    Timer timer;
+    auto mapping = CreateRef<MappedFile>(cachePath); // Kept by the registries, the arrays are used in place
+    const MappedFile& file = *mapping;
+    if (!file.IsValid() || file.GetSize() < sizeof(SessionCacheHeader)) return false;
+
+    const auto& header = *file.As<SessionCacheHeader>();
+    if (std::memcmp(header.Magic, SessionCacheMagic, sizeof(header.Magic)) != 0 ||
+        header.Version != SessionCacheVersion ||
+        header.HeaderSize != sizeof(SessionCacheHeader)) {
+        NVIZ_INFO("Session Cache : {} has an old format, ignoring it", cachePath.string());
+        return false;
+    }
+    if (header.Key != key) {
+        NVIZ_INFO("Session Cache : {} is stale, ignoring it", cachePath.string());
+        return false;
+    }
+
+    auto sources2D = Utils::ReadSection<Probe2D>(file, header, CACHE_SOURCES_2D);
+    auto detectors2D = Utils::ReadSection<Probe2D>(file, header, CACHE_DETECTORS_2D);
+    auto sources3D = Utils::ReadSection<Probe3D>(file, header, CACHE_SOURCES_3D);
+    auto detectors3D = Utils::ReadSection<Probe3D>(file, header, CACHE_DETECTORS_3D);
+    auto wavelengths = Utils::ReadSection<int>(file, header, CACHE_WAVELENGTHS);
+    auto measurements = Utils::ReadSection<CachedMeasurement>(file, header, CACHE_MEASUREMENTS);
+    auto channels = Utils::ReadSection<Channel>(file, header, CACHE_CHANNELS);
+    auto time = Utils::ReadSection<double>(file, header, CACHE_TIME);
+    auto channelData = Utils::ReadSection<ChannelValue>(file, header, CACHE_CHANNEL_DATA);
+    auto runs = Utils::ReadSection<CachedRunName>(file, header, CACHE_RUNS);
+    auto processedData = Utils::ReadSection<ChannelValue>(file, header, CACHE_PROCESSED_DATA);
+    auto stimuli = Utils::ReadSection<CachedStimulus>(file, header, CACHE_STIMULI);
+    auto events = Utils::ReadSection<StimulusEvent>(file, header, CACHE_STIMULUS_EVENTS);
+    auto aux = Utils::ReadSection<CachedAuxChannel>(file, header, CACHE_AUX);
+
+    // The arrays are used in place, so every view has to stay inside its own array and the mapping,
+    // and the channel table and the time vector must not point past them
+    const uint64_t arraySamples = header.NumDataArrays * header.DataArrayStride; // Only read once arraysFit holds
+    const bool arraysFit = header.NumSamples <= header.DataArrayStride &&
+        (header.DataArrayStride == 0 || header.NumDataArrays <= std::numeric_limits<uint64_t>::max() / header.DataArrayStride);
+    bool channelsFit = channels != nullptr;
+    for (size_t i = 0; channelsFit && i < header.Sections[CACHE_CHANNELS].Count; i++) {
+        channelsFit = channels[i].HBODataIndex < header.NumDataArrays && channels[i].HBRDataIndex < header.NumDataArrays;
+    }
+
+    if (!sources2D || !detectors2D || !sources3D || !detectors3D || !wavelengths ||
+        !measurements || !channels || !time || !channelData || !runs || header.Sections[CACHE_RUNS].Count == 0 ||
+        !stimuli || !events || !aux ||
+        !arraysFit || header.Sections[CACHE_CHANNEL_DATA].Count < arraySamples ||
+        !channelsFit || header.Sections[CACHE_TIME].Count != header.NumSamples) {
+        NVIZ_WARN("Session Cache : {} is corrupt, ignoring it", cachePath.string());
+        return false;
+    }
+
+    auto sectionCount = [&](SessionCacheSection section) { return static_cast<size_t>(header.Sections[section].Count); };
+    auto runName = [](const CachedRunName& name) {
+        return std::make_pair(std::string(name.NirsName, strnlen(name.NirsName, sizeof(name.NirsName))),
+                              std::string(name.DataName, strnlen(name.DataName, sizeof(name.DataName))));
+    };
+
+    if (loadProbe) {
+        // The session cache also stands in for enumerating the runs of the file
+        std::tie(run.NirsName, run.DataName) = runName(runs[0]);
+        for (size_t i = 1; i < sectionCount(CACHE_RUNS); i++) {
+            auto other = CreateRef<SNIRFRun>();
+            std::tie(other->NirsName, other->DataName) = runName(runs[i]);
+            m_Runs.push_back(other);
+        }
+
+        m_Sources2D.assign(sources2D, sources2D + sectionCount(CACHE_SOURCES_2D));
+        m_Detectors2D.assign(detectors2D, detectors2D + sectionCount(CACHE_DETECTORS_2D));
+        m_Sources3D.assign(sources3D, sources3D + sectionCount(CACHE_SOURCES_3D));
+        m_Detectors3D.assign(detectors3D, detectors3D + sectionCount(CACHE_DETECTORS_3D));
+        for (const auto& probe : m_Sources2D) m_Source2DMap[probe.ID] = probe;
+        for (const auto& probe : m_Detectors2D) m_Detector2DMap[probe.ID] = probe;
+        for (const auto& probe : m_Sources3D) m_Source3DMap[probe.ID] = probe;
+        for (const auto& probe : m_Detectors3D) m_Detector3DMap[probe.ID] = probe;
+
+        m_Wavelengths.assign(wavelengths, wavelengths + sectionCount(CACHE_WAVELENGTHS));
+        m_ProbeNirsName = run.NirsName;
+    }
+
+    run.Measurements.resize(sectionCount(CACHE_MEASUREMENTS));
+    for (size_t i = 0; i < run.Measurements.size(); i++) {
+        const auto& c = measurements[i];
+        auto& m = run.Measurements[i];
+        m.SourceIndex = c.SourceIndex;
+        m.DetectorIndex = c.DetectorIndex;
+        m.WavelengthIndex = c.WavelengthIndex;
+        m.DataType = c.DataType;
+        m.DataTypeIndex = c.DataTypeIndex;
+        m.DataTypeLabel = std::string(c.DataTypeLabel, strnlen(c.DataTypeLabel, sizeof(c.DataTypeLabel)));
+    }
+
+    run.Channels.assign(channels, channels + sectionCount(CACHE_CHANNELS));
+    for (const auto& channel : run.Channels) run.ChannelMap[channel.ID] = channel;
+
+    run.Time.assign(time, time + sectionCount(CACHE_TIME));
+
+    run.Stimuli.resize(sectionCount(CACHE_STIMULI));
+    for (size_t i = 0; i < run.Stimuli.size(); i++) {
+        const auto& c = stimuli[i];
+        auto& stimulus = run.Stimuli[i];
+        stimulus.Name = std::string(c.Name, strnlen(c.Name, sizeof(c.Name)));
+        if (static_cast<size_t>(c.FirstEvent) + c.EventCount <= sectionCount(CACHE_STIMULUS_EVENTS)) {
+            stimulus.Events.assign(events + c.FirstEvent, events + c.FirstEvent + c.EventCount);
+        }
+    }
+    run.Events = EventIndex(run.Stimuli);
+
+    run.Aux.clear();
+    for (size_t i = 0; i < sectionCount(CACHE_AUX); i++) {
+        const auto& c = aux[i];
+        if (c.DataIndex >= header.NumDataArrays) continue;
+        run.Aux.push_back({ std::string(c.Name, strnlen(c.Name, sizeof(c.Name))), std::string(c.Unit, strnlen(c.Unit, sizeof(c.Unit))), c.DataIndex });
+    }
+    run.SamplingRate = header.SamplingRate;
+    run.DurationSeconds = header.DurationSeconds;
+
+    const size_t numSamples = static_cast<size_t>(header.NumSamples);
+    auto readArrays = [&](const ChannelValue* arrays, ChannelDataRegistry& registry) {
+        registry.AdoptChannelData(mapping, arrays, header.NumDataArrays, numSamples, header.DataArrayStride);
+    };
+    readArrays(channelData, *run.Registry);
+
+    // Without it the caller preprocesses again, as after a fresh read
+    if (processedData && sectionCount(CACHE_PROCESSED_DATA) >= arraySamples) {
+        readArrays(processedData, *run.ProcessedRegistry);
+    }
+    run.NumDataColumns = run.Measurements.size();
+    run.LazyLoaded = false;
+    run.LoadedSamples.store(numSamples, std::memory_order_release);
+    run.Loaded.store(true, std::memory_order_release);
+
+    NVIZ_INFO("Session Cache : loaded {} in {:.2f} ms", cachePath.string(), timer.ElapsedMillis());
+    return true;
+}
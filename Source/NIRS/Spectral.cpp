@@ -0,0 +1,220 @@
+#include "pch.h"
+#include "NIRS/Spectral.h"
+
+#include "Core/ThreadPool.h"
+
+namespace Utils {
+
+	constexpr double Pi = 3.14159265358979323846;
+
+	static size_t NextPowerOfTwo(size_t value)
+	{
+		size_t power = 1;
+		while (power < value) power <<= 1;
+		return power;
+	}
+
+	struct SegmentLayout {
+		size_t Length = 0;	// Samples per segment
+		size_t FFTSize = 0;	// Length zero padded to a power of two
+		size_t Step = 0;
+		size_t Count = 0;
+	};
+
+	static SegmentLayout GetSegmentLayout(size_t samples, double sampleRate, const NIRS::SpectralSettings& settings)
+	{
+		SegmentLayout layout;
+		if (samples < 4 || sampleRate <= 0.0) return layout;
+
+		layout.Length = std::clamp<size_t>(static_cast<size_t>(std::round(settings.SegmentSeconds * sampleRate)), 4, samples);
+		layout.FFTSize = NextPowerOfTwo(layout.Length);
+		const size_t overlap = static_cast<size_t>(std::round(std::clamp(settings.Overlap, 0.0f, 0.95f) * layout.Length));
+		layout.Step = std::max<size_t>(1, layout.Length - overlap);
+		layout.Count = (samples - layout.Length) / layout.Step + 1;
+		return layout;
+	}
+
+	// Calls fn(segment, density) with the one-sided, density scaled power of every segment.
+	// The window, padded segment and spectrum live in per-thread buffers.
+	template<typename F>
+	void ForEachSegmentPower(Span<const NIRS::ChannelValue> data, double sampleRate, const SegmentLayout& layout, F&& fn)
+	{
+		auto plan = NIRS::FFTPlanCache::Get(layout.FFTSize);
+		const size_t bins = plan->GetBinCount();
+
+		// Periodic Hann, as scipy's default 'hann' window for spectral estimates
+		thread_local std::vector<double> window;
+		thread_local double windowEnergy = 0.0;
+		if (window.size() != layout.Length) {
+			window.resize(layout.Length);
+			windowEnergy = 0.0;
+			for (size_t i = 0; i < layout.Length; i++) {
+				window[i] = 0.5 - 0.5 * std::cos(2.0 * Pi * i / layout.Length);
+				windowEnergy += window[i] * window[i];
+			}
+		}
+
+		thread_local std::vector<double> segment, power;
+		thread_local std::vector<std::complex<double>> spectrum;
+		segment.assign(layout.FFTSize, 0.0);
+		spectrum.resize(bins);
+		power.resize(bins);
+
+		const double scale = 1.0 / (sampleRate * windowEnergy);
+		for (size_t s = 0; s < layout.Count; s++) {
+			const NIRS::ChannelValue* start = data.data() + s * layout.Step;
+
+			double mean = 0.0;
+			for (size_t i = 0; i < layout.Length; i++) mean += start[i];
+			mean /= layout.Length;
+			for (size_t i = 0; i < layout.Length; i++) segment[i] = (start[i] - mean) * window[i];
+
+			plan->Forward(segment.data(), spectrum.data());
+
+			// Everything but DC and Nyquist also stands for its negative frequency
+			for (size_t k = 0; k < bins; k++) power[k] = std::norm(spectrum[k]) * scale * ((k == 0 || k == bins - 1) ? 1.0 : 2.0);
+			fn(s, power.data());
+		}
+	}
+}
+
+// --- FFT ---
+
+NIRS::FFTPlan::FFTPlan(size_t size)
+	: m_Size(size)
+{
+	NVIZ_ASSERT(size >= 4 && (size & (size - 1)) == 0, "FFT size must be a power of two of at least 4");
+
+	const size_t half = size / 2;
+	size_t bits = 0;
+	while ((size_t(1) << bits) < half) bits++;
+
+	m_BitReverse.resize(half);
+	for (size_t i = 0; i < half; i++) {
+		uint32_t reversed = 0;
+		for (size_t b = 0; b < bits; b++) reversed |= ((i >> b) & 1u) << (bits - 1 - b);
+		m_BitReverse[i] = reversed;
+	}
+
+	m_Twiddles.resize(half / 2);
+	for (size_t k = 0; k < m_Twiddles.size(); k++) m_Twiddles[k] = std::polar(1.0, -2.0 * Utils::Pi * k / half);
+
+	m_Split.resize(half / 2 + 1);
+	for (size_t k = 0; k < m_Split.size(); k++) m_Split[k] = std::polar(1.0, -2.0 * Utils::Pi * k / size);
+}
+
+void NIRS::FFTPlan::Forward(const double* input, std::complex<double>* spectrum) const
+{
+	using Complex = std::complex<double>;
+	const size_t half = m_Size / 2;
+
+	// Even samples as the real part, odd ones as the imaginary part, in bit reversed order
+	for (size_t i = 0; i < half; i++) spectrum[m_BitReverse[i]] = Complex(input[2 * i], input[2 * i + 1]);
+
+	// Iterative radix-2 over the half size
+	for (size_t length = 2; length <= half; length <<= 1) {
+		const size_t span = length / 2;
+		const size_t stride = half / length;
+		for (size_t start = 0; start < half; start += length) {
+			for (size_t j = 0; j < span; j++) {
+				const Complex u = spectrum[start + j];
+				const Complex v = spectrum[start + j + span] * m_Twiddles[j * stride];
+				spectrum[start + j] = u + v;
+				spectrum[start + j + span] = u - v;
+			}
+		}
+	}
+
+	// Split the packed transform into the spectrum of the real input, bins k and half - k together
+	const Complex z0 = spectrum[0];
+	spectrum[0] = Complex(z0.real() + z0.imag(), 0.0);
+	spectrum[half] = Complex(z0.real() - z0.imag(), 0.0);
+
+	for (size_t k = 1; k <= half / 2; k++) {
+		const Complex a = spectrum[k];
+		const Complex b = spectrum[half - k];
+		const Complex even = 0.5 * (a + std::conj(b));
+		const Complex odd = Complex(0.0, -0.5) * (a - std::conj(b));
+		const Complex twiddled = m_Split[k] * odd;
+
+		spectrum[k] = even + twiddled;
+		spectrum[half - k] = std::conj(even - twiddled);
+	}
+}
+
+std::mutex NIRS::FFTPlanCache::s_Mutex;
+std::map<size_t, Ref<const NIRS::FFTPlan>> NIRS::FFTPlanCache::s_Plans;
+
+Ref<const NIRS::FFTPlan> NIRS::FFTPlanCache::Get(size_t size)
+{
+	std::lock_guard<std::mutex> lock(s_Mutex);
+	auto it = s_Plans.find(size);
+	if (it != s_Plans.end()) return it->second;
+
+	auto plan = CreateRef<FFTPlan>(size);
+	s_Plans.emplace(size, plan);
+	return plan;
+}
+
+size_t NIRS::FFTPlanCache::GetSize()
+{
+	std::lock_guard<std::mutex> lock(s_Mutex);
+	return s_Plans.size();
+}
+
+void NIRS::FFTPlanCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(s_Mutex);
+	s_Plans.clear();
+}
+
+// --- Spectra ---
+
+NIRS::PowerSpectrum NIRS::ComputeWelchPSD(Span<const NIRS::ChannelValue> data, double sampleRate, const SpectralSettings& settings)
+{
+	PowerSpectrum spectrum;
+	const auto layout = Utils::GetSegmentLayout(data.size(), sampleRate, settings);
+	if (layout.Count == 0) return spectrum;
+
+	spectrum.FrequencyStep = sampleRate / layout.FFTSize;
+	spectrum.Power.assign(layout.FFTSize / 2 + 1, 0.0);
+
+	Utils::ForEachSegmentPower(data, sampleRate, layout, [&](size_t, const double* power) {
+		for (size_t k = 0; k < spectrum.Power.size(); k++) spectrum.Power[k] += power[k];
+	});
+	for (auto& p : spectrum.Power) p /= layout.Count;
+	return spectrum;
+}
+
+NIRS::Spectrogram NIRS::ComputeSpectrogram(Span<const NIRS::ChannelValue> data, double sampleRate, const SpectralSettings& settings)
+{
+	Spectrogram spectrogram;
+	const auto layout = Utils::GetSegmentLayout(data.size(), sampleRate, settings);
+	if (layout.Count == 0) return spectrogram;
+
+	spectrogram.FrequencyStep = sampleRate / layout.FFTSize;
+	spectrogram.TimeStep = layout.Step / sampleRate;
+	spectrogram.StartTime = 0.5 * layout.Length / sampleRate;
+	spectrogram.Frames = layout.Count;
+	spectrogram.Bins = layout.FFTSize / 2 + 1;
+	spectrogram.Power.resize(spectrogram.Frames * spectrogram.Bins);
+
+	Utils::ForEachSegmentPower(data, sampleRate, layout, [&](size_t segment, const double* power) {
+		float* frame = spectrogram.Power.data() + segment * spectrogram.Bins;
+		for (size_t k = 0; k < spectrogram.Bins; k++) frame[k] = static_cast<float>(power[k]);
+	});
+	return spectrogram;
+}
+
+std::vector<NIRS::PowerSpectrum> NIRS::ComputeWelchPSD(const ChannelDataRegistry& registry, Span<const int> indices,
+	double sampleRate, const SpectralSettings& settings, bool parallel)
+{
+	std::vector<PowerSpectrum> spectra(indices.size());
+	auto compute = [&](size_t i) {
+		spectra[i] = ComputeWelchPSD(registry.GetChannelData(indices[i]), sampleRate, settings);
+	};
+
+	if (parallel) ThreadPool::Instance().ParallelFor(0, indices.size(), compute);
+	else for (size_t i = 0; i < indices.size(); i++) compute(i);
+	return spectra;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "Core/Base.h"
+
+#include <new>
+#include <algorithm>
+#include <type_traits>
+#include <cstring>
+#include <utility>
+
+// Heap array of trivially copyable T whose first element is aligned to 'Alignment' bytes.
+// Used for the sample stores so every channel starts on a cache line / SIMD boundary.
+template<typename T, size_t Alignment = 64>
+class AlignedBuffer {
+public:
+	static_assert(std::is_trivially_copyable_v<T>, "AlignedBuffer only holds trivially copyable types");
+
+	AlignedBuffer() = default;
+	explicit AlignedBuffer(size_t count) { Resize(count); }
+	~AlignedBuffer() { Release(); }
+
+	AlignedBuffer(const AlignedBuffer&) = delete;
+	AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+	AlignedBuffer(AlignedBuffer&& other) noexcept { *this = std::move(other); }
+	AlignedBuffer& operator=(AlignedBuffer&& other) noexcept {
+		if (this != &other) {
+			Release();
+			std::swap(m_Data, other.m_Data);
+			std::swap(m_Size, other.m_Size);
+		}
+		return *this;
+	}
+
+	// Reallocates to exactly 'count' elements, keeping the common prefix and zeroing the rest
+	void Resize(size_t count) {
+		if (count == m_Size) return;
+
+		T* data = count > 0 ? static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(Alignment))) : nullptr;
+		size_t keep = std::min(count, m_Size);
+		if (keep > 0) std::memcpy(data, m_Data, keep * sizeof(T));
+		if (count > keep) std::memset(data + keep, 0, (count - keep) * sizeof(T));
+
+		Release();
+		m_Data = data;
+		m_Size = count;
+	}
+
+	void Release() {
+		if (m_Data) ::operator delete(m_Data, std::align_val_t(Alignment));
+		m_Data = nullptr;
+		m_Size = 0;
+	}
+
+	T* Data() { return m_Data; }
+	const T* Data() const { return m_Data; }
+	size_t Size() const { return m_Size; }
+
+	T& operator[](size_t index) { return m_Data[index]; }
+	const T& operator[](size_t index) const { return m_Data[index]; }
+
+private:
+	T* m_Data = nullptr;
+	size_t m_Size = 0;
+};
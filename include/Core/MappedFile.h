@@ -0,0 +1,33 @@
+#pragma once
+#include "Core/Base.h"
+
+#include <filesystem>
+
+// Read-only memory mapping of a whole file. The mapping lives as long as the object.
+class MappedFile {
+public:
+	MappedFile(const std::filesystem::path& filepath);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool IsValid() const { return m_Data != nullptr; }
+
+	const uint8_t* GetData() const { return m_Data; }
+	size_t GetSize() const { return m_Size; }
+
+	template<typename T>
+	const T* As(size_t offset = 0) const { return reinterpret_cast<const T*>(m_Data + offset); }
+
+private:
+	const uint8_t* m_Data = nullptr;
+	size_t m_Size = 0;
+
+#ifdef _WIN32
+	void* m_FileHandle = nullptr;
+	void* m_MappingHandle = nullptr;
+#else
+	int m_FileDescriptor = -1;
+#endif
+};
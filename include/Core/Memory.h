@@ -0,0 +1,9 @@
+#pragma once
+#include "Core/Base.h"
+
+namespace Memory {
+
+	// Resident set size (working set on Windows) of this process in bytes, 0 if unknown
+	size_t GetProcessResidentBytes();
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "Core/Base.h"
+
+#include <vector>
+#include <type_traits>
+
+// Non-owning view over contiguous elements, a small stand-in for C++20 std::span.
+// The viewed memory must outlive the span.
+template<typename T>
+class Span {
+public:
+	using element_type = T;
+	using value_type = std::remove_cv_t<T>;
+	using iterator = T*;
+
+	Span() = default;
+	Span(T* data, size_t size) : m_Data(data), m_Size(size) {}
+
+	template<typename U, typename = std::enable_if_t<std::is_convertible_v<U(*)[], T(*)[]>>>
+	Span(const Span<U>& other) : m_Data(other.data()), m_Size(other.size()) {}
+
+	template<typename A, typename U = T, typename = std::enable_if_t<std::is_const_v<U>>>
+	Span(const std::vector<value_type, A>& vector) : m_Data(vector.data()), m_Size(vector.size()) {}
+
+	template<typename A>
+	Span(std::vector<value_type, A>& vector) : m_Data(vector.data()), m_Size(vector.size()) {}
+
+	T* data() const { return m_Data; }
+	size_t size() const { return m_Size; }
+	size_t size_bytes() const { return m_Size * sizeof(T); }
+	bool empty() const { return m_Size == 0; }
+
+	T& operator[](size_t index) const { return m_Data[index]; }
+	T& front() const { return m_Data[0]; }
+	T& back() const { return m_Data[m_Size - 1]; }
+
+	iterator begin() const { return m_Data; }
+	iterator end() const { return m_Data + m_Size; }
+
+	Span first(size_t count) const { return { m_Data, count }; }
+	Span subspan(size_t offset, size_t count) const { return { m_Data + offset, count }; }
+
+private:
+	T* m_Data = nullptr;
+	size_t m_Size = 0;
+};
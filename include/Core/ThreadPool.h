@@ -0,0 +1,76 @@
+#pragma once
+#include "Core/Base.h"
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <atomic>
+
+// Fixed set of worker threads shared by the whole application.
+// A thread waiting in ParallelFor runs that ParallelFor's own queued tasks while it waits,
+// so nested parallel sections cannot starve the pool. It never picks up unrelated work,
+// a ParallelFor on the main thread is not held up by a long job someone else submitted.
+class ThreadPool {
+public:
+	static ThreadPool& Instance() {
+		static ThreadPool instance;
+		return instance;
+	}
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	~ThreadPool();
+
+	size_t GetWorkerCount() const { return m_Workers.size(); }
+
+	template<typename F>
+	auto Submit(F&& task) -> std::future<decltype(task())> {
+		return SubmitToGroup(std::forward<F>(task), nullptr);
+	}
+
+	// Calls fn(i) for every i in [begin, end) across the pool and the calling thread.
+	// Indices are handed out in blocks of 'grain' to keep the scheduling overhead low.
+	// If fn throws, no further blocks are started and the first exception is rethrown
+	// once every helper has finished.
+	void ParallelFor(size_t begin, size_t end, const std::function<void(size_t)>& fn, size_t grain = 1);
+
+private:
+	ThreadPool();
+
+	// Tasks of one ParallelFor share a group, the ones from Submit have none
+	struct Task {
+		std::function<void()> Function;
+		const void* Group = nullptr;
+	};
+
+	template<typename F>
+	auto SubmitToGroup(F&& task, const void* group) -> std::future<decltype(task())> {
+		using R = decltype(task());
+		auto packaged = std::make_shared<std::packaged_task<R()>>(std::forward<F>(task));
+		std::future<R> future = packaged->get_future();
+		Enqueue([packaged]() { (*packaged)(); }, group);
+		return future;
+	}
+
+	// Blocks until 'future' is ready, running queued tasks of 'group' in the meantime
+	template<typename T>
+	void Wait(std::future<T>& future, const void* group) {
+		while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			if (!RunPendingTask(group)) future.wait_for(std::chrono::microseconds(100));
+		}
+	}
+
+	void Enqueue(std::function<void()> task, const void* group);
+	bool RunPendingTask(const void* group);
+	void WorkerLoop();
+
+	std::vector<std::thread> m_Workers;
+	std::deque<Task> m_Tasks;
+	std::mutex m_Mutex;
+	std::condition_variable m_Condition;
+	bool m_Stopping = false;
+};
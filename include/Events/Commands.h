@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Core/Base.h"
+#include "NIRS/Precision.h"
 
 
 // EventBus is a singleton class that manages event subscriptions and publishing.
@@ -14,6 +15,14 @@ struct ExitApplicationCommand {
 struct OnSNIRFLoaded {
 };
 
+// Queued from the SNIRF loading thread, see FileLayer::LoadSNIRFFileAsync
+struct OnSNIRFLoadProgress {
+	std::string Filepath;
+	size_t LoadedSamples = 0;
+	size_t TotalSamples = 0;
+	bool Finished = false;
+};
+
 struct HeadAnatomyLoadedEvent {
 
 };
@@ -42,13 +51,17 @@ struct OnChannelIntersectionsUpdated {
 
 namespace NIRS {
 	using ChannelID = uint32_t;
-	using ChannelValue = double;
 }
 struct OnChannelValuesUpdated {
 	std::map<NIRS::ChannelID, NIRS::ChannelValue> HBOValues;
 	std::map<NIRS::ChannelID, NIRS::ChannelValue> HBRValues;
 };
 
+// A channel of the loading SNIRF file is fully read and preprocessed
+struct OnSNIRFChannelReady {
+	NIRS::ChannelID ChannelID = 0;
+};
+
 struct OnChannelsSelected {
 	std::vector<uint32_t> selectedIDs;
 };
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <typeindex>
 #include <memory>
 #include <mutex>
+#include <vector>
 
 class EventBus {
 private:
@@ -22,6 +23,10 @@ private:
 	std::map<std::type_index, std::unique_ptr<IEventHandler>> handlers;
 	std::mutex busMutex; // Thread safety is important for a central bus
 
+	// Events posted from other threads, published on the main thread by DispatchQueued()
+	std::vector<std::function<void()>> queuedEvents;
+	std::mutex queueMutex;
+
 public:
 public:
 	// ------------------- Singleton Access -------------------
@@ -60,21 +65,47 @@ public:
 
 	template<typename T>
 	void Publish(const T& event) {
-		// Lock only to ensure that the handler list isn't modified while we're reading it
-		// A smarter approach would use a Read-Write lock, but a simple mutex is fine here.
-		std::lock_guard<std::mutex> lock(busMutex);
-		std::type_index typeIndex = typeid(T);
-
-		// Check if any listeners exist for this event type
-		if (handlers.find(typeIndex) != handlers.end()) {	
-			// Get the concrete handler and iterate over its listeners
-			auto handler = static_cast<EventHandler<T>*>(handlers[typeIndex].get());
+		// Lock only to ensure that the handler list isn't modified while we're reading it.
+		// The listeners are copied out so a listener can publish or subscribe itself.
+		std::vector<std::function<void(const T&)>> listeners;
+		{
+			std::lock_guard<std::mutex> lock(busMutex);
+			std::type_index typeIndex = typeid(T);
 
-			// Dispatch the event to all listeners
-			for (const auto& listener : handler->listeners) {
-				listener(event); // Call the listener function
+			// Check if any listeners exist for this event type
+			if (handlers.find(typeIndex) != handlers.end()) {
+				listeners = static_cast<EventHandler<T>*>(handlers[typeIndex].get())->listeners;
 			}
 		}
+
+		// Dispatch the event to all listeners
+		for (const auto& listener : listeners) {
+			listener(event); // Call the listener function
+		}
+	}
+
+	// ------------------- Deferred Publishing -------------------
+	/**
+	 * @brief Queues an event to be published on the main thread.
+	 * Use this from worker threads, listeners touch layers and GL state that are not thread-safe.
+	 */
+	template<typename T>
+	void Enqueue(const T& event) {
+		std::lock_guard<std::mutex> lock(queueMutex);
+		queuedEvents.push_back([this, event]() { Publish<T>(event); });
+	}
+
+	// Publishes every queued event in the order it was queued. Called once per frame by the Application.
+	void DispatchQueued() {
+		std::vector<std::function<void()>> events;
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			events.swap(queuedEvents);
+		}
+
+		for (const auto& publish : events) {
+			publish();
+		}
 	}
 };
 
@@ -0,0 +1,51 @@
+#pragma once
+#include "Core/Base.h"
+
+#include <filesystem>
+
+// In-app benchmarks, started from the Data > Benchmarks menu. Results go to the log.
+namespace NIRS::Benchmark {
+
+	// Submits synthetic channels (half of them duplicates) to a fresh ChannelDataRegistry
+	// with and without deduplication, and times the content hash against the old per-sample hash.
+	void ChannelSubmission(size_t channels = 128, size_t samples = 1 << 17, int repeats = 3);
+
+	// Loads 'snirfPath' (if given) without the session cache in this build's storage precision,
+	// then compares float and double stores on synthetic data: fill time, RSS and the throughput of
+	// the preprocessing bandpass (SOSFilterBank lanes) over each store.
+	void StoragePrecision(const std::filesystem::path& snirfPath = {}, size_t channels = 128, size_t samples = 1 << 17, int repeats = 3);
+
+	// Reads the measurement table of the first run of 'snirfPath' three ways: the compact
+	// SNIRF v1.1 'measurementLists' table (when the file has one), the measurementListN
+	// groups as ParseMeasurementLists falls back to, and the old six reads per group.
+	void MeasurementTable(const std::filesystem::path& snirfPath, int repeats = 5);
+
+	// Bandpass over synthetic channels with the scalar SOSFilter, the 4 and 8 lane
+	// SOSFilterBank and the old transfer function IIRFilter. Logs samples per second
+	// and the largest difference between the lane and scalar outputs.
+	void FilterThroughput(size_t channels = 64, size_t samples = 1 << 16, int repeats = 3);
+
+	// Load-time preprocessing (optical density and bandpass) of synthetic channels,
+	// serially and across the ThreadPool, into a registry like SNIRFRun::ProcessedRegistry
+	void Preprocessing(size_t channels = 128, size_t samples = 1 << 16, int repeats = 3);
+
+	// TDDR over 'hours' of synthetic 10 Hz channels with baseline shifts and spikes, serially
+	// and across the ThreadPool. Logs how much faster than real time it runs and the largest
+	// sample-to-sample jump before and after the correction.
+	void MotionCorrection(size_t channels = 64, double hours = 2.0, int repeats = 3);
+
+	// Decimation of 'hours' of synthetic 50 Hz channels to 10 Hz with ResamplePolyphase, serially
+	// and across the ThreadPool, then the bandpass at both rates to show what the stages
+	// below a Resample stage save
+	void Resampling(size_t channels = 64, double hours = 1.0, int repeats = 3);
+
+	// Block average of 'trials' events over three conditions in 'hours' of synthetic 10 Hz
+	// HbO and HbR arrays, serially and across the ThreadPool, with the default epoch settings
+	void BlockAveraging(size_t channels = 100, double hours = 2.0, size_t trials = 300, int repeats = 3);
+
+	// The per-frame work of the time series plot for 'plotted' channels of a 'hours' long
+	// recording, fully zoomed out: copying the time axis, the channel map and every array
+	// as the plot used to, reading the stored arrays through views, and drawing through the
+	// min/max pyramids at 'width' pixels. ImPlot itself is replaced by a sum over the points.
+	void PlotFrame(size_t channels = 100, double hours = 2.0, size_t plotted = 16, size_t width = 1600, int frames = 100, int repeats = 3);
+}
@@ -0,0 +1,156 @@
+#pragma once
+#include "Core/Base.h"
+#include "Core/Span.h"
+#include "Core/AlignedBuffer.h"
+#include "NIRS/Precision.h"
+
+#include <vector>
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+// Channel-major sample store. Every channel lives in one contiguous, 64-byte aligned buffer
+// and starts on an aligned offset, readers get non-owning views instead of copies.
+// Views stay valid until the next Allocate/Submit/Register/Reserve/Clear call, so allocate
+// everything up front (Reserve) before handing views out. Views of lazy channels are the
+// exception, they share ownership of the slot they were loaded into.
+class ChannelDataRegistry {
+public:
+	using Sample = NIRS::ChannelValue;
+
+	// Span over the samples of one channel. For a lazy channel it also holds a reference to
+	// its slot: evicting the channel while a view is alive gives the slot a new buffer rather
+	// than overwriting this one. Copy it around as a ChannelView, a plain Span does not pin.
+	class ChannelView : public Span<const Sample> {
+	public:
+		ChannelView() = default;
+		ChannelView(const Sample* data, size_t size, std::shared_ptr<const void> owner = nullptr)
+			: Span<const Sample>(data, size), m_Owner(std::move(owner)) {}
+
+	private:
+		std::shared_ptr<const void> m_Owner;
+	};
+	using MutableChannelView = Span<Sample>;
+	// Fills 'out' (already sized to the channel length) with the samples of a lazy channel.
+	using ChannelLoader = std::function<void(int index, MutableChannelView out)>;
+
+	static constexpr size_t Alignment = 64;
+	static constexpr size_t AlignedLength(size_t length) {
+		constexpr size_t perLine = Alignment / sizeof(Sample);
+		return (length + perLine - 1) / perLine * perLine;
+	}
+
+	ChannelDataRegistry() {
+	};
+
+	// Grows the buffer once for 'channels' channels of 'length' samples
+	void Reserve(size_t channels, size_t length);
+
+	// Reserves zero-initialised storage for a channel so it can be filled in place,
+	// e.g. by the chunked SNIRF reader. Allocated channels are not deduplicated.
+	int AllocateChannelData(size_t length);
+
+	// Copies the samples in. With deduplication on, identical content (byte for byte)
+	// returns the index of the channel that was submitted first.
+	int SubmitChannelData(Span<const Sample> data);
+
+	// Adds 'count' read-only channels of 'length' samples that stay where they are, channel i
+	// starting at data + i * stride, e.g. the arrays of a memory mapped session cache.
+	// The registry holds 'owner' until it is cleared. Returns the index of the first one.
+	int AdoptChannelData(Ref<const void> owner, const Sample* data, size_t count, size_t length, size_t stride);
+
+	// Deduplication costs one hash pass over every submitted channel, turn it off
+	// when the data is known to be unique (e.g. straight from a file).
+	void SetDeduplication(bool enabled) { m_Deduplicate = enabled; }
+	bool IsDeduplicating() const { return m_Deduplicate; }
+
+	// Registers a channel whose samples are only fetched through the loader the first
+	// time they are requested. Lazy channels are kept in an LRU cache bounded by the cache budget.
+	int RegisterLazyChannel(size_t length);
+
+	void SetChannelLoader(const ChannelLoader& loader);
+	void SetCacheBudget(size_t bytes);
+	size_t GetCacheBudget() const { return m_CacheBudgetBytes; }
+
+	// Lazy channels are loaded on demand, and their views keep the samples however many
+	// other channels are requested while they are alive (see ChannelView).
+	ChannelView GetChannelData(int index) const;
+	MutableChannelView GetMutableChannelData(int index);
+
+	// Time-major copy of the store, GetTimepoint(t)[i] is sample t of channel i.
+	// Built on first use, only available when every channel is resident and equally long.
+	// Writers going through mutable views from another thread call InvalidateTimeMajorView when done.
+	ChannelView GetTimepoint(size_t sample) const;
+	void InvalidateTimeMajorView();
+
+	bool IsChannelResident(int index) const;
+	size_t GetChannelLength(int index) const;
+	size_t GetChannelCount() const { return m_Entries.size(); }
+	size_t GetResidentBytes() const; // Adopted channels are not counted, their memory belongs to the owner
+
+	void Clear();
+
+private:
+	struct ChannelEntry {
+		size_t Length = 0;
+		size_t Offset = 0;	// In m_Storage, unused for lazy and adopted channels
+		bool Lazy = false;
+		int Slot = -1;		// Lazy channels only, -1 when not resident
+		bool Loading = false; // Lazy channels only, a thread is reading it with the lock released
+		const Sample* External = nullptr; // Adopted channels only
+	};
+
+	AlignedBuffer<Sample> m_Storage;
+	size_t m_StorageUsed = 0;
+	mutable std::vector<ChannelEntry> m_Entries; // Mutable because lazy channels move in and out of slots from the const accessors
+
+	// Content hash -> every submitted channel with that hash, collisions are resolved by comparing the bytes.
+	std::unordered_multimap<uint64_t, int> m_LookupMap;
+	bool m_Deduplicate = true;
+
+	std::vector<Ref<const void>> m_Owners; // Keep the memory of adopted channels alive
+
+	// --- Lazy channels ---
+	// Resident lazy channels share a fixed pool of slots sized from the cache budget.
+	// Each slot has its own buffer, allocated on first use and replaced when a view still holds it.
+	ChannelLoader m_Loader = nullptr;
+	size_t m_CacheBudgetBytes = 256ull * 1024ull * 1024ull;
+	size_t m_LazyChannelCount = 0;
+	size_t m_MaxLazyLength = 0;
+
+	mutable std::vector<std::shared_ptr<AlignedBuffer<Sample>>> m_LazySlots;
+	mutable size_t m_LazySlotStride = 0;
+	mutable std::vector<int> m_FreeSlots;
+
+	// Most recently used lazy channel at the front.
+	mutable std::list<int> m_LRU;
+	mutable std::unordered_map<int, std::list<int>::iterator> m_LRULookup;
+	mutable size_t m_LazyResidentBytes = 0;
+
+	// Loads run without the lock, the loader takes the HDF5 lock which the SNIRF reader holds
+	// while it allocates in here. Bumped whenever the slots are released, a load that finishes
+	// after that hands its samples to the caller without publishing them.
+	mutable uint64_t m_LazyGeneration = 0;
+	mutable std::condition_variable m_LoadCondition;
+
+	// --- Time-major view ---
+	mutable AlignedBuffer<Sample> m_TimeMajor;
+	mutable bool m_TimeMajorValid = false;
+
+	mutable std::mutex m_Mutex;
+
+	size_t AppendStorage(size_t length);
+	void ValidateIndex(int index) const;
+	ChannelView GetLazyChannelData(int index, std::unique_lock<std::mutex>& lock) const;
+	ChannelView LoadLazyChannel(int index, std::unique_lock<std::mutex>& lock) const;
+	void TouchLazyChannel(int index) const;
+	void EvictLazyChannel(int index) const;
+	void EvictLazyChannels() const;
+	void ReleaseLazySlots() const;
+	bool BuildTimeMajorView() const;
+
+	uint64_t HashChannelData(Span<const Sample> data) const;
+};
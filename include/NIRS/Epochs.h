@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Core/Base.h"
+#include "Core/Span.h"
+#include "NIRS/EventIndex.h"
+#include "NIRS/ChannelDataRegistry.h"
+
+#include <Eigen/Core>
+
+namespace NIRS
+{
+	struct EpochSettings {
+		float PreStimulus = 5.0f;		// Seconds kept before each onset, also the baseline
+		float PostStimulus = 20.0f;		// Seconds kept after each onset
+		bool BaselineCorrect = true;	// Subtract each epoch's mean over its pre-stimulus samples
+	};
+
+	// Where the epochs of one condition lie in arrays sharing a time base. The same offsets hold
+	// for every array, an epoch is the view at array + Starts[epoch] and nothing is copied.
+	// Onsets are not evenly spaced, so the offsets take the place of a single stride.
+	struct EpochLayout {
+		size_t PreSamples = 0;			// Samples before the onset sample
+		size_t Length = 0;				// Samples per epoch, the onset sample included
+		std::vector<size_t> Starts = {};
+
+		size_t GetEpochCount() const { return Starts.size(); }
+
+		template<typename T>
+		Span<T> GetEpoch(Span<T> array, size_t epoch) const { return array.subspan(Starts[epoch], Length); }
+	};
+
+	// Epochs around the onsets of 'events' in arrays of 'sampleCount' samples starting at 'startTime'.
+	// Epochs that do not fit inside the data are left out.
+	EpochLayout GetEpochLayout(Span<const IndexedEvent> events, double startTime, double sampleRate, size_t sampleCount, const EpochSettings& settings = {});
+
+	struct BlockAverage {
+		std::vector<std::string> Conditions = {};
+		std::vector<size_t> EpochCounts = {};		// Per condition
+		double StartTime = 0.0;		// Of the first sample, relative to the onset
+		double SampleRate = 0.0;
+		size_t Length = 0;			// Samples per epoch
+		std::vector<Eigen::MatrixXd> Mean = {};				// Per condition, samples x arrays, arrays indexed like the registry
+		std::vector<Eigen::MatrixXd> StandardError = {};	// Of the mean, zero with fewer than two epochs
+	};
+
+	// Averages the epochs of every condition of 'events' in every array of 'registry', each
+	// epoch baseline corrected on the way. The layouts are computed once and shared, arrays
+	// are spread across the ThreadPool and every array writes only its own columns.
+	// Lazy registries are read serially, pass 'parallel' as false for them.
+	BlockAverage ComputeBlockAverage(const EventIndex& events, const ChannelDataRegistry& registry, double startTime, double sampleRate,
+		size_t sampleCount, const EpochSettings& settings = {}, bool parallel = true);
+}
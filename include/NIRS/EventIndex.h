@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Core/Base.h"
+#include "Core/Span.h"
+#include "NIRS/NIRS.h"
+
+namespace NIRS
+{
+	// A stimulus event tagged with the condition it belongs to, an index into the stimuli
+	struct IndexedEvent {
+		double Onset = 0.0;
+		double Duration = 0.0;
+		double Amplitude = 1.0;
+		uint32_t Condition = 0;
+	};
+
+	// The events of every condition sorted by onset, once together and once per condition,
+	// so the events inside a time window are two binary searches away whatever the event count.
+	// Built once per run, read by the plot every frame and by epoching and the GLM.
+	class EventIndex {
+	public:
+		EventIndex() = default;
+		EventIndex(const std::vector<Stimulus>& stimuli);
+
+		size_t GetEventCount() const { return m_Events.size(); }
+		size_t GetConditionCount() const { return m_ConditionEvents.size(); }
+		const std::string& GetConditionName(size_t condition) const { return m_ConditionNames[condition]; }
+		bool IsEmpty() const { return m_Events.empty(); }
+
+		// Longest duration of any event, GetEventsInWindow(start - longest, end) holds every
+		// event that overlaps [start, end) rather than only those starting inside it
+		double GetLongestDuration() const { return m_LongestDuration; }
+
+		// Sorted by onset, events with the same onset in condition order
+		Span<const IndexedEvent> GetEvents() const { return m_Events; }
+		Span<const IndexedEvent> GetEvents(size_t condition) const;
+
+		// Events with an onset in [start, end), O(log n)
+		Span<const IndexedEvent> GetEventsInWindow(double start, double end) const;
+		Span<const IndexedEvent> GetEventsInWindow(size_t condition, double start, double end) const;
+
+	private:
+		std::vector<IndexedEvent> m_Events = {};
+		std::vector<std::vector<IndexedEvent>> m_ConditionEvents = {};
+		std::vector<std::string> m_ConditionNames = {};
+		double m_LongestDuration = 0.0;
+	};
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "Core/Base.h"
+#include "Core/Span.h"
+#include "Core/AlignedBuffer.h"
+
+#include <complex>
+#include <tuple>
+#include <map>
+#include <mutex>
+
+#include <Eigen/Core>
+
+namespace NIRS
+{
+	enum class FilterBand {
+		Lowpass = 0,
+		Highpass,
+		Bandpass,
+		Bandstop
+	};
+
+	// One second-order section, normalised so a0 == 1:
+	// y[n] = B0 x[n] + B1 x[n-1] + B2 x[n-2] - A1 y[n-1] - A2 y[n-2]
+	// A first-order section has B2 == A2 == 0.
+	struct BiquadSection {
+		double B0 = 1.0, B1 = 0.0, B2 = 0.0;
+		double A1 = 0.0, A2 = 0.0;
+	};
+
+	struct FilterDesign {
+		FilterBand Band = FilterBand::Bandpass;
+		int Order = 0;
+		double SampleRate = 0.0;
+		double LowCutoff = 0.0;		// Hz, unused by Lowpass
+		double HighCutoff = 0.0;	// Hz, unused by Highpass
+		std::vector<BiquadSection> Sections;
+
+		// Per-section state after a long run of ones, scipy's sosfilt_zi. Scaled by
+		// the first input it starts the cascade without a step transient.
+		std::vector<std::array<double, 2>> InitialState;
+
+		// |H| at 'frequency' Hz, mostly useful to check a design
+		double GetMagnitudeResponse(double frequency) const;
+	};
+
+	struct FilterDesignKey {
+		FilterBand Band;
+		int Order;
+		double SampleRate;
+		double LowCutoff;
+		double HighCutoff;
+
+		bool operator<(const FilterDesignKey& other) const {
+			return std::tie(Band, Order, SampleRate, LowCutoff, HighCutoff)
+				< std::tie(other.Band, other.Order, other.SampleRate, other.LowCutoff, other.HighCutoff);
+		}
+	};
+
+	// Digital Butterworth design as second-order sections, the same design as
+	// scipy.signal.butter(order, cutoffs, btype, fs=sampleRate, output='sos'):
+	// analog prototype, band transform at the prewarped cutoffs, bilinear transform,
+	// then poles paired with their nearest zeros. Bandpass and bandstop designs
+	// have 'order' sections, lowpass and highpass (order + 1) / 2.
+	// Invalid parameters (cutoffs outside (0, fs/2), order < 1) return an empty design.
+	FilterDesign DesignButterworth(FilterBand band, int order, double sampleRate, double lowCutoff, double highCutoff);
+
+	// Edge padding sosfiltfilt uses by default, 3 * (2 * sections + 1) less one per
+	// first-order section, clamped so the odd extension fits inside 'length' samples
+	size_t GetFiltFiltPadLength(const FilterDesign& design, size_t length);
+
+	// Values of scratch FiltFilt needs for 'design', whatever the data length
+	size_t GetFiltFiltScratchSize(const FilterDesign& design);
+
+	// Zero-phase filtering in place, as scipy.signal.sosfiltfilt(sos, data) with padtype='odd'.
+	// The odd extension is generated on the fly rather than copied, and only the filtered
+	// right padding is kept, in 'scratch' along with the cascade state. Nothing is allocated.
+	void FiltFilt(const FilterDesign& design, Span<double> data, Span<double> scratch);
+
+	// Anti-aliasing FIR of a rational resampler by Up / Down, split into its Up phases.
+	// Output sample m is the dot product of one phase with TapsPerPhase consecutive inputs.
+	struct PolyphaseFilter {
+		int Up = 1;
+		int Down = 1;
+		int HalfLength = 0;		// Delay of the prototype filter, in upsampled samples
+		int TapsPerPhase = 0;
+		std::vector<double> Phases; // Phases[phase * TapsPerPhase + tap], taps in time order of the inputs
+	};
+
+	// The filter scipy.signal.resample_poly(x, up, down) designs: a Kaiser (beta 5) windowed
+	// sinc of 20 * max(up, down) + 1 taps, cut off at the lower of both Nyquist rates, with
+	// every phase normalised to unit DC gain. The ratio is reduced first, an invalid one
+	// gives an empty filter.
+	PolyphaseFilter DesignPolyphaseFilter(int up, int down);
+
+	// Designs are shared between every channel and file with the same parameters,
+	// so the design cost is paid once per (band, order, fs, cutoffs) or resampling ratio.
+	class FilterDesignCache {
+	public:
+		static Ref<const FilterDesign> GetButterworth(FilterBand band, int order, double sampleRate, double lowCutoff, double highCutoff);
+		static Ref<const PolyphaseFilter> GetPolyphase(int up, int down);
+
+		static size_t GetSize();
+		static void Clear();
+
+	private:
+		static std::mutex s_Mutex;
+		static std::map<FilterDesignKey, Ref<const FilterDesign>> s_Designs;
+		static std::map<std::pair<int, int>, Ref<const PolyphaseFilter>> s_PolyphaseFilters;
+	};
+
+	// Direct form II transposed cascade of a design's sections, one sample at a time
+	class SOSFilter {
+	public:
+		SOSFilter(const Ref<const FilterDesign>& design);
+
+		double Process(double x);
+		void Reset();
+
+	private:
+		Ref<const FilterDesign> m_Design;
+		std::vector<std::array<double, 2>> m_State;
+	};
+
+	// Channels filtered together by default: one AVX register of doubles, two with AVX-512
+#ifdef __AVX512F__
+	constexpr int DefaultFilterLanes = 8;
+#else
+	constexpr int DefaultFilterLanes = 4;
+#endif
+
+	// The same cascade run over 'Lanes' channels at once, one channel per SIMD lane.
+	// Works on channel-interleaved blocks, block[sample * Lanes + lane], and gives the
+	// same results as SOSFilter on each lane up to rounding.
+	template<int Lanes>
+	class SOSFilterBank {
+	public:
+		using Lane = Eigen::Array<double, Lanes, 1>;
+
+		SOSFilterBank(const Ref<const FilterDesign>& design);
+
+		// Filters 'samples' interleaved frames of 'block' in place
+		void Process(double* block, size_t samples);
+		void Reset();
+		// Steady state for a constant input of frame[lane] on every lane, as FiltFilt starts
+		void SetInitialState(const double* frame);
+
+	private:
+		Ref<const FilterDesign> m_Design;
+		AlignedBuffer<double> m_State; // Two lanes per section
+	};
+
+	// Runs 'design' forward over every channel in place, Lanes channels at a time.
+	// Each run of BlockSamples is interleaved into a small buffer, filtered and written back,
+	// so the interleaved copy stays in L1 whatever the channel length.
+	template<int Lanes = DefaultFilterLanes>
+	void FilterChannels(const Ref<const FilterDesign>& design, Span<double* const> channels, size_t samples);
+
+	// FiltFilt over every channel in place, Lanes channels at a time: same padding and
+	// initial states, same results up to rounding. All channels hold 'samples' samples.
+	// The block and right padding buffers are kept per thread, nothing is allocated once
+	// the calling thread has filtered with a design of the same order.
+	template<int Lanes = DefaultFilterLanes>
+	void FiltFiltChannels(const Ref<const FilterDesign>& design, Span<double* const> channels, size_t samples);
+}
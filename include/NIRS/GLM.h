@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Core/Base.h"
+#include "Core/Span.h"
+#include "NIRS/NIRS.h"
+#include "NIRS/ChannelDataRegistry.h"
+
+#include <Eigen/Core>
+
+namespace NIRS
+{
+	struct GLMSettings {
+		float HRFLength = 32.0f;	// Seconds of the canonical HRF kernel
+		int DriftOrder = 3;			// Polynomial drift regressors on top of the constant
+		bool Prewhiten = true;		// AR(1), one coefficient pooled over every array
+	};
+
+	// SPM's canonical HRF: a gamma density peaking at 5 s minus a sixth of one peaking
+	// at 15 s, sampled at 'sampleRate' over 'length' seconds and scaled to a unit sum
+	std::vector<double> ComputeCanonicalHRF(double sampleRate, double length = 32.0);
+
+	struct GLMDesign {
+		Eigen::MatrixXd Matrix;					// Samples x regressors
+		std::vector<std::string> Regressors = {};
+		size_t ConditionCount = 0;				// Leading columns, one per stimulus with events in the data
+	};
+
+	// One column per stimulus: its events as boxcars (an impulse for zero durations) scaled by
+	// their amplitude, convolved with the canonical HRF. Then Legendre polynomial drifts up to
+	// DriftOrder, the constant first. Stimuli without an event inside 'time' are left out.
+	GLMDesign BuildGLMDesign(const std::vector<Stimulus>& stimuli, Span<const double> time, double sampleRate, const GLMSettings& settings = {});
+
+	struct GLMResult {
+		std::vector<std::string> Regressors = {};
+		size_t ConditionCount = 0;
+		Eigen::MatrixXd Betas;			// Regressors x arrays, arrays indexed like the registry
+		Eigen::MatrixXd TValues;		// Regressors x arrays, 0 for regressors a rank deficient design cannot separate
+		double AutoCorrelation = 0.0;	// AR(1) coefficient the fit was whitened with, 0 without prewhitening
+		size_t DegreesOfFreedom = 0;
+	};
+
+	// Fits every array of 'registry' against 'design' at once. The design is factorized a single
+	// time (a second time once whitened) and that QR solves all arrays, blocks of them across the
+	// ThreadPool. Prewhitening estimates one AR(1) coefficient from the ordinary least squares
+	// residuals of all arrays, so every array shares the whitened design and its factorization.
+	// Lazy registries are read serially, pass 'parallel' as false for them.
+	GLMResult FitGLM(const GLMDesign& design, const ChannelDataRegistry& registry, const GLMSettings& settings = {}, bool parallel = true);
+}
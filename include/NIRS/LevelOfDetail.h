@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Core/Base.h"
+#include "Core/Span.h"
+#include "NIRS/Precision.h"
+#include "NIRS/ChannelDataRegistry.h"
+
+namespace NIRS
+{
+	// Samples to draw for part of an array, evenly spaced: value i sits at sample FirstSample + i * SampleStep
+	struct DecimatedRange {
+		Span<const ChannelValue> Values;
+		double FirstSample = 0.0;
+		double SampleStep = 1.0;
+	};
+
+	// Min/max decimation pyramid of one array. Level 0 keeps the smallest and the largest of
+	// every BaseBucket samples, each level above merges two buckets of the one below.
+	// Drawn at no more than one bucket per pixel column, the line through every minimum and
+	// maximum fills the same envelope as the full array would. About as large as the array.
+	class MinMaxPyramid {
+	public:
+		static constexpr size_t BaseBucket = 4;
+
+		MinMaxPyramid() = default;
+		MinMaxPyramid(Span<const ChannelValue> samples);
+
+		size_t GetLevelCount() const { return m_Levels.size(); }
+		size_t GetSampleCount() const { return m_SampleCount; }
+		size_t GetMemoryBytes() const;
+
+		// Samples [first, last) of 'samples' (the array the pyramid was built from) as at most
+		// about 2 * 'width' values. Raw samples when few enough are visible, otherwise the finest
+		// level with no more than 'width' buckets across the range. One value of margin on each
+		// side keeps the line running up to the edges.
+		DecimatedRange GetRange(Span<const ChannelValue> samples, size_t first, size_t last, size_t width) const;
+
+	private:
+		size_t m_SampleCount = 0;
+		std::vector<std::vector<ChannelValue>> m_Levels = {}; // Pairs of extremes, two values per bucket
+	};
+
+	// One pyramid per array of 'registry', over its first 'sampleCount' samples, built across the ThreadPool.
+	// Lazy registries are read serially, pass 'parallel' as false for them.
+	std::vector<MinMaxPyramid> BuildMinMaxPyramids(const ChannelDataRegistry& registry, size_t sampleCount, bool parallel = true);
+}
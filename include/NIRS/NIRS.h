@@ -8,6 +8,8 @@
 #include <algorithm> // For std::transform (optional, but good for case insensitivity)
 #include <map>
 
+#include "NIRS/Precision.h"
+
 namespace NIRS {
 
     
@@ -19,7 +21,7 @@ namespace NIRS {
     using ProbeID = uint32_t;
 	using ChannelID = uint32_t;
     using ChannelDataID = uint32_t;
-    using ChannelValue = double;
+    // ChannelValue lives in NIRS/Precision.h
 
     struct Line {
         glm::vec3 Start;
@@ -63,6 +65,37 @@ namespace NIRS {
         ProbeID ID;
     };
 
+    // One entry per dataTimeSeries column, as described by measurementList(s)
+    struct Measurement {
+        int SourceIndex = 0;        // 1-indexed
+        int DetectorIndex = 0;      // 1-indexed
+        int WavelengthIndex = 0;    // 1-indexed into probe/wavelengths
+        int DataType = 0;
+        int DataTypeIndex = 0;
+        std::string DataTypeLabel = ""; // Only present for processed data (dataType 99999)
+    };
+
+    // One row of a /nirsN/stimM data table
+    struct StimulusEvent {
+        double Onset = 0.0;     // Seconds, in the time base of the run's time vector
+        double Duration = 0.0;  // Seconds
+        double Amplitude = 1.0;
+    };
+
+    // One /nirsN/stimM condition, the events in file order
+    struct Stimulus {
+        std::string Name = "";
+        std::vector<StimulusEvent> Events = {};
+    };
+
+    // One /nirsN/auxM signal (accelerometer, respiration belt, ...), resampled onto the
+    // run's time vector and kept in the run's registry after the data columns
+    struct AuxChannel {
+        std::string Name = "";
+        std::string Unit = "";
+        ChannelDataID DataIndex = 0;
+    };
+
     struct Channel {
         ChannelID ID;
 
@@ -71,6 +104,13 @@ namespace NIRS {
 
 		ChannelDataID HBODataIndex;
 		ChannelDataID HBRDataIndex;
+
+		// Raw intensity runs only, 0 when the data already holds concentrations.
+		// The HBR data starts out as the shorter wavelength, the HBO data as the longer one.
+		float HBRWavelength = 0.0f;	// nm
+		float HBOWavelength = 0.0f;	// nm
+		float Distance = 0.0f;		// Source-detector separation in cm, 0 when the probe has no positions
+		glm::vec3 Position = glm::vec3(0.0f); // Midpoint of source and detector in cm, probe coordinates (not swizzled like Probe3D)
     };
 
     struct ChannelVisualization {
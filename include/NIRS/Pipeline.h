@@ -0,0 +1,258 @@
+#pragma once
+
+#include "Core/Base.h"
+#include "NIRS/NIRS.h"
+#include "NIRS/Snirf.h"
+#include "NIRS/ChannelDataRegistry.h"
+
+#include <vector>
+
+namespace NIRS
+{
+	enum class StageType {
+		OpticalDensity = 0,
+		MBLL,
+		Bandpass,
+		ZNormalize,
+		TDDR,
+		ShortChannelRegression,
+		Resample
+	};
+
+	// Every stage type, in the order the stream editor offers them
+	inline constexpr StageType StageTypes[] = {
+		StageType::Resample,
+		StageType::OpticalDensity,
+		StageType::MBLL,
+		StageType::Bandpass,
+		StageType::TDDR,
+		StageType::ShortChannelRegression,
+		StageType::ZNormalize,
+	};
+
+	static std::string StageTypeToString(StageType type) {
+		switch (type) {
+		case StageType::OpticalDensity: return "Optical Density";
+		case StageType::MBLL: return "Modified Beer-Lambert";
+		case StageType::Bandpass: return "Bandpass";
+		case StageType::ZNormalize: return "Z-Normalize";
+		case StageType::TDDR: return "TDDR Motion Correction";
+		case StageType::ShortChannelRegression: return "Short Channel Regression";
+		case StageType::Resample: return "Resample";
+		}
+		return "INVALID";
+	}
+
+	// What the samples of a stage result hold
+	enum class SignalType {
+		Intensity = 0,
+		OpticalDensity,
+		Concentration
+	};
+
+	static std::string SignalTypeToString(SignalType type) {
+		switch (type) {
+		case SignalType::Intensity: return "Intensity";
+		case SignalType::OpticalDensity: return "Optical Density";
+		case SignalType::Concentration: return "Concentration";
+		}
+		return "INVALID";
+	}
+
+	// Output of one stage. Data is indexed like the run's raw registry, so a channel's
+	// HBODataIndex and HBRDataIndex work in every stage result.
+	struct StageResult {
+		Ref<ChannelDataRegistry> Data = nullptr;
+		SignalType Type = SignalType::Intensity;
+		double SamplingRate = 0.0;
+		std::vector<double> Time = {};
+		bool Lazy = false; // Data fetches its arrays on demand, only read it from one thread
+	};
+
+	// A tweakable stage parameter, described generically so the editor can draw it
+	// without the stages knowing about ImGui. Value points into the stage.
+	struct StageParameter {
+		enum class Kind { Float, Int, Bool };
+
+		const char* Name = "";
+		Kind Type = Kind::Float;
+		void* Value = nullptr;
+		float Min = 0.0f;
+		float Max = 0.0f;
+	};
+
+	struct StageContext {
+		const SNIRFRun& Run;
+	};
+
+	// What the raw registry of 'run' holds: raw intensity for CW amplitudes, otherwise
+	// processed data whose labels tell optical density from concentrations
+	SignalType GetSourceSignalType(const SNIRFRun& run);
+
+	// What SNIRF::PreprocessRun leaves in run.ProcessedRegistry with 'settings': concentrations
+	// when the raw data already are or every channel can go through MBLL, otherwise optical density
+	SignalType GetProcessedSignalType(const SNIRFRun& run, const PreprocessingSettings& settings);
+
+	class ProcessingStage {
+	public:
+		virtual ~ProcessingStage() = default;
+
+		virtual StageType GetType() const = 0;
+		std::string GetName() const { return StageTypeToString(GetType()); }
+
+		virtual std::vector<StageParameter> GetParameters() { return {}; }
+
+		virtual bool AcceptsInput([[maybe_unused]] SignalType type) const { return true; }
+		// Whether the run's metadata has what the stage needs, checked with the input type before anything runs
+		virtual bool AcceptsRun([[maybe_unused]] const SNIRFRun& run) const { return true; }
+		virtual SignalType GetOutputType(SignalType input) const { return input; }
+
+		// Fills 'output' from 'input', both indexed like the raw registry. Runs on the calling
+		// thread and spreads the work over the ThreadPool itself.
+		virtual void Process(const StageContext& context, const StageResult& input, StageResult& output) const = 0;
+
+		// A disabled stage passes its input through untouched
+		bool Enabled = true;
+	};
+
+	Ref<ProcessingStage> CreateStage(StageType type);
+
+	class OpticalDensityStage : public ProcessingStage {
+	public:
+		StageType GetType() const override { return StageType::OpticalDensity; }
+		bool AcceptsInput(SignalType type) const override { return type == SignalType::Intensity; }
+		SignalType GetOutputType(SignalType) const override { return SignalType::OpticalDensity; }
+		void Process(const StageContext& context, const StageResult& input, StageResult& output) const override;
+	};
+
+	// Optical density pairs to HbO / HbR, see ComputeMBLLMatrix. Only takes runs whose channels
+	// all have both wavelengths in their own arrays, processed files have nothing to convert.
+	class MBLLStage : public ProcessingStage {
+	public:
+		float DifferentialPathlengthFactor = 6.0f;
+		float FallbackDistance = 3.0f; // cm
+
+		StageType GetType() const override { return StageType::MBLL; }
+		std::vector<StageParameter> GetParameters() override;
+		bool AcceptsInput(SignalType type) const override { return type == SignalType::OpticalDensity; }
+		bool AcceptsRun(const SNIRFRun& run) const override;
+		SignalType GetOutputType(SignalType) const override { return SignalType::Concentration; }
+		void Process(const StageContext& context, const StageResult& input, StageResult& output) const override;
+	};
+
+	class BandpassStage : public ProcessingStage {
+	public:
+		float LowerCutoff = 0.01f;
+		float HigherCutoff = 0.1f;
+		int Order = 5;
+
+		StageType GetType() const override { return StageType::Bandpass; }
+		std::vector<StageParameter> GetParameters() override;
+		void Process(const StageContext& context, const StageResult& input, StageResult& output) const override;
+	};
+
+	class ZNormalizeStage : public ProcessingStage {
+	public:
+		StageType GetType() const override { return StageType::ZNormalize; }
+		void Process(const StageContext& context, const StageResult& input, StageResult& output) const override;
+	};
+
+	// Motion correction, see TemporalDerivativeDistributionRepair. Meant for optical density
+	// or concentrations, raw intensities have to go through OpticalDensityStage first.
+	class TDDRStage : public ProcessingStage {
+	public:
+		StageType GetType() const override { return StageType::TDDR; }
+		bool AcceptsInput(SignalType type) const override { return type != SignalType::Intensity; }
+		void Process(const StageContext& context, const StageResult& input, StageResult& output) const override;
+	};
+
+	// Channels whose source-detector separation is below ShortDistance only see the scalp.
+	// Every other channel has the nearest short channel (by midpoint) regressed out, HbO from
+	// HbO and HbR from HbR, see RegressShortChannel. Short channels are passed through.
+	class ShortChannelRegressionStage : public ProcessingStage {
+	public:
+		float ShortDistance = 1.5f; // cm
+
+		StageType GetType() const override { return StageType::ShortChannelRegression; }
+		std::vector<StageParameter> GetParameters() override;
+		bool AcceptsInput(SignalType type) const override { return type != SignalType::Intensity; }
+		void Process(const StageContext& context, const StageResult& input, StageResult& output) const override;
+	};
+
+	// Anti-aliased polyphase resampling of every array to about TargetRate, see ResamplePolyphase.
+	// The result is a reduced-rate copy of the store with its own SamplingRate and Time, so
+	// every stage below it (and the plots) work on fewer samples. Placed first, it also saves
+	// the work of the stages that would otherwise run at the recorded rate.
+	class ResampleStage : public ProcessingStage {
+	public:
+		float TargetRate = 10.0f; // Hz
+
+		StageType GetType() const override { return StageType::Resample; }
+		std::vector<StageParameter> GetParameters() override;
+		void Process(const StageContext& context, const StageResult& input, StageResult& output) const override;
+	};
+
+	// Processing stream: a DAG of stages, each fed by one other stage or by the run's raw data.
+	// Every stage keeps its last result under a key chained from its input's key, its type and
+	// its parameters, so after a parameter change Run only recomputes that stage and the ones below it.
+	class ProcessingPipeline {
+	public:
+		using StageID = uint32_t;
+		static constexpr StageID Source = 0; // The run's raw registry
+
+		// OD -> Bandpass -> MBLL, what the loader does for raw intensity files
+		static Ref<ProcessingPipeline> CreateDefault();
+		// The part of that chain 'run' can take: no OD for processed files, no MBLL without wavelengths
+		static Ref<ProcessingPipeline> CreateDefault(const SNIRFRun& run);
+
+		StageID AddStage(StageType type, StageID input);
+		StageID AddStage(const Ref<ProcessingStage>& stage, StageID input);
+		// Stages fed by 'id' are fed by its input instead
+		void RemoveStage(StageID id);
+
+		Ref<ProcessingStage> GetStage(StageID id) const;
+		StageID GetInput(StageID id) const;
+
+		// The stage plotted by default, the last one added
+		StageID GetOutput() const { return m_Output; }
+		void SetOutput(StageID id) { m_Output = id; }
+
+		// Stages from the source down to 'id', in execution order
+		std::vector<StageID> GetChain(StageID id) const;
+
+		// Follows the signal type from the source down to 'output' without running anything.
+		// False, with the first stage that cannot take its input in 'error', when the chain does not fit 'run'.
+		bool Validate(const SNIRFRun& run, StageID output, std::string* error = nullptr) const;
+
+		// Brings 'output' up to date for 'run' and returns its result, nullptr if the
+		// chain does not validate for it
+		Ref<const StageResult> Run(const SNIRFRun& run, StageID output);
+		Ref<const StageResult> Run(const SNIRFRun& run) { return Run(run, m_Output); }
+
+		// Stages recomputed by the last Run, the others came from the cache
+		size_t GetRecomputedCount() const { return m_RecomputedCount; }
+		void ClearCache();
+
+	private:
+		struct Node {
+			StageID ID = Source;
+			StageID Input = Source;
+			Ref<ProcessingStage> Stage = nullptr;
+
+			uint64_t Key = 0;
+			Ref<const StageResult> Result = nullptr;
+		};
+
+		std::vector<Node> m_Nodes = {};
+		StageID m_NextID = 1;
+		StageID m_Output = Source;
+
+		Ref<const StageResult> m_Source = nullptr;
+		uint64_t m_SourceKey = 0;
+		size_t m_RecomputedCount = 0;
+
+		Node* FindNode(StageID id);
+		const Node* FindNode(StageID id) const;
+		Ref<const StageResult> Evaluate(const StageContext& context, StageID id, uint64_t& key);
+	};
+}
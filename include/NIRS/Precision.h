@@ -0,0 +1,14 @@
+#pragma once
+
+// Storage precision of channel samples. Building with NVIZ_SINGLE_PRECISION (CMake option of
+// the same name) stores samples as float, halving the memory and bandwidth of the channel store.
+// Time vectors, filter coefficients and filter state stay double either way.
+namespace NIRS {
+#ifdef NVIZ_SINGLE_PRECISION
+	using ChannelValue = float;
+	constexpr const char* ChannelValueName = "float32";
+#else
+	using ChannelValue = double;
+	constexpr const char* ChannelValueName = "float64";
+#endif
+}
@@ -1,17 +1,104 @@
 #pragma once
 
 #include "Core/Base.h"
+#include "Core/Span.h"
 #include "NIRS/NIRS.h"
 
+#include <Eigen/Core>
+
 namespace NIRS
 {
+	struct PreprocessingSettings {
+		// 0.01 to 0.1 Hz - Typical hemodynamic response range
+		float LowerCutoff = 0.01f;
+		float HigherCutoff = 0.1f;
+		int FilterOrder = 5; // Butterworth order, the bandpass has twice as many poles
+
+		// Modified Beer-Lambert Law, raw intensity runs only
+		bool ConvertToHemoglobin = true;
+		float DifferentialPathlengthFactor = 6.0f;
+		float FallbackDistance = 3.0f; // cm, for channels whose optodes have no usable position
+	};
+
+	// Optical density and bandpass of one raw intensity series.
+	// 'processedData' must be as long as 'rawData', it may be a registry view.
+	void PreprocessHemodynamicData(Span<const NIRS::ChannelValue> rawData,
+		Span<NIRS::ChannelValue> processedData,
+		float samplingRate,
+		const PreprocessingSettings& settings = {});
+
+	// The same over several series of one length at once, the bandpass filtering them
+	// DefaultFilterLanes at a time (see FiltFiltChannels). Series i of 'rawData' goes to series i of 'processedData'.
+	void PreprocessHemodynamicData(Span<const Span<const NIRS::ChannelValue>> rawData,
+		Span<const Span<NIRS::ChannelValue>> processedData,
+		float samplingRate,
+		const PreprocessingSettings& settings = {});
+
+	// log10(I0 / I) against the first sample, 0 where the intensity is not positive
+	void ConvertToOpticalDensity(Span<const NIRS::ChannelValue> intensity, Span<NIRS::ChannelValue> opticalDensity);
+
+	// Subtracts the mean and divides by the standard deviation, in place
+	void NormalizeZScore(Span<NIRS::ChannelValue> data);
+
+	// Temporal Derivative Distribution Repair (Fishburn et al., 2019) of one optical density or
+	// concentration series, in place. The part below 0.5 Hz is differentiated, the derivative is
+	// reweighted with Tukey's biweight until its robust mean settles and integrated back, so
+	// spikes and baseline shifts from motion are pulled into the distribution of the clean signal.
+	// Works in per-thread scratch buffers, nothing is allocated once they have grown to the length.
+	void TemporalDerivativeDistributionRepair(Span<double> data, float sampleRate);
+
+	// Short-separation regression: removes from every long channel the part explained by
+	// 'shortChannel' (least squares with an intercept, so each long channel keeps its mean).
+	// The design matrix is factorized once and solved for all long channels together.
+	void RegressShortChannel(Span<const NIRS::ChannelValue> shortChannel, Span<const Span<NIRS::ChannelValue>> longChannels);
+
+	// --- Resampling ---
+
+	// Samples resampling 'length' samples by up / down gives, ceil(length * up / down)
+	size_t GetResampledLength(size_t length, int up, int down);
+
+	// Smallest ratio up / down (up <= maxUp, reduced) taking 'sampleRate' within 0.1 % of
+	// 'targetRate', else the closest one. Rates averaged from a time vector are rarely exact,
+	// so 50.002 Hz to 10 Hz is 1 / 5 rather than a long filter for an exact fraction.
+	std::pair<int, int> GetResamplingRatio(double sampleRate, double targetRate, int maxUp = 32);
+
+	// Anti-aliased rational resampling by up / down, as scipy.signal.resample_poly(x, up, down,
+	// padtype='edge'): the polyphase filter from FilterDesignCache only computes the samples that
+	// are kept, each as one vectorised dot product, and the edges repeat the first and last sample
+	// so intensities do not droop towards zero. 'output' takes GetResampledLength samples.
+	// Unlike the filters there is no SOSFilterBank style lane version: each output is
+	// already a SIMD dot product over its taps, and a version with one channel per lane
+	// measured 1.4 to 2x slower, the interleaving costs more than it saves.
+	void ResamplePolyphase(Span<const NIRS::ChannelValue> input, Span<NIRS::ChannelValue> output, int up, int down);
+
+	// --- Modified Beer-Lambert Law ---
+	struct ExtinctionCoefficients {
+		double HbO = 0.0;
+		double HbR = 0.0;
+	};
+
+	// Molar extinction coefficients in 1/(cm M), base 10, from Prahl's tabulation.
+	// Linearly interpolated between 10 nm steps, clamped to 650 - 950 nm.
+	ExtinctionCoefficients GetExtinctionCoefficients(double wavelength);
 
-	void PreprocessHemodynamicData(const std::vector<NIRS::ChannelValue>& rawData,
-		std::vector<NIRS::ChannelValue>& processedData,
-		float samplingRate);
+	// Inverse of the 2x2 MBLL system of one source-detector pair: maps the optical density
+	// changes at (hbrWavelength, hboWavelength) to (HbO, HbR) concentration changes in uM
+	Eigen::Matrix2d ComputeMBLLMatrix(double hbrWavelength, double hboWavelength, double distanceCm, double dpf);
 
+	// In place: 'hbr' holds the optical density at the shorter wavelength and becomes HbR,
+	// 'hbo' the optical density at the longer one and becomes HbO
+	void ApplyModifiedBeerLambert(const Eigen::Matrix2d& matrix, Span<NIRS::ChannelValue> hbr, Span<NIRS::ChannelValue> hbo);
 
-	void ButterworthBandpassFilter(std::vector<NIRS::ChannelValue>& data, float sampleRate, float lowerCutoff, float higherCutoff);
+	// Zero-phase Butterworth bandpass designed for 'sampleRate', see NIRS/Filter.h.
+	// A cutoff at or above Nyquist falls back to a highpass, one at or below 0 Hz to a lowpass.
+	// Filters in place and in double whatever the storage precision, without allocating
+	// once the calling thread has filtered with a design of the same order.
+	void ButterworthBandpassFilter(Span<double> data, float sampleRate, float lowerCutoff, float higherCutoff, int order = 5);
+	// Several channels of 'samples' samples each, filtered DefaultFilterLanes at a time
+	void ButterworthBandpassFilter(Span<double* const> channels, size_t samples, float sampleRate, float lowerCutoff, float higherCutoff, int order = 5);
+	// Out of place from series of one length, series i of 'input' to series i of 'output', through per-thread double buffers
+	void ButterworthBandpassFilter(Span<const Span<const NIRS::ChannelValue>> input, Span<const Span<NIRS::ChannelValue>> output,
+		float sampleRate, float lowerCutoff, float higherCutoff, int order = 5);
 
 }
 
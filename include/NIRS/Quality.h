@@ -0,0 +1,70 @@
+#pragma once
+
+#include "Core/Base.h"
+#include "Core/Span.h"
+#include "NIRS/NIRS.h"
+#include "NIRS/Snirf.h"
+
+#include <map>
+#include <mutex>
+
+namespace NIRS
+{
+	// Signal quality from the heartbeat both wavelengths of a well coupled channel pick up,
+	// after Pollonini et al. (2014, 2016) and their QT-NIRS toolbox
+	struct QualitySettings {
+		float WindowSeconds = 5.0f;
+		float StepSeconds = 5.0f;		// Equal to the window: back to back windows, as QT-NIRS
+		float CardiacLowCutoff = 0.5f;	// Hz
+		float CardiacHighCutoff = 2.5f;	// Hz
+
+		// A window is good when both indices reach their threshold
+		float SCIThreshold = 0.8f;
+		float PSPThreshold = 0.1f;
+	};
+
+	struct ChannelQuality {
+		// One value per window
+		std::vector<float> SCI = {};	// Scalp coupling index, zero-lag correlation of the wavelengths
+		std::vector<float> PSP = {};	// Peak spectral power of their cross-correlation in the cardiac band
+
+		float MedianSCI = 0.0f;
+		float MedianPSP = 0.0f;
+		float GoodFraction = 0.0f;		// Share of windows passing both thresholds
+	};
+
+	struct QualityReport {
+		QualitySettings Settings;
+		double WindowStep = 0.0;		// Seconds between window starts
+		size_t WindowCount = 0;
+		std::vector<ChannelQuality> Channels = {}; // Indexed like SNIRFRun::Channels
+	};
+
+	// Windowed SCI and PSP of one channel from its two wavelengths, raw intensity or optical
+	// density. Both are cardiac bandpassed and z-scored, then every window's normalised
+	// cross-correlation gives the SCI at lag zero and, through a Hamming windowed periodogram,
+	// the PSP. Returns no windows when the rate cannot resolve the cardiac band.
+	ChannelQuality ComputeChannelQuality(Span<const NIRS::ChannelValue> first, Span<const NIRS::ChannelValue> second,
+		double sampleRate, const QualitySettings& settings = {});
+
+	// Every channel of the run, across the ThreadPool unless the run is lazily loaded
+	Ref<const QualityReport> ComputeRunQuality(const SNIRFRun& run, const QualitySettings& settings = {});
+
+	// Reports are computed once per file version, run and settings and shared afterwards,
+	// so redrawing or reselecting channels never recomputes them
+	class ChannelQualityCache {
+	public:
+		static Ref<const QualityReport> Get(const std::string& filepath, const SNIRFRun& run, const QualitySettings& settings = {});
+		// nullptr when that report was not computed yet
+		static Ref<const QualityReport> Find(const std::string& filepath, const SNIRFRun& run, const QualitySettings& settings = {});
+
+		static size_t GetSize();
+		static void Clear();
+
+	private:
+		static uint64_t GetKey(const std::string& filepath, const SNIRFRun& run, const QualitySettings& settings);
+
+		static std::mutex s_Mutex;
+		static std::map<uint64_t, Ref<const QualityReport>> s_Reports;
+	};
+}
@@ -3,92 +3,148 @@
 
 #include <string>
 #include <filesystem>
+#include <atomic>
+#include <functional>
+#include <mutex>
 
 #include <Eigen/Dense>
 
 #include <highfive/H5Group.hpp>
 
 #include "NIRS/NIRS.h"
+#include "NIRS/EventIndex.h"
+#include "NIRS/Processing.h"
+#include "NIRS/ChannelDataRegistry.h"
 
-class ChannelDataRegistry {
-	using ChannelData = std::vector<double>;
-public:
-	ChannelDataRegistry() {
-	};
-
-	int SubmitChannelData(const ChannelData& data) {
-		std::size_t hash_val = HashChannelData(data);
-
-		if (m_LookupMap.count(hash_val)) { 
-			int potential_index = m_LookupMap.at(hash_val);
-			if (m_DataStorage[potential_index] == data) {
-				return potential_index;
-			}
-		}
-
-		int new_index = static_cast<int>(m_DataStorage.size());
-		m_DataStorage.push_back(data); 
-
-		m_LookupMap[hash_val] = new_index;
-
-		return new_index;
-	}
-	const ChannelData& GetChannelData(int index) const {
-		if (index < 0 || index >= m_DataStorage.size()) {
-			NVIZ_ERROR("Invalid channel data index: {}", index);
-			throw std::out_of_range("Invalid channel data index.");
-		}
-		return m_DataStorage[index];
-	}
-	
-	void Clear() {
-		m_DataStorage.clear();
-		m_LookupMap.clear();
-	}
+namespace HighFive { class File; }
 
-private:
-	std::vector<ChannelData> m_DataStorage;
-
-	// Map to quickly check if a vector with the same content hash already exists.
-	// Key: Hash of the ChannelData content. Value: Index in data_storage_.
-	std::unordered_map<std::size_t, int> m_LookupMap;
-
-	std::size_t HashChannelData(const ChannelData& data) const {
-		// Simple hash combining the size and a few values.
-		// For a more robust solution, a non-cryptographic polynomial rolling hash
-		// (like FNV-1a or MurmurHash) is usually better. 
-		// For demonstration, here's a basic size-and-checksum-based hash:
-
-		std::size_t seed = data.size();
-		for (double d : data) {
-			// Combine hash of the double with the current seed
-			// This is a common pattern for combining hashes in C++
-			std::hash<double> double_hasher;
-			seed ^= double_hasher(d) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-		}
-		return seed;
-	}
-
-	static ChannelDataRegistry* s_Instance;
+enum class ChannelLoadMode {
+	Eager = 0,	// Stream every channel into memory while the file is opened
+	Lazy = 1,	// Only read metadata on open, fetch channel columns on first access
+	Auto = 2	// Lazy when the data would not fit in the channel cache budget
+};
+
+struct SNIRFLoadSettings {
+	// Number of samples (rows of dataTimeSeries) pulled per hyperslab read.
+	// 0 reads the whole dataset in a single selection.
+	size_t ChunkSamples = 4096;
+
+	ChannelLoadMode LoadMode = ChannelLoadMode::Auto;
+	size_t ChannelCacheBudgetBytes = 256ull * 1024ull * 1024ull;
+
+	// Reuse/write the <file>.snirf.nvizcache sidecar so reopening skips HDF5 and preprocessing
+	bool UseSessionCache = true;
+	NIRS::PreprocessingSettings Preprocessing;
 };
 
+// One /nirsN/dataM block. Time, channels and samples belong to a run,
+// the probe belongs to the nirs entry the run lives in.
+struct SNIRFRun {
+	std::string NirsName = "";	// "nirs", "nirs2", ...
+	std::string DataName = "";	// "data1", "data2", ...
+	std::string GetName() const { return NirsName + "/" + DataName; }
+
+	double SamplingRate = 0.0;
+	double DurationSeconds = 0.0;
+	std::vector<double> Time = {};
+
+	std::vector<NIRS::Measurement> Measurements = {};
+	std::vector<NIRS::Channel> Channels = {};
+	std::map<NIRS::ChannelID, NIRS::Channel> ChannelMap = {};
+	size_t NumDataColumns = 0;
+
+	// Conditions of the nirs entry the run lives in, shared by all of its data blocks
+	std::vector<NIRS::Stimulus> Stimuli = {};
+	NIRS::EventIndex Events;	// The stimuli sorted by onset, rebuilt whenever Stimuli is read
+	// Aux signals, their arrays follow the NumDataColumns data columns in Registry (and ProcessedRegistry, unprocessed)
+	std::vector<NIRS::AuxChannel> Aux = {};
+
+	Ref<ChannelDataRegistry> Registry = CreateRef<ChannelDataRegistry>();
+	// The bandpassed data, as HbR / HbO concentration changes (uM) where every channel has its
+	// two wavelengths (Channel::HBRWavelength set), see NIRS::GetProcessedSignalType. Indexed like Registry,
+	// so a channel's HBODataIndex and HBRDataIndex work in both. Empty for lazily loaded runs.
+	Ref<ChannelDataRegistry> ProcessedRegistry = CreateRef<ChannelDataRegistry>();
+	bool LazyLoaded = false;
+
+	bool HasProcessedData() const { return ProcessedRegistry->GetChannelCount() > 0; }
+
+	std::atomic<size_t> LoadedSamples{ 0 };
+	std::atomic<bool> Loaded{ false };
+	std::mutex LoadMutex;
+};
+
+namespace NIRS {
+	// Fill 'measurements', already sized to the columns of dataTimeSeries, from a /nirsN/dataM group.
+	// The SNIRF v1.1 compact 'measurementLists' table takes one read per field for every column.
+	// Returns false, leaving the rest to ReadMeasurementGroups, when it is missing or has fewer entries.
+	bool ReadMeasurementTable(const HighFive::Group& data, std::vector<Measurement>& measurements);
+	// The measurementListN groups, the optional label only read for processed data
+	void ReadMeasurementGroups(const HighFive::Group& data, std::vector<Measurement>& measurements);
+}
+
 class SNIRF {
 public:
+	// Called after every chunk with the number of samples read so far and the total.
+	using ChunkLoadedCallback = std::function<void(size_t, size_t)>;
+	// Called once a run's channel table exists, before its samples are streamed in.
+	using MetadataLoadedCallback = std::function<void(const SNIRFRun&)>;
+	// Called when a channel of a run is fully read and preprocessed (or read, for lazy runs).
+	using ChannelReadyCallback = std::function<void(const SNIRFRun&, NIRS::ChannelID)>;
+
 	SNIRF();
 	SNIRF(const std::filesystem::path& filepath);
+	SNIRF(const std::filesystem::path& filepath, const SNIRFLoadSettings& settings);
 
 	void Print();
 
+	// Enumerates every /nirsN/dataM run and loads the first one, the others are loaded on demand.
 	void LoadFile(const std::filesystem::path& filepath);
 
 	void ParseMetadataTags(const HighFive::Group& metadata);
 	void ParseProbe(const HighFive::Group& probe);
-	void ParseData1(const HighFive::Group& data1);
+	void ParseDataBlock(const HighFive::Group& data, SNIRFRun& run);
+	void ParseMeasurementLists(const HighFive::Group& data, SNIRFRun& run);
+	void ParseStimuli(const HighFive::Group& nirs, SNIRFRun& run);
+	// Appends every aux signal to the run's registry, linearly interpolated at the run's sample times
+	void ParseAux(const HighFive::Group& nirs, SNIRFRun& run);
+
+	// --- Runs ---
+	size_t GetRunCount() const { return m_Runs.size(); };
+	const SNIRFRun& GetRun(size_t index) const { return *m_Runs[index]; };
+	size_t GetActiveRunIndex() const { return m_ActiveRun; };
+
+	// Loads the run if needed and makes it the one the getters below refer to
+	void SetActiveRun(size_t index);
+	// Loads a single run, safe to call from several threads at once
+	bool LoadRun(size_t index);
+	// Loads every run that is not loaded yet, in parallel on the ThreadPool
+	void LoadAllRuns();
+
+	// Every HighFive call in the process goes through this lock, HDF5 is not reentrant
+	static std::mutex& GetHDF5Mutex();
+
+	// Implemented in SnirfCache.cpp
+	bool LoadSessionCache(SNIRFRun& run, const std::filesystem::path& cachePath, uint64_t key, bool loadProbe);
+	void WriteSessionCache(const SNIRFRun& run, const std::filesystem::path& cachePath, uint64_t key);
 
 	std::string GetFilepath() { return m_Filepath.string(); };
 
 	bool IsFileLoaded() { return !m_Filepath.empty(); };
 
+	void SetLoadSettings(const SNIRFLoadSettings& settings) { m_LoadSettings = settings; };
+	const SNIRFLoadSettings& GetLoadSettings() const { return m_LoadSettings; };
+	// The callbacks run on the loading thread, the channel ready one on the ThreadPool workers filtering the run
+	void SetChunkLoadedCallback(const ChunkLoadedCallback& callback) { m_ChunkLoadedCallback = callback; };
+	void SetMetadataLoadedCallback(const MetadataLoadedCallback& callback) { m_MetadataLoadedCallback = callback; };
+	void SetChannelReadyCallback(const ChannelReadyCallback& callback) { m_ChannelReadyCallback = callback; };
+
+	bool IsLazyLoaded() const { return ActiveRun().LazyLoaded; };
+	// Stimuli, the event index and the aux signals are read after the samples, only use them once this is set
+	bool IsRunLoaded() const { return ActiveRun().Loaded.load(std::memory_order_acquire); };
+
+	// Samples per channel that are already in the registry. Equal to GetTime().size() once loading is done.
+	size_t GetLoadedSampleCount() const { return ActiveRun().LoadedSamples.load(std::memory_order_acquire); };
+
 
 	//std::vector<NIRS::Landmark> GetLandmarks() { return m_ManualLandmarks; };
 	std::map<NIRS::ProbeID, NIRS::Probe2D> GetSource2DMap() { return m_Source2DMap; };
@@ -109,29 +165,49 @@ public:
 	NIRS::Probe2D GetSource2D(int index) { return m_Sources2D[index]; };
 	NIRS::Probe3D GetSource3D(int index) { return m_Sources3D[index]; };
 
-	std::map<NIRS::ChannelID, NIRS::Channel> GetChannelMap() { return m_ChannelMap; };
-	std::vector<NIRS::Channel> GetChannels() { return m_Channels; };
+	// References into the active run, valid until the run changes. The plotting panel reads them every frame.
+	const std::map<NIRS::ChannelID, NIRS::Channel>& GetChannelMap() const { return ActiveRun().ChannelMap; };
+	const std::vector<NIRS::Channel>& GetChannels() const { return ActiveRun().Channels; };
 
 	std::vector<int> GetWavelengths() { return m_Wavelengths; };
+	const std::vector<NIRS::Measurement>& GetMeasurements() const { return ActiveRun().Measurements; };
 
 	int GetSourceAmount()	{ return m_Sources2D.size(); };
 	int GetDetectorAmount()	{ return m_Detectors2D.size(); };
 
-	double GetSamplingRate() { return m_SamplingRate; };
-	std::vector<double> GetTime() { return m_Time; };
+	double GetSamplingRate() const { return ActiveRun().SamplingRate; };
+	const std::vector<double>& GetTime() const { return ActiveRun().Time; };
+	const std::vector<NIRS::Stimulus>& GetStimuli() const { return ActiveRun().Stimuli; };
+	const NIRS::EventIndex& GetEventIndex() const { return ActiveRun().Events; };
+	const std::vector<NIRS::AuxChannel>& GetAuxChannels() const { return ActiveRun().Aux; };
 
-	Ref<ChannelDataRegistry> GetChannelDataRegistry() { return m_ChannelDataRegistry; }
+	Ref<ChannelDataRegistry> GetChannelDataRegistry() { return ActiveRun().Registry; }
+	Ref<ChannelDataRegistry> GetProcessedChannelDataRegistry() { return ActiveRun().ProcessedRegistry; }
 private:
 	std::filesystem::path m_Filepath = std::filesystem::path("");
 
-	Eigen::Matrix<double,
-		Eigen::Dynamic,
-		Eigen::Dynamic,
-		Eigen::RowMajor> m_ChannelData;
+	SNIRFLoadSettings m_LoadSettings;
+	ChunkLoadedCallback m_ChunkLoadedCallback = nullptr;
+	MetadataLoadedCallback m_MetadataLoadedCallback = nullptr;
+	ChannelReadyCallback m_ChannelReadyCallback = nullptr;
+
+	// Opened on demand, kept open while runs are unloaded or lazily loaded
+	Ref<HighFive::File> m_File = nullptr;
+	void OpenFile();
+	void ReleaseFileIfUnused();
+	void ClearProbe();
 
-	double m_SamplingRate = 0.0;
-	double m_DurationSeconds = 0.0;
-	std::vector<double> m_Time = {};
+	// Runs PreprocessHemodynamicData over every raw array of the run in parallel on the
+	// ThreadPool and stores the results in run.ProcessedRegistry, reporting each channel ready as it is done
+	void PreprocessRun(SNIRFRun& run);
+	void NotifyChannelsReady(const SNIRFRun& run);
+
+	std::vector<Ref<SNIRFRun>> m_Runs = {};
+	size_t m_ActiveRun = 0;
+	std::string m_ProbeNirsName = ""; // The nirs entry the probe members below were parsed from
+
+	SNIRFRun& ActiveRun() { return *m_Runs[m_ActiveRun]; };
+	const SNIRFRun& ActiveRun() const { return *m_Runs[m_ActiveRun]; };
 
 	std::map<NIRS::ProbeID, NIRS::Probe2D> m_Source2DMap = {};
 	std::map<NIRS::ProbeID, NIRS::Probe2D> m_Detector2DMap = {};
@@ -144,10 +220,5 @@ private:
 	std::vector<NIRS::Probe3D> m_Detectors3D = {};
 	//std::vector<NIRS::Landmark> m_Landmarks	 = {};
 	
-	std::map<NIRS::ChannelID, NIRS::Channel> m_ChannelMap = {};
-	std::vector<NIRS::Channel> m_Channels	 = {};
 	std::vector<int> m_Wavelengths			 = {};
-
-	Ref<ChannelDataRegistry> m_ChannelDataRegistry = nullptr;
-
 };
\ No newline at end of file
@@ -0,0 +1,104 @@
+#pragma once
+#include "Core/Base.h"
+
+#include <filesystem>
+
+#include "NIRS/NIRS.h"
+#include "NIRS/Processing.h"
+
+// Binary sidecar written next to a SNIRF file (<file>.snirf.nvizcache) holding everything
+// needed to reopen the session without touching HDF5: the run list, probe, channel and
+// measurement tables, the time vector, the stimuli, the aux signals and the raw and preprocessed channel arrays of the first run.
+// Other runs get their own <file>.snirf.<nirs>.<data>.nvizcache without the probe.
+// Every section starts on a SessionCacheAlignment boundary so the file can be memory
+// mapped and used in place.
+namespace NIRS {
+
+	constexpr char SessionCacheMagic[8] = { 'N', 'V', 'I', 'Z', 'S', 'N', 'C', '\0' };
+	constexpr uint32_t SessionCacheVersion = 8;
+	constexpr size_t SessionCacheAlignment = 64;
+
+	enum SessionCacheSection : uint32_t {
+		CACHE_SOURCES_2D = 0,
+		CACHE_DETECTORS_2D,
+		CACHE_SOURCES_3D,
+		CACHE_DETECTORS_3D,
+		CACHE_WAVELENGTHS,
+		CACHE_MEASUREMENTS,
+		CACHE_CHANNELS,
+		CACHE_TIME,
+		CACHE_CHANNEL_DATA,
+		CACHE_RUNS,
+		CACHE_PROCESSED_DATA, // Same layout as CACHE_CHANNEL_DATA, empty for lazily loaded runs
+		CACHE_STIMULI,
+		CACHE_STIMULUS_EVENTS, // Every condition's events back to back, see CachedStimulus
+		CACHE_AUX,
+		CACHE_SECTION_COUNT
+	};
+
+	struct SessionCacheSectionInfo {
+		uint64_t Offset = 0;		// Bytes from the start of the file
+		uint64_t Count = 0;			// Number of elements
+		uint64_t ElementSize = 0;	// sizeof one element, guards against layout changes
+	};
+
+	struct SessionCacheHeader {
+		char Magic[8] = {};
+		uint32_t Version = 0;
+		uint32_t HeaderSize = 0;
+		uint64_t Key = 0;
+		int64_t SourceModifiedTime = 0;
+
+		double SamplingRate = 0.0;
+		double DurationSeconds = 0.0;
+
+		uint64_t NumSamples = 0;		// Samples per channel array
+		uint64_t NumDataArrays = 0;		// Channel arrays in CACHE_CHANNEL_DATA and CACHE_PROCESSED_DATA
+		uint64_t DataArrayStride = 0;	// Samples between array starts, padded to the alignment
+
+		SessionCacheSectionInfo Sections[CACHE_SECTION_COUNT];
+	};
+
+	// NIRS::Measurement without the std::string, so it can live in the mapped file
+	struct CachedMeasurement {
+		int32_t SourceIndex = 0;
+		int32_t DetectorIndex = 0;
+		int32_t WavelengthIndex = 0;
+		int32_t DataType = 0;
+		int32_t DataTypeIndex = 0;
+		char DataTypeLabel[28] = {};
+	};
+
+	// NIRS::Stimulus with its events moved into CACHE_STIMULUS_EVENTS
+	struct CachedStimulus {
+		char Name[56] = {};
+		uint32_t FirstEvent = 0;
+		uint32_t EventCount = 0;
+	};
+
+	// NIRS::AuxChannel, its samples are one of the arrays in CACHE_CHANNEL_DATA
+	struct CachedAuxChannel {
+		char Name[48] = {};
+		char Unit[12] = {};
+		uint32_t DataIndex = 0;
+	};
+
+	// Run name as in "nirs/data1"
+	struct CachedRunName {
+		char NirsName[32] = {};
+		char DataName[32] = {};
+	};
+
+	// An empty run name is the session cache, which stores whichever run comes first in the file
+	std::filesystem::path GetSessionCachePath(const std::filesystem::path& snirfPath, const std::string& runName);
+
+	int64_t GetSourceModifiedTime(const std::filesystem::path& snirfPath);
+
+	// Hash of the absolute SNIRF path, its modification time, the run, the preprocessing
+	// parameters, the sample type and the cache version. A cache is only used when its key matches.
+	uint64_t ComputeSessionCacheKey(const std::filesystem::path& snirfPath, const PreprocessingSettings& settings, const std::string& runName);
+
+	inline size_t AlignSessionCacheOffset(size_t offset) {
+		return (offset + SessionCacheAlignment - 1) & ~(SessionCacheAlignment - 1);
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "Core/Base.h"
+#include "Core/Span.h"
+#include "NIRS/Precision.h"
+#include "NIRS/ChannelDataRegistry.h"
+
+#include <complex>
+#include <map>
+#include <mutex>
+
+namespace NIRS
+{
+	// Real input FFT of one power-of-two size: a half size complex radix-2 transform and a
+	// split step. Twiddles and the bit reversal table are built once, so one plan serves every
+	// transform of that size, from any number of threads.
+	class FFTPlan {
+	public:
+		FFTPlan(size_t size);
+
+		size_t GetSize() const { return m_Size; }
+		size_t GetBinCount() const { return m_Size / 2 + 1; }
+
+		// Spectrum of GetSize() real samples into GetBinCount() bins, unnormalised.
+		// 'spectrum' doubles as the work buffer, nothing is allocated.
+		void Forward(const double* input, std::complex<double>* spectrum) const;
+
+	private:
+		size_t m_Size = 0;
+		std::vector<uint32_t> m_BitReverse;				// Of the half size transform
+		std::vector<std::complex<double>> m_Twiddles;	// exp(-2 pi i k / (size / 2))
+		std::vector<std::complex<double>> m_Split;		// exp(-2 pi i k / size)
+	};
+
+	// Plans are shared between channels and views, keyed by size
+	class FFTPlanCache {
+	public:
+		static Ref<const FFTPlan> Get(size_t size);
+
+		static size_t GetSize();
+		static void Clear();
+
+	private:
+		static std::mutex s_Mutex;
+		static std::map<size_t, Ref<const FFTPlan>> s_Plans;
+	};
+
+	struct SpectralSettings {
+		float SegmentSeconds = 100.0f;	// Resolution is about 1 / SegmentSeconds Hz
+		float Overlap = 0.5f;			// Share of a segment the next one starts within
+	};
+
+	// One-sided power spectral density, bin k at k * FrequencyStep Hz
+	struct PowerSpectrum {
+		double FrequencyStep = 0.0;
+		std::vector<double> Power = {}; // unit^2 / Hz
+	};
+
+	struct Spectrogram {
+		double FrequencyStep = 0.0;
+		double TimeStep = 0.0;		// Seconds between frames
+		double StartTime = 0.0;		// Centre of the first frame, from the start of the data
+		size_t Frames = 0;
+		size_t Bins = 0;
+		std::vector<float> Power = {}; // Power[frame * Bins + bin], unit^2 / Hz
+	};
+
+	// Welch's method as scipy.signal.welch: Hann windowed, mean removed segments, zero padded
+	// to a power of two and averaged. Empty when the data is shorter than four samples.
+	PowerSpectrum ComputeWelchPSD(Span<const NIRS::ChannelValue> data, double sampleRate, const SpectralSettings& settings = {});
+
+	// The same segments, one spectrum per frame instead of their average
+	Spectrogram ComputeSpectrogram(Span<const NIRS::ChannelValue> data, double sampleRate, const SpectralSettings& settings = {});
+
+	// Welch spectra of several registry arrays, one per index, across the ThreadPool
+	// unless 'parallel' is off (lazy registries)
+	std::vector<PowerSpectrum> ComputeWelchPSD(const ChannelDataRegistry& registry, Span<const int> indices,
+		double sampleRate, const SpectralSettings& settings = {}, bool parallel = true);
+}